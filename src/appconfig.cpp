@@ -20,9 +20,14 @@
 
 #include "appconfig.hpp"
 
-#include <QBuffer>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QPointer>
 #include <QSettings>
 #include <QMessageBox>
+#include <QThreadPool>
 
 namespace MosConfig {
 
@@ -32,10 +37,135 @@ namespace {
 // write alpha values other than 0x00 or 0xFF for the relevant config).
 constexpr unsigned COMPAT_NO_COLOR_RANGE_ICON = 0xDEADCAFEU;
 
+constexpr char CUSTOM_COLOR_RANGES_KEY[] = "customColorRanges";
+
+constexpr char CUSTOM_PALETTES_KEY[] = "customPalettes";
+
+/**
+ * Version of the binary encoding used for custom color ranges and palettes.
+ */
+constexpr quint32 CUSTOM_DEFINITIONS_FORMAT = 1;
+
+constexpr char RECENT_FILES_PATHS_KEY[] = "recentFiles/paths";
+
+constexpr char RECENT_FILES_THUMBNAILS_GROUP[] = "recentFiles/thumbnails";
+
+/**
+ * Returns the settings key for the thumbnail of a recent file.
+ *
+ * Paths may contain characters that are not valid in keys, so thumbnails are
+ * indexed by a hash of the path instead.
+ */
+QString recentFileThumbnailKey(const QString& filePath)
+{
+	const auto& hash = QCryptographicHash::hash(filePath.toUtf8(), QCryptographicHash::Sha1);
+
+	return QString{RECENT_FILES_THUMBNAILS_GROUP} + '/' + QString::fromLatin1(hash.toHex());
+}
+
+//
+// Custom color ranges and palettes are each stored as a single binary blob
+// rather than as arrays of individual keys, which were very slow to write
+// with a large number of definitions. The arrays written by previous versions
+// are left untouched, so that downgrading does not lose any definitions.
+//
+
+QByteArray encodeColorRanges(const QMap<QString, ColorRange>& colorRanges)
+{
+	QByteArray data;
+	QDataStream out{&data, QIODevice::WriteOnly};
+
+	out.setVersion(QDataStream::Qt_6_0);
+	out << CUSTOM_DEFINITIONS_FORMAT << quint32(colorRanges.count());
+
+	for (const auto& [id, colorRange] : colorRanges.asKeyValueRange())
+	{
+		out << id
+			<< quint32(colorRange.mid())
+			<< quint32(colorRange.max())
+			<< quint32(colorRange.min())
+			<< quint32(colorRange.rep());
+	}
+
+	return data;
+}
+
+bool decodeColorRanges(const QByteArray& data, QMap<QString, ColorRange>& colorRanges)
+{
+	QDataStream in{data};
+	quint32 format = 0, count = 0;
+
+	in.setVersion(QDataStream::Qt_6_0);
+	in >> format >> count;
+
+	if (format != CUSTOM_DEFINITIONS_FORMAT)
+		return false;
+
+	for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+	{
+		QString id;
+		quint32 mid = 0, max = 0, min = 0, rep = 0;
+
+		in >> id >> mid >> max >> min >> rep;
+
+		colorRanges.insert(id, ColorRange{mid, max, min, rep});
+	}
+
+	return in.status() == QDataStream::Ok;
+}
+
+QByteArray encodePalettes(const QMap<QString, ColorList>& palettes)
+{
+	QByteArray data;
+	QDataStream out{&data, QIODevice::WriteOnly};
+
+	out.setVersion(QDataStream::Qt_6_0);
+	out << CUSTOM_DEFINITIONS_FORMAT << palettes;
+
+	return data;
+}
+
+bool decodePalettes(const QByteArray& data, QMap<QString, ColorList>& palettes)
+{
+	QDataStream in{data};
+	quint32 format = 0;
+
+	in.setVersion(QDataStream::Qt_6_0);
+	in >> format;
+
+	if (format != CUSTOM_DEFINITIONS_FORMAT)
+		return false;
+
+	in >> palettes;
+
+	return in.status() == QDataStream::Ok;
+}
+
+/**
+ * Keeps a copy of custom definitions that could not be decoded (e.g. because
+ * they are damaged or were written by a newer version) under a separate key,
+ * since the original key is overwritten as soon as the user changes any of
+ * the definitions.
+ */
+void keepUnreadableDefinitions(QSettings& qs, SettingsStore& settings, const char* key)
+{
+	const auto& backupKey = QString{key} + "Unreadable";
+
+	qWarning().noquote() << "Could not read" << key << "from the configuration,"
+						 << "falling back to the previous format. The original data is kept as"
+						 << backupKey;
+
+	// Never replace an earlier copy with what may be our own output
+	if (!qs.contains(backupKey))
+		settings.setValue(backupKey, qs.value(key));
+}
+
 } // end unnamed namespace
 
 Manager::Manager()
-	: imageFilesMru_()
+	: settings_()
+	, imageFilesMru_()
+	, storedRecentFiles_()
 	, customColorRanges_()
 	, customPalettes_()
 	, rememberMainWindowSize_()
@@ -45,6 +175,8 @@ Manager::Manager()
 	, rememberImageViewMode_()
 	, imageViewMode_()
 	, pngVanityPlate_()
+	, pngProfile_()
+	, traceFile_()
 {
 	QSettings qs;
 
@@ -70,10 +202,99 @@ Manager::Manager()
 
 	pngVanityPlate_ = qs.value("fileOptions/pngVanityPlate", true).toBool();
 
+	pngProfile_ = MosIO::PngProfile(qBound(int(MosIO::PngProfileFast),
+										   qs.value("fileOptions/pngProfile", MosIO::PngProfileBalanced).toInt(),
+										   int(MosIO::PngProfileSmallest)));
+
+	traceFile_ = qs.value("debug/traceFile").toString();
+
 	//
 	// User-defined color ranges
 	//
 
+	if (qs.contains(CUSTOM_COLOR_RANGES_KEY)) {
+		QMap<QString, ColorRange> colorRanges;
+
+		if (decodeColorRanges(qs.value(CUSTOM_COLOR_RANGES_KEY).toByteArray(), colorRanges)) {
+			customColorRanges_ = colorRanges;
+		} else {
+			keepUnreadableDefinitions(qs, settings_, CUSTOM_COLOR_RANGES_KEY);
+			readLegacyColorRanges(qs);
+		}
+	} else {
+		readLegacyColorRanges(qs);
+	}
+
+	//
+	// User-defined color palettes
+	//
+
+	if (qs.contains(CUSTOM_PALETTES_KEY)) {
+		QMap<QString, ColorList> palettes;
+
+		if (decodePalettes(qs.value(CUSTOM_PALETTES_KEY).toByteArray(), palettes)) {
+			customPalettes_ = palettes;
+		} else {
+			keepUnreadableDefinitions(qs, settings_, CUSTOM_PALETTES_KEY);
+			readLegacyPalettes(qs);
+		}
+	} else {
+		readLegacyPalettes(qs);
+	}
+
+	//
+	// Recent files
+	//
+	// Thumbnails are stored separately from the list of paths, so that adding
+	// a file only requires writing its own thumbnail. They are not decoded
+	// until the UI needs them.
+	//
+
+	if (qs.contains(RECENT_FILES_PATHS_KEY)) {
+		const auto& paths = qs.value(RECENT_FILES_PATHS_KEY).toStringList();
+
+		for (auto i = paths.count() - 1; i >= 0; --i)
+		{
+			imageFilesMru_.push(paths[i],
+								qs.value(recentFileThumbnailKey(paths[i])).toString());
+		}
+	} else {
+		// Previous versions stored thumbnails inline in an array
+		const int numRecentFiles = qs.beginReadArray("recent_files");
+
+		for (int i = numRecentFiles - 1; i >= 0; --i)
+		{
+			qs.setArrayIndex(i);
+
+			auto path = qs.value("path").toString();
+			auto thumbnailBase64 = qs.value("thumbnail").toString();
+
+			imageFilesMru_.push(path, thumbnailBase64);
+		}
+
+		qs.endArray();
+
+		if (numRecentFiles > 0) {
+			settings_.remove("recent_files");
+
+			for (const auto& entry : imageFilesMru_)
+			{
+				settings_.setValue(recentFileThumbnailKey(entry.filePath()),
+								   QString::fromLatin1(entry.thumbnailData()));
+			}
+
+			writeRecentFileList();
+		}
+	}
+
+	storedRecentFiles_.clear();
+
+	for (const auto& entry : imageFilesMru_)
+		storedRecentFiles_.push_back(entry.filePath());
+}
+
+void Manager::readLegacyColorRanges(QSettings& qs)
+{
 	const int numRanges = qs.beginReadArray("color_ranges");
 
 	for (int i = 0; i < numRanges; ++i)
@@ -97,19 +318,16 @@ Manager::Manager()
 	}
 
 	qs.endArray();
+}
 
-	//
-	// User-defined color palettes
-	//
-
+void Manager::readLegacyPalettes(QSettings& qs)
+{
 	const int numPals = qs.beginReadArray("palettes");
 
 	for (int i = 0; i < numPals; ++i)
 	{
 		qs.setArrayIndex(i);
 
-		// TODO: use QStringList variant instead
-
 		auto id = qs.value("id").toString();
 		auto values = qs.value("values").toString().split(',', Qt::SkipEmptyParts);
 
@@ -123,182 +341,154 @@ Manager::Manager()
 	}
 
 	qs.endArray();
-
-	//
-	// Recent files
-	//
-
-	const int numRecentFiles = qs.beginReadArray("recent_files");
-
-	for (int i = numRecentFiles - 1; i >= 0; --i)
-	{
-		qs.setArrayIndex(i);
-
-		auto path = qs.value("path").toString();
-		auto thumbnailBase64 = qs.value("thumbnail").toString();
-
-		imageFilesMru_.push(path, thumbnailBase64);
-	}
-
-	qs.endArray();
 }
 
 void Manager::setRememberMainWindowSize(bool remember)
 {
-	QSettings qs;
-
 	rememberMainWindowSize_ = remember;
 
-	qs.setValue("preview/rememberWindowSize", remember);
+	settings_.setValue("preview/rememberWindowSize", remember);
 }
 
 void Manager::setMainWindowSize(const QSize& size)
 {
-	QSettings qs;
-
 	mainWindowSize_ = size;
 
-	qs.setValue("preview/windowSize", size);
+	settings_.setValue("preview/windowSize", size);
 }
 
 void Manager::setDefaultZoom(qreal zoom)
 {
-	QSettings qs;
-
 	defaultZoom_ = zoom;
 
-	qs.setValue("preview/defaultZoom", zoom);
+	settings_.setValue("preview/defaultZoom", zoom);
 }
 
 void Manager::setPreviewBackgroundColor(const QString& previewBackgroundColor)
 {
-	QSettings qs;
-
 	previewBackgroundColor_ = previewBackgroundColor;
 
-	qs.setValue("preview/background", previewBackgroundColor);
+	settings_.setValue("preview/background", previewBackgroundColor);
 }
 
 void Manager::setRememberImageViewMode(bool remember)
 {
-	QSettings qs;
-
 	rememberImageViewMode_ = remember;
 
-	qs.setValue("preview/rememberMode", remember);
+	settings_.setValue("preview/rememberMode", remember);
 }
 
 void Manager::setImageViewMode(ImageViewMode imageViewMode)
 {
-	QSettings qs;
-
 	imageViewMode_ = imageViewMode;
 
-	qs.setValue("preview/mode", imageViewMode);
+	settings_.setValue("preview/mode", imageViewMode);
 }
 
 void Manager::setPngVanityPlate(bool enable)
 {
-	QSettings qs;
-
 	pngVanityPlate_ = enable;
 
-	qs.setValue("fileOptions/pngVanityPlate", enable);
+	settings_.setValue("fileOptions/pngVanityPlate", enable);
 }
 
-void Manager::setCustomColorRanges(const QMap<QString, ColorRange>& colorRanges)
+void Manager::setPngProfile(MosIO::PngProfile profile)
 {
-	QSettings qs;
-	int i = 0;
-
-	customColorRanges_ = colorRanges;
+	pngProfile_ = profile;
 
-	qs.beginWriteArray("color_ranges");
-
-	for (const auto& [id, colorRange] : customColorRanges_.asKeyValueRange())
-	{
-		qs.setArrayIndex(i);
-
-		qs.setValue("id", id);
-		qs.setValue("avg", colorRange.mid());
-		qs.setValue("max", colorRange.max());
-		qs.setValue("min", colorRange.min());
-		qs.setValue("rep", colorRange.rep());
+	settings_.setValue("fileOptions/pngProfile", profile);
+}
 
-		++i;
-	}
+void Manager::setCustomColorRanges(const QMap<QString, ColorRange>& colorRanges)
+{
+	customColorRanges_ = colorRanges;
 
-	qs.endArray();
+	settings_.setValue(CUSTOM_COLOR_RANGES_KEY, encodeColorRanges(customColorRanges_));
 }
 
 void Manager::setCustomPalettes(const QMap<QString, ColorList>& palettes)
 {
-	QSettings qs;
-	int i = 0;
-
 	customPalettes_ = palettes;
 
-	qs.beginWriteArray("palettes");
+	settings_.setValue(CUSTOM_PALETTES_KEY, encodePalettes(customPalettes_));
+}
 
-	for (const auto& [id, palette] : customPalettes_.asKeyValueRange())
-	{
-		qs.setArrayIndex(i);
+void Manager::flush()
+{
+	settings_.flush();
+}
 
-		// TODO: use QStringList variant instead
+void Manager::addRecentFile(const QString& filePath,
+							const QImage& image,
+							QObject* context,
+							std::function<void()> onThumbnailReady)
+{
+	imageFilesMru_.push(filePath, QImage{});
+	writeRecentFileList();
 
-		QString colorList;
+	if (image.isNull())
+		return;
 
-		for (auto color : palette)
-		{
-			if (!colorList.isEmpty())
-				colorList += ',';
-			colorList += QString::number(color);
-		}
+	const QPointer<QObject> receiver{context};
+	const bool hasReceiver = context != nullptr;
 
-		qs.setValue("id", id);
-		qs.setValue("values", colorList);
+	QThreadPool::globalInstance()->start([=]() {
+		const auto& thumbnail = MruEntry::makeThumbnail(image);
+		const auto& thumbnailData = MruEntry::encodeThumbnail(thumbnail);
 
-		++i;
-	}
+		QMetaObject::invokeMethod(QCoreApplication::instance(), [=]() {
+			if (!setRecentFileThumbnail(filePath, thumbnail, thumbnailData))
+				return;
 
-	qs.endArray();
+			if (onThumbnailReady && (!hasReceiver || receiver))
+				onThumbnailReady();
+		}, Qt::QueuedConnection);
+	});
 }
 
-void Manager::addRecentFile(const QString& filePath, const QImage& image)
+bool Manager::setRecentFileThumbnail(const QString& filePath,
+									 const QImage& thumbnail,
+									 const QByteArray& thumbnailData)
 {
-	QSettings qs;
-	int i = 0;
+	auto* entry = imageFilesMru_.find(filePath);
 
-	imageFilesMru_.push(filePath, image);
+	// The file may have been removed from the list in the meantime
+	if (!entry)
+		return false;
 
-	qs.beginWriteArray("recent_files");
+	entry->setThumbnail(thumbnail, thumbnailData);
 
-	for (const auto& entry : imageFilesMru_)
-	{
-		qs.setArrayIndex(i);
+	settings_.setValue(recentFileThumbnailKey(filePath), QString::fromLatin1(thumbnailData));
 
-		QBuffer thumbnail;
+	return true;
+}
 
-		thumbnail.open(QIODevice::WriteOnly);
-		entry.thumbnail().save(&thumbnail, "PNG");
+void Manager::writeRecentFileList()
+{
+	QStringList paths;
+
+	for (const auto& entry : imageFilesMru_)
+		paths.push_back(entry.filePath());
 
-		qs.setValue("path", entry.filePath());
-		qs.setValue("thumbnail", thumbnail.data().toBase64());
+	settings_.setValue(RECENT_FILES_PATHS_KEY, paths);
 
-		++i;
+	// Drop thumbnails for files that fell off the list
+	for (const auto& path : std::as_const(storedRecentFiles_))
+	{
+		if (!paths.contains(path))
+			settings_.remove(recentFileThumbnailKey(path));
 	}
 
-	qs.endArray();
+	storedRecentFiles_ = paths;
 }
 
 void Manager::clearRecentFiles()
 {
-	QSettings qs;
-
 	imageFilesMru_.clear();
+	storedRecentFiles_.clear();
 
-	qs.beginWriteArray("recent_files");
-	qs.endArray();
+	settings_.remove("recentFiles");
+	settings_.setValue(RECENT_FILES_PATHS_KEY, QStringList{});
 }
 
 } // end namespace MosConfig
@@ -21,10 +21,15 @@
 #pragma once
 
 #include "recentfiles.hpp"
+#include "settingsstore.hpp"
 #include "wesnothrc.hpp"
 
 #include <QSize>
 
+class QSettings;
+
+#include <functional>
+
 namespace MosConfig {
 
 Q_NAMESPACE
@@ -69,11 +74,22 @@ public:
 	/**
 	 * Adds a new recent file entry.
 	 *
-	 * @param filePath       File path.
-	 * @param image          Image contents of the file which will be used for
-	 *                       generating a thumbnail.
+	 * The thumbnail is generated and saved in the background. Until then, the
+	 * entry keeps its previous thumbnail if the file was already in the list.
+	 *
+	 * @param filePath          File path.
+	 * @param image             Image contents of the file which will be used
+	 *                          for generating a thumbnail.
+	 * @param context           If not null, @a onThumbnailReady is not called
+	 *                          if this object is destroyed before the
+	 *                          thumbnail is ready.
+	 * @param onThumbnailReady  Called in the GUI thread once the thumbnail is
+	 *                          ready, e.g. for refreshing the UI.
 	 */
-	void addRecentFile(const QString& filePath, const QImage& image);
+	void addRecentFile(const QString& filePath,
+					   const QImage& image,
+					   QObject* context = nullptr,
+					   std::function<void()> onThumbnailReady = {});
 
 	/**
 	 * Clears the recent files list.
@@ -217,10 +233,59 @@ public:
 	 */
 	void setPngVanityPlate(bool enable);
 
+	/**
+	 * Returns the encoder profile used by PNG writer functions.
+	 */
+	MosIO::PngProfile pngProfile() const
+	{
+		return pngProfile_;
+	}
+
+	/**
+	 * Sets the encoder profile used by PNG writer functions.
+	 *
+	 * This trades off encoding speed and file size, mostly affecting the
+	 * time taken to save large images or many color ranges at once.
+	 */
+	void setPngProfile(MosIO::PngProfile profile);
+
+	/**
+	 * Returns the file name to record a trace of image processing stages to,
+	 * if any.
+	 *
+	 * This is a troubleshooting option without a user interface, which is
+	 * only set by editing the configuration manually, and has no effect
+	 * unless tracing support was enabled at build time (see MosTrace).
+	 */
+	const QString& traceFile() const
+	{
+		return traceFile_;
+	}
+
+	/**
+	 * Writes any pending configuration changes.
+	 *
+	 * Changes are normally written in the background shortly after being
+	 * made, so this only needs to be called before exiting.
+	 */
+	void flush();
+
 private:
 	Manager();
 
+	void readLegacyColorRanges(QSettings& qs);
+
+	void readLegacyPalettes(QSettings& qs);
+
+	bool setRecentFileThumbnail(const QString& filePath,
+								const QImage& thumbnail,
+								const QByteArray& thumbnailData);
+
+	void writeRecentFileList();
+
+	SettingsStore settings_;
 	MruList imageFilesMru_;
+	QStringList storedRecentFiles_;
 	QMap<QString, ColorRange> customColorRanges_;
 	QMap<QString, ColorList> customPalettes_;
 	bool rememberMainWindowSize_;
@@ -230,6 +295,8 @@ private:
 	bool rememberImageViewMode_;
 	ImageViewMode imageViewMode_;
 	bool pngVanityPlate_;
+	MosIO::PngProfile pngProfile_;
+	QString traceFile_;
 };
 
 inline Manager& current()
@@ -0,0 +1,452 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+//
+// Performance benchmarks for libmorningstar.
+//
+// Unlike the test suite, this only measures how long the backend functions
+// take on synthetic images of various sizes (plus any sample files given on
+// the command line for the image decoders), and writes the results as JSON
+// so they can be compared between builds by scripts.
+//
+
+#include "defs.hpp"
+#include "simdkernels.hpp"
+#include "version.hpp"
+#include "wesnothrc.hpp"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+namespace {
+
+enum ExitStatus
+{
+	ExitSuccess = 0,
+	ExitFailure = 1,
+	ExitUsageError = 2,
+};
+
+const QList<int> defaultSizes{72, 256, 1024, 4096, 8192};
+
+QTextStream& out()
+{
+	static QTextStream stream{stdout};
+	return stream;
+}
+
+QTextStream& err()
+{
+	static QTextStream stream{stderr};
+	return stream;
+}
+
+inline QString tr(const char* str)
+{
+	return QCoreApplication::translate("MosBench", str);
+}
+
+QString instructionSetName(MosKernels::InstructionSet set)
+{
+	switch (set)
+	{
+		case MosKernels::InstructionSetScalar:
+			return "scalar";
+		case MosKernels::InstructionSetSse2:
+			return "sse2";
+		case MosKernels::InstructionSetAvx2:
+			return "avx2";
+		case MosKernels::InstructionSetNeon:
+			return "neon";
+	}
+
+	return {};
+}
+
+/**
+ * Generates a sprite-like image using the colors of the magenta key palette.
+ *
+ * The image consists of runs of random length of either transparent pixels
+ * or a single palette color, which resembles actual unit sprites closely
+ * enough as far as the recoloring functions are concerned.
+ */
+QImage spriteImage(int size)
+{
+	const auto& palette = wesnoth::builtinPalettes["magenta"];
+	QRandomGenerator rng{quint32(size)};
+	QImage image{size, size, QImage::Format_ARGB32};
+
+	for (int y = 0; y < size; ++y)
+	{
+		auto* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+
+		for (int x = 0; x < size;)
+		{
+			const auto run = qMin(size - x, int(rng.bounded(1, 33)));
+			// Roughly a quarter of all runs are transparent
+			const auto index = rng.bounded(int(palette.count() * 4 / 3));
+			const auto rgb = index < palette.count() ? (palette[index] | 0xFF000000U) : 0U;
+
+			std::fill(line + x, line + x + run, rgb);
+			x += run;
+		}
+	}
+
+	return image;
+}
+
+/**
+ * Generates an image with random colors, which can't be written using a
+ * palette and compresses poorly.
+ */
+QImage noiseImage(int size)
+{
+	QRandomGenerator rng{quint32(size)};
+	QImage image{size, size, QImage::Format_ARGB32};
+
+	for (int y = 0; y < size; ++y)
+	{
+		auto* line = reinterpret_cast<quint32*>(image.scanLine(y));
+		rng.fillRange(line, size);
+	}
+
+	return image;
+}
+
+/**
+ * Runs benchmark cases and collects their results.
+ */
+class BenchmarkRunner
+{
+public:
+	BenchmarkRunner(qint64 minTime, int maxIterations, bool quiet)
+		: minTime_(minTime)
+		, maxIterations_(maxIterations)
+		, quiet_(quiet)
+		, results_()
+		, failed_(0)
+	{
+	}
+
+	/**
+	 * Runs a benchmark case repeatedly until it has taken at least the
+	 * minimum time or the maximum number of iterations is reached, after an
+	 * untimed warm-up run.
+	 *
+	 * @param name         Case name, normally the function being measured.
+	 * @param variant      Case variant (e.g. input type), may be empty.
+	 * @param size         Size of the image processed by each iteration, or
+	 *                     an empty size if not applicable.
+	 * @param function     Function to measure, which returns false on
+	 *                     failure.
+	 */
+	void run(const QString& name,
+			 const QString& variant,
+			 const QSize& size,
+			 const std::function<bool()>& function)
+	{
+		QJsonObject result{
+			{"name", name},
+			{"variant", variant},
+			{"width", size.width()},
+			{"height", size.height()},
+		};
+
+		if (!function()) {
+			result.insert("error", true);
+			results_.append(result);
+			++failed_;
+			err() << tr("Benchmark failed: %1 %2 %3x%4").arg(name, variant).arg(size.width()).arg(size.height()) << Qt::endl;
+			return;
+		}
+
+		QElapsedTimer timer;
+		qint64 totalTime = 0, minTime = std::numeric_limits<qint64>::max();
+		int iterations = 0;
+
+		while (iterations < maxIterations_ && (iterations == 0 || totalTime < minTime_ * 1000000))
+		{
+			timer.start();
+			function();
+			const auto elapsed = timer.nsecsElapsed();
+
+			totalTime += elapsed;
+			minTime = qMin(minTime, elapsed);
+			++iterations;
+		}
+
+		const auto meanMs = double(totalTime) / iterations / 1e6;
+		const auto pixels = size.isValid() ? qint64(size.width()) * size.height() : 0;
+
+		result.insert("iterations", iterations);
+		result.insert("meanMs", meanMs);
+		result.insert("minMs", double(minTime) / 1e6);
+
+		if (pixels > 0)
+			result.insert("megapixelsPerSecond", double(pixels) / (meanMs * 1000));
+
+		results_.append(result);
+
+		if (!quiet_) {
+			err() << name << ' ' << variant << ' ' << size.width() << 'x' << size.height()
+				  << ": " << meanMs << " ms" << Qt::endl;
+		}
+	}
+
+	const QJsonArray& results() const
+	{
+		return results_;
+	}
+
+	int failed() const
+	{
+		return failed_;
+	}
+
+private:
+	qint64 minTime_;
+	int maxIterations_;
+	bool quiet_;
+	QJsonArray results_;
+	int failed_;
+};
+
+} // end unnamed namespace
+
+int main(int argc, char* argv[])
+{
+	QCoreApplication a{argc, argv};
+
+	QCoreApplication::setApplicationName("wespal_bench");
+	QCoreApplication::setOrganizationName("Irydacea");
+	QCoreApplication::setOrganizationDomain("irydacea.me");
+	QCoreApplication::setApplicationVersion(MOS_VERSION);
+
+	QCommandLineParser parser;
+
+	parser.setApplicationDescription(tr(
+		"Measures the performance of Wespal's recoloring and image I/O "
+		"functions on synthetic images, and of the image decoders on the "
+		"specified sample files (e.g. XCF, PSD, KRA or ORA images)."));
+	parser.addHelpOption();
+	parser.addVersionOption();
+
+	QCommandLineOption outputOption{
+		{"o", "output"},
+		tr("Writes JSON results to a file instead of standard output."),
+		tr("file")};
+	QCommandLineOption sizesOption{
+		{"s", "sizes"},
+		tr("Comma-separated list of synthetic image sizes (default: %1).")
+			.arg("72,256,1024,4096,8192"),
+		tr("sizes")};
+	QCommandLineOption minTimeOption{
+		"min-time",
+		tr("Minimum time to spend repeating each case, in milliseconds "
+		   "(default: 500)."),
+		tr("ms"), "500"};
+	QCommandLineOption maxIterationsOption{
+		"max-iterations",
+		tr("Maximum number of times to repeat each case (default: 100)."),
+		tr("count"), "100"};
+	QCommandLineOption quietOption{
+		{"q", "quiet"},
+		tr("Do not report progress on standard error.")};
+
+	parser.addOptions({
+		outputOption,
+		sizesOption,
+		minTimeOption,
+		maxIterationsOption,
+		quietOption,
+	});
+
+	parser.addPositionalArgument("files", tr("Sample image files for the decoder benchmarks."), tr("[files...]"));
+
+	parser.process(a);
+
+	QList<int> sizes = defaultSizes;
+
+	if (parser.isSet(sizesOption)) {
+		sizes.clear();
+
+		const auto& values = parser.value(sizesOption).split(',', Qt::SkipEmptyParts);
+
+		for (const auto& value : values)
+		{
+			bool ok = false;
+			const auto size = value.trimmed().toInt(&ok);
+
+			if (!ok || size <= 0) {
+				err() << tr("Invalid image size: %1").arg(value) << Qt::endl;
+				return ExitUsageError;
+			}
+
+			sizes.push_back(size);
+		}
+	}
+
+	bool minTimeOk = false, maxIterationsOk = false;
+	const auto minTime = parser.value(minTimeOption).toLongLong(&minTimeOk);
+	const auto maxIterations = parser.value(maxIterationsOption).toInt(&maxIterationsOk);
+
+	if (!minTimeOk || minTime < 0 || !maxIterationsOk || maxIterations < 1) {
+		err() << tr("Invalid repetition settings.") << Qt::endl;
+		return ExitUsageError;
+	}
+
+	QTemporaryDir tempDir;
+
+	if (!tempDir.isValid()) {
+		err() << tr("Could not create a temporary directory.") << Qt::endl;
+		return ExitFailure;
+	}
+
+	BenchmarkRunner bench{minTime, maxIterations, parser.isSet(quietOption)};
+
+	//
+	// Synthetic image benchmarks
+	//
+
+	const auto& palMagenta = wesnoth::builtinPalettes["magenta"];
+	const auto& colorRangeRed = wesnoth::builtinColorRanges["red"];
+	const CompiledColorMap rangeMap{colorRangeRed.applyToPalette(palMagenta)};
+
+	bench.run("applyToPalette", {}, {0, 0}, [&]() {
+		return !colorRangeRed.applyToPalette(palMagenta).isEmpty();
+	});
+
+	ImagePathFunctionChain chain;
+	chain.parse("~RC(magenta>red)~CS(10,0,-5)~BLEND(255,0,0,0.3)",
+				wesnoth::builtinColorRanges.objects(),
+				wesnoth::builtinPalettes.objects());
+
+	const QList<std::pair<QString, MosIO::PngProfile>> pngProfiles{
+		{"fast", MosIO::PngProfileFast},
+		{"balanced", MosIO::PngProfileBalanced},
+		{"smallest", MosIO::PngProfileSmallest},
+	};
+
+	for (const auto size : std::as_const(sizes))
+	{
+		const auto sprite = spriteImage(size);
+		const auto noise = noiseImage(size);
+		const auto indexed = toIndexedImage(sprite);
+
+		bench.run("recolorImage", "sprite", sprite.size(), [&]() {
+			return !recolorImage(sprite, rangeMap).isNull();
+		});
+		bench.run("recolorImage", "indexed", indexed.size(), [&]() {
+			return !recolorImage(indexed, rangeMap).isNull();
+		});
+		bench.run("colorBlendImage", "sprite", sprite.size(), [&]() {
+			return !colorBlendImage(sprite, QColor{255, 0, 0}, 0.3).isNull();
+		});
+		bench.run("colorShiftImage", "sprite", sprite.size(), [&]() {
+			return !colorShiftImage(sprite, 10, 0, -5).isNull();
+		});
+		bench.run("ImagePathFunctionChain::apply", "sprite", sprite.size(), [&]() {
+			return !chain.apply(sprite).isNull();
+		});
+		bench.run("uniqueColorsFromImage", "sprite", sprite.size(), [&]() {
+			return !uniqueColorsFromImage(sprite).isEmpty();
+		});
+		bench.run("uniqueColorsFromImage", "noise", noise.size(), [&]() {
+			return !uniqueColorsFromImage(noise).isEmpty();
+		});
+
+		const auto& fileName = tempDir.filePath("bench.png");
+
+		for (const auto& profile : pngProfiles)
+		{
+			bench.run("writePng", "sprite/" + profile.first, sprite.size(), [&]() {
+				auto input = sprite;
+				return MosIO::writePng(input, fileName, false, profile.second);
+			});
+			bench.run("writePng", "noise/" + profile.first, noise.size(), [&]() {
+				auto input = noise;
+				return MosIO::writePng(input, fileName, false, profile.second);
+			});
+		}
+
+		bench.run("writeBase64Png", "sprite", sprite.size(), [&]() {
+			auto input = sprite;
+			return !MosIO::writeBase64Png(input, false, MosIO::PngProfileBalanced).isEmpty();
+		});
+	}
+
+	//
+	// Decoder benchmarks
+	//
+
+	for (const auto& path : parser.positionalArguments())
+	{
+		QImageReader probe{path};
+		const auto format = QString::fromLatin1(probe.format());
+
+		bench.run("decode", format.isEmpty() ? QFileInfo{path}.suffix() : format, probe.size(), [&path]() {
+			QImageReader reader{path};
+			return !reader.read().isNull();
+		});
+	}
+
+	//
+	// Report
+	//
+
+	QJsonObject report{
+		{"version", MOS_VERSION},
+		{"qtVersion", qVersion()},
+		{"instructionSet", instructionSetName(MosKernels::preferredInstructionSet())},
+		{"threads", QThread::idealThreadCount()},
+		{"results", bench.results()},
+	};
+
+	const auto& json = QJsonDocument{report}.toJson();
+
+	if (parser.isSet(outputOption)) {
+		QFile file{parser.value(outputOption)};
+
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+			err() << tr("Could not write results: %1").arg(file.fileName()) << Qt::endl;
+			return ExitFailure;
+		}
+	} else {
+		out() << json;
+		out().flush();
+	}
+
+	return bench.failed() ? ExitFailure : ExitSuccess;
+}
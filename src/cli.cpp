@@ -0,0 +1,594 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+//
+// Headless batch recoloring front-end.
+//
+// This is built only on top of libmorningstar and Qt Core/Gui, and never
+// creates a QApplication or any widgets, so it can be used in build scripts
+// and other non-interactive environments.
+//
+
+#include "defs.hpp"
+#include "jobrunner.hpp"
+#include "tracing.hpp"
+#include "version.hpp"
+#include "wesnothrc.hpp"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <QRegularExpression>
+#include <QScopeGuard>
+#include <QTextStream>
+#include <QThread>
+
+namespace {
+
+enum ExitStatus
+{
+	ExitSuccess = 0,
+	ExitJobsFailed = 1,
+	ExitUsageError = 2,
+};
+
+const QString defaultOutputPattern = "%d/%b-RC-%p-%n-%r.png";
+const QString defaultFunctionOutputPattern = "%d/%b%r.png";
+
+QTextStream& out()
+{
+	static QTextStream stream{stdout};
+	return stream;
+}
+
+QTextStream& err()
+{
+	static QTextStream stream{stderr};
+	return stream;
+}
+
+inline QString tr(const char* str)
+{
+	return QCoreApplication::translate("MosCli", str);
+}
+
+/**
+ * A color range along with its id and position in the GUI's range list, or
+ * an image path function chain along with its position on the command line.
+ */
+struct RangeJob
+{
+	QString id;
+	int index;
+	ColorRange range;
+	ImagePathFunctionChain functions;
+};
+
+/**
+ * Makes an image path function chain usable as part of a file name.
+ */
+QString functionsFileNameId(QString functions)
+{
+	static const QRegularExpression unsafeRe{"[<>:\"/\\\\|?*\\s]"};
+
+	return functions.replace(unsafeRe, "_");
+}
+
+bool parseColor(QString str, QRgb& result)
+{
+	if (str.startsWith('#'))
+		str.remove(0, 1);
+
+	bool ok = false;
+	auto rgb = str.toUInt(&ok, 16);
+
+	if (!ok || str.length() != 6)
+		return false;
+
+	result = rgb;
+	return true;
+}
+
+/**
+ * Parses an <id>=<color>,<color>... definition.
+ */
+bool parseDefinition(const QString& def, QString& id, ColorList& colors)
+{
+	auto sep = def.indexOf('=');
+	if (sep <= 0)
+		return false;
+
+	id = def.left(sep).trimmed();
+	colors.clear();
+
+	const auto& values = def.mid(sep + 1).split(',', Qt::SkipEmptyParts);
+
+	for (const auto& value : values)
+	{
+		QRgb rgb;
+		if (!parseColor(value.trimmed(), rgb))
+			return false;
+		colors.emplaceBack(rgb);
+	}
+
+	return !id.isEmpty() && !colors.isEmpty();
+}
+
+/**
+ * Expands input arguments, treating those containing wildcards as globs.
+ *
+ * Wildcards are only supported in the file name portion of an argument,
+ * which is enough for platforms (Windows) whose shells don't do it for us.
+ */
+QStringList expandInputs(const QStringList& args)
+{
+	static const QRegularExpression wildcardRe{"[*?\\[]"};
+
+	QStringList inputs;
+
+	for (const auto& arg : args)
+	{
+		QFileInfo fi{arg};
+
+		if (fi.exists() || !fi.fileName().contains(wildcardRe)) {
+			inputs.push_back(arg);
+			continue;
+		}
+
+		QDir dir{fi.path()};
+		const auto& matches = dir.entryList({fi.fileName()}, QDir::Files, QDir::Name);
+
+		if (matches.isEmpty()) {
+			// Keep the pattern so the failure gets reported later on
+			inputs.push_back(arg);
+			continue;
+		}
+
+		for (const auto& match : matches)
+		{
+			inputs.push_back(dir.filePath(match));
+		}
+	}
+
+	return inputs;
+}
+
+QString expandOutputPattern(const QString& pattern,
+							const QFileInfo& input,
+							const QString& palId,
+							const RangeJob& job)
+{
+	QString result;
+
+	for (qsizetype k = 0; k < pattern.length(); ++k)
+	{
+		if (pattern[k] != '%' || k + 1 == pattern.length()) {
+			result += pattern[k];
+			continue;
+		}
+
+		switch (pattern[++k].unicode())
+		{
+			case 'd':
+				result += input.path();
+				break;
+			case 'b':
+				result += input.completeBaseName();
+				break;
+			case 'p':
+				result += palId;
+				break;
+			case 'n':
+				result += QString::number(job.index + 1);
+				break;
+			case 'r':
+				result += job.id;
+				break;
+			case '%':
+				result += '%';
+				break;
+			default:
+				result += '%';
+				result += pattern[k];
+		}
+	}
+
+	return result;
+}
+
+void listDefinitions()
+{
+	out() << tr("Built-in palettes:") << '\n';
+
+	for (const auto& palId : wesnoth::builtinPalettes.orderedNames())
+	{
+		out() << "  " << palId << '\n';
+	}
+
+	out() << tr("Built-in color ranges:") << '\n';
+
+	const auto& rangeIds = wesnoth::builtinColorRanges.orderedNames();
+
+	for (int k = 0; k < rangeIds.count(); ++k)
+	{
+		out() << "  " << (k + 1) << ' ' << rangeIds[k] << '\n';
+	}
+}
+
+} // end unnamed namespace
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication a{argc, argv};
+
+	QCoreApplication::setApplicationName("wespal-cli");
+	QCoreApplication::setOrganizationName("Irydacea");
+	QCoreApplication::setOrganizationDomain("irydacea.me");
+	QCoreApplication::setApplicationVersion(MOS_VERSION);
+
+	QCommandLineParser parser;
+
+	parser.setApplicationDescription(tr(
+		"Recolors Wesnoth assets using color ranges without a graphical "
+		"interface.\n\n"
+		"Output file name patterns may use the following placeholders:\n"
+		"  %d  Input file directory\n"
+		"  %b  Input file base name\n"
+		"  %p  Key palette id\n"
+		"  %n  Color range number, as displayed by --list, or --function number\n"
+		"  %r  Color range id, or --function chain (default with --function: "
+		"%d/%b%r.png)\n"
+		"  %%  A literal percent sign"));
+	parser.addHelpOption();
+	parser.addVersionOption();
+
+	QCommandLineOption paletteOption{
+		{"p", "palette"},
+		tr("Key palette id (default: magenta)."),
+		tr("id"), "magenta"};
+	QCommandLineOption rangesOption{
+		{"r", "ranges"},
+		tr("Comma-separated list of color range ids (default: all)."),
+		tr("ids")};
+	QCommandLineOption functionOption{
+		{"f", "function"},
+		tr("Applies a chain of Wesnoth image path functions such as "
+		   "~RC(magenta>red)~CS(10,0,-5) instead of color ranges. May be used "
+		   "multiple times."),
+		tr("functions")};
+	QCommandLineOption outputOption{
+		{"o", "output"},
+		tr("Output file name pattern (default: %1).").arg(defaultOutputPattern),
+		tr("pattern")};
+	QCommandLineOption definePaletteOption{
+		"define-palette",
+		tr("Defines or overrides a palette. May be used multiple times."),
+		tr("id=color,...")};
+	QCommandLineOption defineRangeOption{
+		"define-range",
+		tr("Defines or overrides a color range using its average, maximum, "
+		   "minimum and (optionally) icon colors. May be used multiple times."),
+		tr("id=avg,max,min[,rep]")};
+	QCommandLineOption noVanityPlateOption{
+		"no-vanity-plate",
+		tr("Do not record the Wespal version in output PNG files.")};
+	QCommandLineOption pngProfileOption{
+		"png-profile",
+		tr("PNG encoder profile: fast, balanced or smallest (default: balanced)."),
+		tr("profile"), "balanced"};
+	QCommandLineOption lowMemoryOption{
+		"low-memory",
+		tr("Processes images one at a time in strips of scanlines rather than "
+		   "loading them in full, keeping memory use low regardless of image "
+		   "size.")};
+	QCommandLineOption listOption{
+		"list",
+		tr("Lists the built-in palettes and color ranges, and exits.")};
+	QCommandLineOption quietOption{
+		{"q", "quiet"},
+		tr("Only report errors.")};
+	QCommandLineOption traceOption{
+		"trace",
+		tr("Records the time taken by each processing stage to a Chrome trace "
+		   "file (same as setting the %1 environment variable).")
+			.arg(MosTrace::ENVIRONMENT_VARIABLE),
+		tr("file")};
+
+	parser.addOptions({
+		paletteOption,
+		rangesOption,
+		functionOption,
+		outputOption,
+		definePaletteOption,
+		defineRangeOption,
+		noVanityPlateOption,
+		pngProfileOption,
+		lowMemoryOption,
+		listOption,
+		quietOption,
+		traceOption,
+	});
+
+	parser.addPositionalArgument("files", tr("Input image files or wildcard patterns."), tr("files..."));
+
+	parser.process(a);
+
+	if (parser.isSet(listOption)) {
+		listDefinitions();
+		return ExitSuccess;
+	}
+
+	if (parser.isSet(traceOption)) {
+		if (!MosTrace::start(parser.value(traceOption)))
+			err() << tr("Tracing is not available in this build.") << Qt::endl;
+	} else {
+		MosTrace::startFromEnvironment();
+	}
+
+	const auto traceGuard = qScopeGuard([]() {
+		if (MosTrace::isActive() && !MosTrace::stop())
+			err() << tr("Could not write trace file.") << Qt::endl;
+	});
+
+	//
+	// Merge user definitions with built-ins
+	//
+
+	auto palettes = wesnoth::builtinPalettes.objects();
+	auto colorRanges = wesnoth::builtinColorRanges.objects();
+
+	// Extra ranges follow built-ins in id order, just like in the GUI
+	QMap<QString, ColorRange> extraRanges;
+
+	for (const auto& def : parser.values(definePaletteOption))
+	{
+		QString id;
+		ColorList colors;
+
+		if (!parseDefinition(def, id, colors)) {
+			err() << tr("Invalid palette definition: %1").arg(def) << Qt::endl;
+			return ExitUsageError;
+		}
+
+		palettes.insert(id, colors);
+	}
+
+	for (const auto& def : parser.values(defineRangeOption))
+	{
+		QString id;
+		ColorList colors;
+
+		if (!parseDefinition(def, id, colors) || colors.count() < 3 || colors.count() > 4) {
+			err() << tr("Invalid color range definition: %1").arg(def) << Qt::endl;
+			return ExitUsageError;
+		}
+
+		ColorRange range{colors[0], colors[1], colors[2],
+						 colors.count() > 3 ? colors[3] : colors[0]};
+
+		colorRanges.insert(id, range);
+
+		if (!wesnoth::builtinColorRanges.hasName(id))
+			extraRanges.insert(id, range);
+	}
+
+	QStringList orderedRangeIds = wesnoth::builtinColorRanges.orderedNames();
+	orderedRangeIds.append(extraRanges.keys());
+
+	//
+	// Validate job parameters
+	//
+
+	const auto& palId = parser.value(paletteOption);
+
+	if (!palettes.contains(palId)) {
+		err() << tr("Unknown palette: %1").arg(palId) << Qt::endl;
+		return ExitUsageError;
+	}
+
+	const auto& palette = palettes[palId];
+
+	const bool useFunctions = parser.isSet(functionOption);
+
+	if (useFunctions && (parser.isSet(rangesOption) || parser.isSet(lowMemoryOption))) {
+		err() << tr("--function cannot be combined with --ranges or --low-memory.") << Qt::endl;
+		return ExitUsageError;
+	}
+
+	QList<RangeJob> rangeJobs;
+
+	if (useFunctions) {
+		const auto& chains = parser.values(functionOption);
+
+		for (qsizetype k = 0; k < chains.count(); ++k)
+		{
+			ImagePathFunctionChain functions;
+			QString error;
+
+			if (!functions.parse(chains[k], colorRanges, palettes, &error)) {
+				err() << tr("Invalid image path functions: %1 (%2)").arg(chains[k], error) << Qt::endl;
+				return ExitUsageError;
+			}
+
+			rangeJobs.push_back({functionsFileNameId(chains[k]), int(k), {}, functions});
+		}
+	} else {
+		QStringList requestedRangeIds = parser.isSet(rangesOption)
+										? parser.value(rangesOption).split(',', Qt::SkipEmptyParts)
+										: orderedRangeIds;
+
+		for (const auto& rangeId : requestedRangeIds)
+		{
+			const auto& id = rangeId.trimmed();
+			auto index = orderedRangeIds.indexOf(id);
+
+			if (index < 0) {
+				err() << tr("Unknown color range: %1").arg(id) << Qt::endl;
+				return ExitUsageError;
+			}
+
+			rangeJobs.push_back({id, int(index), colorRanges[id], {}});
+		}
+	}
+
+	static const QMap<QString, MosIO::PngProfile> pngProfiles{
+		{"fast",		MosIO::PngProfileFast},
+		{"balanced",	MosIO::PngProfileBalanced},
+		{"smallest",	MosIO::PngProfileSmallest},
+	};
+
+	const auto& pngProfileId = parser.value(pngProfileOption);
+
+	if (!pngProfiles.contains(pngProfileId)) {
+		err() << tr("Unknown PNG encoder profile: %1").arg(pngProfileId) << Qt::endl;
+		return ExitUsageError;
+	}
+
+	const auto pngProfile = pngProfiles.value(pngProfileId);
+
+	const auto& inputs = expandInputs(parser.positionalArguments());
+
+	if (inputs.isEmpty()) {
+		err() << tr("No input files specified.") << Qt::endl;
+		parser.showHelp(ExitUsageError);
+	}
+
+	//
+	// Compile every color map once and reuse it for all inputs; the actual
+	// work is spread across all CPU cores by the job runner
+	//
+
+	ColorMapCache colorMapCache;
+	QList<CompiledColorMap> colorMaps;
+
+	// Function chains are compiled while parsing them instead
+	if (!useFunctions) {
+		for (const auto& job : rangeJobs)
+		{
+			colorMaps.emplaceBack(colorMapCache.colorRangeMap(job.range, palette));
+		}
+	}
+
+	const auto& outputPattern = parser.isSet(outputOption)
+								? parser.value(outputOption)
+								: useFunctions ? defaultFunctionOutputPattern : defaultOutputPattern;
+	const bool vanityPlate = !parser.isSet(noVanityPlateOption);
+	const bool quiet = parser.isSet(quietOption);
+
+	int failed = 0;
+
+	if (parser.isSet(lowMemoryOption)) {
+		for (const auto& inputPath : inputs)
+		{
+			const QFileInfo inputInfo{inputPath};
+			QStringList fileNames;
+			QStringList failedFileNames;
+
+			for (const auto& job : rangeJobs)
+			{
+				fileNames.push_back(expandOutputPattern(outputPattern, inputInfo, palId, job));
+			}
+
+			if (!MosIO::recolorImageFile(inputPath, colorMaps, fileNames, failedFileNames, vanityPlate, pngProfile)) {
+				err() << tr("Could not read image: %1").arg(inputPath) << Qt::endl;
+				++failed;
+				continue;
+			}
+
+			for (const auto& fileName : std::as_const(fileNames))
+			{
+				if (failedFileNames.contains(fileName)) {
+					err() << tr("Could not write image: %1").arg(fileName) << Qt::endl;
+					++failed;
+				} else if (!quiet) {
+					out() << fileName << Qt::endl;
+				}
+			}
+		}
+
+		return failed ? ExitJobsFailed : ExitSuccess;
+	}
+
+	// Inputs are decoded and recolored in batches of about as many images as
+	// there are CPU cores, so that memory use is bounded by the batch rather
+	// than by the whole set of inputs
+	const auto batchSize = qMax(1, QThread::idealThreadCount());
+
+	for (qsizetype first = 0; first < inputs.count(); first += batchSize)
+	{
+		RecolorJobRunner runner;
+
+		runner.setVanityPlate(vanityPlate);
+		runner.setPngProfile(pngProfile);
+
+		for (const auto& inputPath : inputs.mid(first, batchSize))
+		{
+			QImage input;
+
+			{
+				MOS_TRACE_NAMED_SPAN(decodeSpan, "decode", "QImage::load");
+				input.load(inputPath);
+				MOS_TRACE_SET_IMAGE_SIZE(decodeSpan, input.size());
+			}
+
+			if (input.isNull()) {
+				err() << tr("Could not read image: %1").arg(inputPath) << Qt::endl;
+				++failed;
+				continue;
+			}
+
+			input = toWorkingFormat(input);
+
+			const QFileInfo inputInfo{inputPath};
+
+			for (qsizetype k = 0; k < rangeJobs.count(); ++k)
+			{
+				const auto& fileName = expandOutputPattern(outputPattern, inputInfo, palId, rangeJobs[k]);
+
+				if (useFunctions) {
+					runner.addJob(input, rangeJobs[k].functions, fileName);
+				} else {
+					runner.addJob(input, colorMaps[k], fileName);
+				}
+			}
+		}
+
+		runner.start();
+		runner.wait();
+
+		if (!quiet) {
+			for (const auto& fileName : runner.succeeded())
+			{
+				out() << fileName << '\n';
+			}
+			out().flush();
+		}
+
+		for (const auto& fileName : runner.failed())
+		{
+			err() << tr("Could not write image: %1").arg(fileName) << Qt::endl;
+			++failed;
+		}
+	}
+
+	return failed ? ExitJobsFailed : ExitSuccess;
+}
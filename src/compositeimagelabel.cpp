@@ -20,10 +20,13 @@
 
 #include "compositeimagelabel.hpp"
 
+#include "simdkernels.hpp"
+
 #include <QLayout>
 #include <QPainter>
 #include <QPaintEvent>
 #include <QScrollBar>
+#include <QtMath>
 
 CompositeImageLabel::CompositeImageLabel(QWidget* parent)
 	: QWidget(parent)
@@ -38,6 +41,7 @@ CompositeImageLabel::CompositeImageLabel(QWidget* parent)
 void CompositeImageLabel::setLeftImage(const QImage& leftImage)
 {
 	leftImage_ = leftImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	leftTiles_.setImage(leftImage_);
 
 	buildComposite();
 	updateGeometry();
@@ -47,6 +51,7 @@ void CompositeImageLabel::setLeftImage(const QImage& leftImage)
 void CompositeImageLabel::setRightImage(const QImage& rightImage)
 {
 	rightImage_ = rightImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	rightTiles_.setImage(rightImage_);
 
 	buildComposite();
 	updateGeometry();
@@ -57,6 +62,8 @@ void CompositeImageLabel::setImages(const QImage& leftImage, const QImage& right
 {
 	leftImage_ = leftImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
 	rightImage_ = rightImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	leftTiles_.setImage(leftImage_);
+	rightTiles_.setImage(rightImage_);
 
 	buildComposite();
 	updateGeometry();
@@ -66,87 +73,110 @@ void CompositeImageLabel::setImages(const QImage& leftImage, const QImage& right
 void CompositeImageLabel::clear()
 {
 	compositeCache_ = rightImage_ = leftImage_ = QImage{};
+	leftTiles_.clear();
+	rightTiles_.clear();
 
 	buildComposite();
 	updateGeometry();
 	update();
 }
 
+void CompositeImageLabel::setDisplayRatio(qreal displayRatio)
+{
+	displayRatio = qBound(0.0, displayRatio, 1.0);
+
+	if (displayRatio == displayRatio_)
+		return;
+
+	if (displayMode_ != CompositeDisplaySliding) {
+		const auto oldStep = onionSkinStep();
+		displayRatio_ = displayRatio;
+
+		if (onionSkinStep() != oldStep) {
+			buildComposite();
+			update();
+		}
+
+		return;
+	}
+
+	// Only the strip between the old and new split positions changes
+
+	const auto oldSplit = mapColumnToWidget(splitColumn());
+	displayRatio_ = displayRatio;
+	const auto newSplit = mapColumnToWidget(splitColumn());
+
+	if (oldSplit == newSplit)
+		return;
+
+	const auto left = int(qFloor(qMin(oldSplit, newSplit))) - 1,
+			   right = int(qCeil(qMax(oldSplit, newSplit))) + 1;
+
+	update(left, 0, right - left, height());
+}
+
+int CompositeImageLabel::onionSkinStep() const
+{
+	return qRound(displayRatio_ * 256);
+}
+
+int CompositeImageLabel::splitColumn() const
+{
+	return qRound(displayRatio_ * rightImage_.width());
+}
+
+qreal CompositeImageLabel::mapColumnToWidget(int column) const
+{
+	if (rightImage_.width() <= 0)
+		return 0;
+
+	return qreal(column) * width() / rightImage_.width();
+}
+
 void CompositeImageLabel::buildComposite()
 {
 	auto& left = leftImage_;
 	auto& right = rightImage_;
 
-	// Optimise the best case scenarios by referencing a single image.
+	compositeTiles_.clear();
 
-	if (displayRatio_ == 0.0) {
-		compositeCache_ = left;
-		return;
-	} else if (displayRatio_ == 1.0) {
-		compositeCache_ = right;
+	if (displayMode_ != CompositeDisplayOnionSkin || left.isNull()) {
+		compositeCache_ = QImage{};
 		return;
 	}
 
-	QImage::Format fmt = displayMode_ == CompositeDisplayOnionSkin
-						 ? QImage::Format_ARGB32
-						 : QImage::Format_ARGB32_Premultiplied;
+	const auto step = onionSkinStep();
 
-	QImage compositeRender{leftImage_.size(), fmt};
-	compositeRender.fill(0);
-	QPainter o{&compositeRender};
+	// Optimise the best case scenarios by painting a single image.
 
-	switch (displayMode_)
-	{
-		case CompositeDisplaySliding: {
-			QRect rightRect{
-				0,
-				0,
-				qRound(displayRatio_ * rightImage_.width()),
-				rightImage_.height()
-			};
-			QRect leftRect{rightRect};
-
-			leftRect.setWidth(rightImage_.width() - rightRect.width());
-			leftRect.translate(rightRect.width(), 0);
-
-			o.drawImage(rightRect, right, rightRect);
-			o.drawImage(leftRect, left, leftRect);
-
-			break;
-		}
-		case CompositeDisplayOnionSkin: {
-			auto maxY = qMin(left.height(), right.height()),
-				 maxX = qMin(left.width(), right.width());
-
-			for (int y = 0; y < maxY; ++y)
-			{
-				const auto* leftLine = reinterpret_cast<const QRgb*>(left.constScanLine(y));
-				const auto* rightLine = reinterpret_cast<const QRgb*>(right.constScanLine(y));
-				auto* compositeLine = reinterpret_cast<QRgb*>(compositeRender.scanLine(y));
-
-				for (int x = 0; x < maxX; ++x)
-				{
-					// Manual alpha blending wheeeeee
+	if (step == 0 || step == 256)
+		return;
 
-					auto leftCol = qUnpremultiply(leftLine[x]) & 0xFFFFFFU;
-					auto rightCol = qUnpremultiply(rightLine[x]) & 0xFFFFFFU;
+	// Reuse the previous composite buffer unless it is still in use elsewhere
+	if (!compositeCache_.isDetached()
+		|| compositeCache_.size() != left.size()
+		|| compositeCache_.format() != QImage::Format_ARGB32_Premultiplied)
+	{
+		compositeCache_ = QImage{left.size(), QImage::Format_ARGB32_Premultiplied};
+	}
 
-					auto r = displayRatio_ * qRed(rightCol) + (1 - displayRatio_) * qRed(leftCol);
-					auto g = displayRatio_ * qGreen(rightCol) + (1 - displayRatio_) * qGreen(leftCol);
-					auto b = displayRatio_ * qBlue(rightCol) + (1 - displayRatio_) * qBlue(leftCol);
+	const auto maxY = qMin(left.height(), right.height()),
+			   maxX = qMin(left.width(), right.width());
 
-					compositeLine[x] = qRgba(r, g, b, qAlpha(leftLine[x]));
-				}
-			}
+	if (left.size() != right.size())
+		compositeCache_.fill(0);
 
-			break;
-		}
-		default:
-			// Shouldn't be here
-			Q_ASSERT(false);
+	// Both images are premultiplied, so they can be cross-faded directly.
+	for (int y = 0; y < maxY; ++y)
+	{
+		MosKernels::crossFadeLine(reinterpret_cast<QRgb*>(compositeCache_.scanLine(y)),
+								  reinterpret_cast<const QRgb*>(left.constScanLine(y)),
+								  reinterpret_cast<const QRgb*>(right.constScanLine(y)),
+								  maxX,
+								  quint16(step));
 	}
 
-	compositeCache_ = compositeRender;
+	compositeTiles_.setImage(compositeCache_);
 }
 
 void CompositeImageLabel::paintEvent(QPaintEvent* event)
@@ -158,5 +188,21 @@ void CompositeImageLabel::paintEvent(QPaintEvent* event)
 
 	p.setClipRect(event->rect());
 	p.setRenderHint(QPainter::SmoothPixmapTransform, false);
-	p.drawImage(rect(), compositeCache_);
+
+	if (displayMode_ == CompositeDisplayOnionSkin) {
+		const auto step = onionSkinStep();
+		auto& tiles = step == 0 ? leftTiles_ : step == 256 ? rightTiles_ : compositeTiles_;
+
+		tiles.paint(p, rect(), event->rect());
+		return;
+	}
+
+	// Sliding mode: the right image is displayed on the left side of the
+	// split and vice versa, each clipped to its own side.
+
+	const auto split = splitColumn();
+
+	rightTiles_.paint(p, rect(), event->rect(), QRect{0, 0, split, rightImage_.height()});
+	leftTiles_.paint(p, rect(), event->rect(),
+					 QRect{split, 0, leftImage_.width() - split, leftImage_.height()});
 }
@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include "scaledimagecache.hpp"
+
 #include <QWidget>
 
 /**
@@ -86,6 +88,9 @@ public:
 	 */
 	void setDisplayMode(CompositeDisplayMode newMode)
 	{
+		if (newMode == displayMode_)
+			return;
+
 		displayMode_ = newMode;
 		buildComposite();
 		update();
@@ -110,15 +115,7 @@ public:
 	 * value of 0.0 means only the right image is displayed, while a value of
 	 * 1.0 means only the left image is displayed.
 	 */
-	void setDisplayRatio(qreal displayRatio)
-	{
-		if (displayRatio == displayRatio_)
-			return;
-
-		displayRatio_ = qBound(0.0, displayRatio, 1.0);
-		buildComposite();
-		update();
-	}
+	void setDisplayRatio(qreal displayRatio);
 
 	/**
 	 * Retrieves the left pixmap.
@@ -164,8 +161,34 @@ protected:
 	virtual void paintEvent(QPaintEvent* event) override;
 
 private:
+	/**
+	 * Renders the onion skin composite image.
+	 *
+	 * Sliding mode does not use a composite image. Instead, both images are
+	 * drawn directly by paintEvent(), each clipped to its side of the split.
+	 */
 	void buildComposite();
 
+	/**
+	 * Returns the cross-fade step used to render the onion skin composite
+	 * image, between 0 and 256 (inclusive).
+	 *
+	 * The composite image only needs to be rendered again when this changes,
+	 * rather than on every display ratio change.
+	 */
+	int onionSkinStep() const;
+
+	/**
+	 * Returns the image column at which the split between the right and left
+	 * images is located in sliding mode.
+	 */
+	int splitColumn() const;
+
+	/**
+	 * Maps an image column to the widget's horizontal coordinates.
+	 */
+	qreal mapColumnToWidget(int column) const;
+
 	CompositeDisplayMode displayMode_;
 
 	qreal displayRatio_;
@@ -174,4 +197,8 @@ private:
 	QImage rightImage_;
 
 	QImage compositeCache_;
+
+	ScaledImageCache leftTiles_;
+	ScaledImageCache rightTiles_;
+	ScaledImageCache compositeTiles_;
 };
@@ -201,4 +201,23 @@ extern const BuiltinColorRanges builtinColorRanges;
  */
 extern const BuiltinPalettes builtinPalettes;
 
+/**
+ * Retrieves a precomputed color map for a built-in color range and palette.
+ *
+ * The results of applying every built-in color range to every built-in
+ * palette are generated at compile time. Lookups are done by value, so
+ * user-defined color ranges and palettes identical to built-in ones will
+ * also match.
+ *
+ * @param colorRange   Color range.
+ * @param palette      Source palette.
+ * @param colorMap     Set to the same color map ColorRange::applyToPalette()
+ *                     would produce, if a match is found.
+ *
+ * @return Whether a precomputed color map was found.
+ */
+bool precomputedColorMap(const ColorRange& colorRange,
+						 const ColorList& palette,
+						 ColorMap& colorMap);
+
 } // end namespace wesnoth
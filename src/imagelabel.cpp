@@ -26,25 +26,25 @@
 
 ImageLabel::ImageLabel(QWidget* parent) :
 	QWidget(parent),
-	image_()
+	cache_()
 {
 }
 
 void ImageLabel::setImage(const QImage& image)
 {
-	image_ = image.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	cache_.setImage(image);
 	update();
 }
 
 void ImageLabel::clear()
 {
-	image_ = QImage{};
+	cache_.clear();
 	update();
 }
 
 void ImageLabel::paintEvent(QPaintEvent* event)
 {
-	if (image_.isNull())
+	if (cache_.image().isNull())
 		return;
 
 	QPainter p{this};
@@ -52,5 +52,5 @@ void ImageLabel::paintEvent(QPaintEvent* event)
 	p.setClipRect(event->rect());
 	p.setRenderHint(QPainter::SmoothPixmapTransform, false);
 
-	p.drawImage(rect(), image_);
+	cache_.paint(p, rect(), event->rect());
 }
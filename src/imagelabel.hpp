@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include "scaledimagecache.hpp"
+
 #include <QWidget>
 
 /**
@@ -39,7 +41,7 @@ public:
 
 	virtual QSize minimumSizeHint() const override
 	{
-		return image_.size();
+		return image().size();
 	}
 	
 	/**
@@ -47,7 +49,7 @@ public:
 	 */
 	const QImage& image() const
 	{
-		return image_;
+		return cache_.image();
 	}
 
 	/**
@@ -68,5 +70,5 @@ protected:
 	virtual void paintEvent(QPaintEvent* event) override;
 
 private:
-	QImage image_;
+	ScaledImageCache cache_;
 };
@@ -0,0 +1,221 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "imageloader.hpp"
+
+#include "tracing.hpp"
+#include "wesnothrc.hpp"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+
+#include <functional>
+
+namespace {
+
+// Highest progress percentage reported while a request is still running
+constexpr int MAX_READ_PROGRESS = 99;
+
+/**
+ * Read-only file device that reports read progress and can be made to fail
+ * reads.
+ *
+ * This wraps a QFile rather than deriving from it, so that the position of
+ * the underlying file always matches what the decoder has consumed so far
+ * regardless of QIODevice's internal buffering.
+ */
+class ProgressFileDevice : public QIODevice
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param fileName     File name.
+	 * @param canceled     Called before every read. Reads fail if it
+	 *                     returns true.
+	 * @param progress     Called with the percentage of the file read so
+	 *                     far whenever it changes.
+	 */
+	ProgressFileDevice(const QString& fileName,
+					   std::function<bool()> canceled,
+					   std::function<void(int)> progress)
+		: QIODevice()
+		, file_(fileName)
+		, canceled_(std::move(canceled))
+		, progress_(std::move(progress))
+		, percent_(-1)
+	{
+	}
+
+	bool openFile()
+	{
+		return file_.open(QIODevice::ReadOnly) &&
+			   QIODevice::open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+	}
+
+	virtual qint64 size() const override
+	{
+		return file_.size();
+	}
+
+	virtual bool seek(qint64 pos) override
+	{
+		return QIODevice::seek(pos) && file_.seek(pos);
+	}
+
+protected:
+	virtual qint64 readData(char* data, qint64 maxSize) override
+	{
+		if (canceled_()) {
+			setErrorString(QStringLiteral("Operation canceled"));
+			return -1;
+		}
+
+		const auto count = file_.read(data, maxSize);
+		const auto fileSize = file_.size();
+
+		if (count > 0 && fileSize > 0) {
+			// Decoders may seek around, so this is only an approximation.
+			// Decoding and conversion may still take a while after reading
+			// the whole file, so completion is only signaled by finishing.
+			const auto percent = int(qMin(qint64(MAX_READ_PROGRESS), file_.pos() * 100 / fileSize));
+
+			if (percent != percent_) {
+				percent_ = percent;
+				progress_(percent);
+			}
+		}
+
+		return count;
+	}
+
+	virtual qint64 writeData(const char* /*data*/, qint64 /*maxSize*/) override
+	{
+		return -1;
+	}
+
+private:
+	QFile file_;
+	std::function<bool()> canceled_;
+	std::function<void(int)> progress_;
+	int percent_;
+};
+
+} // end unnamed namespace
+
+ImageLoader::ImageLoader(QObject* parent)
+	: QObject(parent)
+	, pool_()
+	, generation_(0)
+{
+}
+
+ImageLoader::~ImageLoader()
+{
+	cancel();
+	pool_.waitForDone();
+}
+
+void ImageLoader::load(const QString& fileName)
+{
+	start(fileName, [this, fileName](int generation) {
+		return read(fileName, generation);
+	});
+}
+
+void ImageLoader::loadData(const QByteArray& data)
+{
+	start({}, [this, data](int generation) {
+		MOS_TRACE_NAMED_SPAN(decodeSpan, "decode", "QImage::fromData");
+
+		const auto& image = QImage::fromData(data);
+
+		if (image.isNull() || !isCurrent(generation))
+			return QImage{};
+
+		MOS_TRACE_SET_IMAGE_SIZE(decodeSpan, image.size());
+
+		return toWorkingFormat(image);
+	});
+}
+
+void ImageLoader::cancel()
+{
+	generation_.fetchAndAddOrdered(1);
+}
+
+void ImageLoader::start(const QString& fileName, ReadFunction readFunction)
+{
+	// Superseded loads notice the new generation on their next read
+	const auto generation = generation_.fetchAndAddOrdered(1) + 1;
+
+	pool_.start([this, fileName, readFunction = std::move(readFunction), generation]() {
+		const auto& image = readFunction(generation);
+
+		if (!isCurrent(generation))
+			return;
+
+		QMetaObject::invokeMethod(this, [this, fileName, image, generation]() {
+			// The request may have been canceled in the meantime
+			if (isCurrent(generation))
+				emit finished(fileName, image);
+		}, Qt::QueuedConnection);
+	});
+}
+
+void ImageLoader::wait()
+{
+	pool_.waitForDone();
+}
+
+QImage ImageLoader::read(const QString& fileName, int generation)
+{
+	MOS_TRACE_NAMED_SPAN(decodeSpan, "decode", "ImageLoader::read");
+
+	ProgressFileDevice file{
+		fileName,
+		[this, generation]() {
+			return !isCurrent(generation);
+		},
+		[this, generation](int percent) {
+			QMetaObject::invokeMethod(this, [this, generation, percent]() {
+				if (isCurrent(generation))
+					emit progressChanged(percent);
+			}, Qt::QueuedConnection);
+		}};
+
+	if (!file.openFile())
+		return {};
+
+	// Like QImage::load(), try the format matching the file name suffix
+	// first and fall back to detecting it from the contents
+	QImageReader reader{&file, QFileInfo{fileName}.suffix().toLower().toLatin1()};
+	QImage image;
+
+	if (!reader.read(&image) || !isCurrent(generation))
+		return {};
+
+	MOS_TRACE_SET_IMAGE_SIZE(decodeSpan, image.size());
+
+	// We want to work on actual ARGB data (or indexed color data)
+	return toWorkingFormat(image);
+}
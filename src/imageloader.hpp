@@ -0,0 +1,118 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#pragma once
+
+#include <QAtomicInt>
+#include <QImage>
+#include <QObject>
+#include <QThreadPool>
+
+#include <functional>
+
+/**
+ * Loads image files, or encoded image data, on a background thread.
+ *
+ * Images are decoded from a file device that reports how much of the file
+ * has been read so far, which is used to emit progress updates. Canceling a
+ * load makes any further reads from the file fail, so decoders give up at
+ * their next read instead of running to completion.
+ *
+ * Loaded images are converted to the working format (see toWorkingFormat())
+ * before being delivered. Only the result of the most recent request is ever
+ * delivered, whether it was for a file or for data, and signals are always
+ * emitted in the thread the loader lives in.
+ */
+class ImageLoader : public QObject
+{
+	Q_OBJECT
+public:
+	explicit ImageLoader(QObject* parent = nullptr);
+
+	/**
+	 * Destructor.
+	 *
+	 * Any running load is canceled and waited on.
+	 */
+	virtual ~ImageLoader() override;
+
+	/**
+	 * Starts loading an image file, superseding any previous request.
+	 */
+	void load(const QString& fileName);
+
+	/**
+	 * Starts decoding an image from memory (e.g. from the clipboard),
+	 * superseding any previous request.
+	 *
+	 * No progress is reported for these requests.
+	 */
+	void loadData(const QByteArray& data);
+
+	/**
+	 * Cancels the current request, if any.
+	 *
+	 * No further signals are emitted for it.
+	 */
+	void cancel();
+
+	/**
+	 * Waits for all running loads to end.
+	 *
+	 * Results are delivered through the event loop as usual.
+	 */
+	void wait();
+
+signals:
+	/**
+	 * Emitted as the current request progresses.
+	 *
+	 * @param percent      Percentage of the file read so far. This stays
+	 *                     below 100 until the request is finished, since
+	 *                     decoding may continue after reading the file.
+	 */
+	void progressChanged(int percent);
+
+	/**
+	 * Emitted when the current request is done.
+	 *
+	 * @param fileName     Name of the file requested, or an empty string
+	 *                     for loadData() requests.
+	 * @param image        Loaded image, or a null image if the file could
+	 *                     not be read.
+	 */
+	void finished(const QString& fileName, const QImage& image);
+
+private:
+	using ReadFunction = std::function<QImage(int generation)>;
+
+	void start(const QString& fileName, ReadFunction readFunction);
+
+	QImage read(const QString& fileName, int generation);
+
+	bool isCurrent(int generation) const
+	{
+		return generation_.loadAcquire() == generation;
+	}
+
+	QThreadPool pool_;
+	QAtomicInt generation_;
+};
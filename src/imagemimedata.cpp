@@ -0,0 +1,76 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "imagemimedata.hpp"
+
+#include "wesnothrc.hpp"
+
+namespace {
+
+const QString MIME_TYPE_PNG = QStringLiteral("image/png");
+
+/** Format used by Qt for passing QImage objects in-process. */
+const QString MIME_TYPE_QT_IMAGE = QStringLiteral("application/x-qt-image");
+
+} // end unnamed namespace
+
+ImageMimeData::ImageMimeData(const QImage& image)
+	: QMimeData()
+	, image_(image)
+	, pngData_()
+{
+}
+
+QStringList ImageMimeData::formats() const
+{
+	if (image_.isNull())
+		return {};
+
+	// Platform integrations convert the QImage to any native formats
+	// (e.g. DIB on Windows) when asked to
+	return { MIME_TYPE_PNG, MIME_TYPE_QT_IMAGE };
+}
+
+bool ImageMimeData::hasFormat(const QString& mimeType) const
+{
+	return formats().contains(mimeType);
+}
+
+QVariant ImageMimeData::retrieveData(const QString& mimeType, QMetaType type) const
+{
+	if (image_.isNull())
+		return {};
+
+	if (mimeType == MIME_TYPE_QT_IMAGE)
+		return QVariant::fromValue(image_);
+
+	if (mimeType == MIME_TYPE_PNG) {
+		if (pngData_.isEmpty()) {
+			// The encoder may modify its input, so it gets a copy
+			auto image = image_;
+			pngData_ = MosIO::writePngData(image, false, MosIO::PngProfileFast);
+		}
+
+		return pngData_;
+	}
+
+	return QMimeData::retrieveData(mimeType, type);
+}
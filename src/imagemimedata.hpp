@@ -0,0 +1,65 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#pragma once
+
+#include <QImage>
+#include <QMimeData>
+
+/**
+ * MIME data for dragging or copying an image, encoded on demand.
+ *
+ * Unlike QMimeData::setImageData(), this offers a fixed list of formats and
+ * only encodes an image format once a drop target or clipboard client asks
+ * for it. PNG data is produced using the fast encoder profile and reused for
+ * subsequent requests.
+ */
+class ImageMimeData : public QMimeData
+{
+	Q_OBJECT
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param image        Image to provide. It should be in ARGB32 format
+	 *                     (see MosIO::writePng()).
+	 */
+	explicit ImageMimeData(const QImage& image);
+
+	/**
+	 * Retrieves the image.
+	 */
+	const QImage& image() const
+	{
+		return image_;
+	}
+
+	virtual QStringList formats() const override;
+
+	virtual bool hasFormat(const QString& mimeType) const override;
+
+protected:
+	virtual QVariant retrieveData(const QString& mimeType, QMetaType type) const override;
+
+private:
+	QImage image_;
+	mutable QByteArray pngData_;
+};
@@ -0,0 +1,986 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "imagestream.hpp"
+
+#include "tracing.hpp"
+#include "version.hpp"
+
+#include <QImageReader>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <QtEndian>
+
+#include <zlib.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const QByteArray PNG_SIGNATURE = QByteArrayLiteral("\x89PNG\r\n\x1A\n");
+
+// Amount of compressed data read or written at once
+constexpr qsizetype IO_BUFFER_SIZE = 64 * 1024;
+
+// Amount of filtered scanline data compressed by each thread at once with
+// PngProfileFast
+constexpr qsizetype FAST_DEFLATE_CHUNK_SIZE = 256 * 1024;
+
+// Size of the deflate sliding window
+constexpr qsizetype DEFLATE_WINDOW_SIZE = 32 * 1024;
+
+// zlib stream header for a 32 KiB window and the fastest compression level
+const QByteArray ZLIB_FAST_HEADER = QByteArrayLiteral("\x78\x01");
+
+// PNG color types
+enum PngColorType
+{
+	PngGray = 0,
+	PngRgb = 2,
+	PngPalette = 3,
+	PngGrayAlpha = 4,
+	PngRgba = 6,
+};
+
+// PNG filter types
+enum PngFilterType
+{
+	PngFilterNone = 0,
+	PngFilterSub = 1,
+	PngFilterUp = 2,
+	PngFilterAverage = 3,
+	PngFilterPaeth = 4,
+	PngFilterCount
+};
+
+// Formats whose image handlers can decode a clip rectangle without decoding
+// everything before it. Others (e.g. JPEG) decode the file from the start
+// every time, which would make reading in strips quadratic.
+const QList<QByteArray> RANDOM_ACCESS_CLIP_FORMATS{
+	QByteArrayLiteral("svg"),
+	QByteArrayLiteral("svgz"),
+};
+
+// Number of SerialCompressionScope objects alive in the current thread
+thread_local int serialCompressionDepth = 0;
+
+/**
+ * Returns whether the calling thread may compress chunks in parallel.
+ */
+bool parallelCompressionAllowed()
+{
+	// Workers of the global pool would only be competing with the chunks they
+	// queue for the same threads
+	return serialCompressionDepth == 0 &&
+		   !QThreadPool::globalInstance()->contains(QThread::currentThread());
+}
+
+inline uchar paethPredictor(int a, int b, int c)
+{
+	const int p = a + b - c;
+	const int pa = std::abs(p - a);
+	const int pb = std::abs(p - b);
+	const int pc = std::abs(p - c);
+
+	if (pa <= pb && pa <= pc)
+		return uchar(a);
+	if (pb <= pc)
+		return uchar(b);
+	return uchar(c);
+}
+
+} // end unnamed namespace
+
+namespace MosIO {
+
+//
+// SerialCompressionScope
+//
+
+SerialCompressionScope::SerialCompressionScope(bool enable)
+	: enabled_(enable)
+{
+	if (enabled_)
+		++serialCompressionDepth;
+}
+
+SerialCompressionScope::~SerialCompressionScope()
+{
+	if (enabled_)
+		--serialCompressionDepth;
+}
+
+bool SerialCompressionScope::isActive()
+{
+	return serialCompressionDepth != 0;
+}
+
+//
+// ImageStripReader
+//
+
+ImageStripReader::ImageStripReader(const QString& fileName)
+	: fileName_(fileName)
+	, errorString_()
+	, size_()
+	, rowsRead_(0)
+	, mode_(ReadWhole)
+	, image_()
+	, file_(fileName)
+	, inflate_()
+	, inflateInput_()
+	, idatRemaining_(0)
+	, idatDone_(false)
+	, colorType_(0)
+	, bitDepth_(0)
+	, bytesPerPixel_(0)
+	, rowBytes_(0)
+	, previousRow_()
+	, currentRow_()
+	, colorTable_()
+{
+}
+
+ImageStripReader::~ImageStripReader()
+{
+	if (inflate_)
+		inflateEnd(inflate_.get());
+}
+
+bool ImageStripReader::open()
+{
+	MOS_TRACE_SPAN("decode", "ImageStripReader::open");
+
+	if (openPng()) {
+		mode_ = ReadPng;
+		return true;
+	}
+
+	// Anything we can't decode ourselves (including damaged PNG files) is
+	// left to Qt, which will also take care of reporting errors
+	file_.close();
+
+	QImageReader reader{fileName_};
+	const auto size = reader.size();
+
+	if (size.isValid() &&
+		reader.supportsOption(QImageIOHandler::ClipRect) &&
+		RANDOM_ACCESS_CLIP_FORMATS.contains(reader.format())) {
+		mode_ = ReadClipRect;
+		size_ = size;
+		return true;
+	}
+
+	mode_ = ReadWhole;
+	image_ = reader.read();
+
+	if (image_.isNull())
+		return fail(reader.errorString());
+
+	image_.convertTo(QImage::Format_ARGB32);
+	size_ = image_.size();
+
+	return true;
+}
+
+QImage ImageStripReader::read(int maxRows)
+{
+	if (atEnd() || maxRows <= 0 || !errorString_.isEmpty())
+		return {};
+
+	const int rows = qMin(maxRows, size_.height() - rowsRead_);
+	const QRect rect{0, rowsRead_, size_.width(), rows};
+
+	MOS_TRACE_SPAN("decode", "ImageStripReader::read", rect.size());
+	QImage strip;
+
+	switch (mode_)
+	{
+		case ReadPng:
+			strip = readPngStrip(rows);
+			break;
+		case ReadClipRect:
+			{
+				// Handlers can only be read from once, so we need a new
+				// reader for every strip
+				QImageReader reader{fileName_};
+				reader.setClipRect(rect);
+				strip = reader.read();
+
+				if (strip.size() != rect.size()) {
+					fail(reader.errorString());
+					return {};
+				}
+
+				strip.convertTo(QImage::Format_ARGB32);
+			}
+			break;
+		case ReadWhole:
+			strip = image_.copy(rect);
+			break;
+	}
+
+	if (strip.isNull())
+		return {};
+
+	rowsRead_ += rows;
+
+	if (atEnd()) {
+		image_ = QImage{};
+		file_.close();
+	}
+
+	return strip;
+}
+
+bool ImageStripReader::openPng()
+{
+	if (!file_.open(QIODevice::ReadOnly))
+		return false;
+
+	// Signature and IHDR chunk
+	const auto header = file_.read(33);
+
+	if (header.size() != 33 ||
+		!header.startsWith(PNG_SIGNATURE) ||
+		header.mid(12, 4) != "IHDR")
+		return false;
+
+	const auto* ihdr = header.constData() + 16;
+	const auto width = qFromBigEndian<quint32>(ihdr);
+	const auto height = qFromBigEndian<quint32>(ihdr + 4);
+
+	bitDepth_ = uchar(ihdr[8]);
+	colorType_ = uchar(ihdr[9]);
+
+	const bool interlaced = ihdr[12] != 0;
+
+	if (width == 0 || height == 0 ||
+		width > 0x100000 || height > 0x7FFFFFFF || interlaced)
+		return false;
+
+	int channels = 0;
+
+	switch (colorType_)
+	{
+		case PngGray:
+			channels = 1;
+			break;
+		case PngRgb:
+			channels = 3;
+			break;
+		case PngPalette:
+			channels = 1;
+			break;
+		case PngGrayAlpha:
+			channels = 2;
+			break;
+		case PngRgba:
+			channels = 4;
+			break;
+		default:
+			return false;
+	}
+
+	// 16-bit samples and sub-byte grayscale are left to Qt, since we would
+	// need to reproduce its conversions exactly
+	if (colorType_ == PngPalette) {
+		if (bitDepth_ != 1 && bitDepth_ != 2 && bitDepth_ != 4 && bitDepth_ != 8)
+			return false;
+	} else if (bitDepth_ != 8) {
+		return false;
+	}
+
+	bytesPerPixel_ = qMax(1, channels * bitDepth_ / 8);
+	rowBytes_ = (qsizetype(width) * channels * bitDepth_ + 7) / 8;
+	colorTable_.clear();
+
+	// Walk the chunks preceding the image data
+	forever
+	{
+		const auto chunkHeader = file_.read(8);
+
+		if (chunkHeader.size() != 8)
+			return false;
+
+		const auto length = qFromBigEndian<quint32>(chunkHeader.constData());
+		const auto type = chunkHeader.mid(4);
+
+		if (type == "IDAT") {
+			idatRemaining_ = length;
+			break;
+		} else if (type == "IEND") {
+			return false;
+		} else if (type == "PLTE" && colorType_ == PngPalette) {
+			const auto plte = file_.read(length);
+
+			if (plte.size() != qsizetype(length))
+				return false;
+
+			for (qsizetype k = 0; k + 2 < plte.size(); k += 3)
+			{
+				colorTable_.push_back(qRgb(uchar(plte[k]),
+										   uchar(plte[k + 1]),
+										   uchar(plte[k + 2])));
+			}
+		} else if (type == "tRNS") {
+			// Color key transparency is rare enough not to bother with it
+			if (colorType_ != PngPalette)
+				return false;
+
+			const auto trns = file_.read(length);
+
+			if (trns.size() != qsizetype(length))
+				return false;
+
+			for (qsizetype k = 0; k < qMin(trns.size(), colorTable_.size()); ++k)
+			{
+				colorTable_[k] = qRgba(qRed(colorTable_[k]),
+									   qGreen(colorTable_[k]),
+									   qBlue(colorTable_[k]),
+									   uchar(trns[k]));
+			}
+		} else if (file_.skip(length) != qint64(length)) {
+			return false;
+		}
+
+		// CRC
+		if (file_.skip(4) != 4)
+			return false;
+	}
+
+	if (colorType_ == PngPalette) {
+		if (colorTable_.isEmpty())
+			return false;
+		// Same as QImage's Indexed8 to ARGB32 conversion
+		colorTable_.resize(256, 0);
+	}
+
+	inflate_.reset(new z_stream_s{});
+
+	if (inflateInit(inflate_.get()) != Z_OK) {
+		inflate_.reset();
+		return false;
+	}
+
+	idatDone_ = false;
+	inflateInput_.resize(IO_BUFFER_SIZE);
+	previousRow_ = QByteArray(rowBytes_ + 1, '\0');
+	currentRow_ = QByteArray(rowBytes_ + 1, '\0');
+	size_ = QSize{int(width), int(height)};
+
+	return true;
+}
+
+bool ImageStripReader::fillInflateInput()
+{
+	while (idatRemaining_ == 0)
+	{
+		if (idatDone_)
+			return false;
+
+		// CRC of the previous IDAT chunk, followed by the next chunk header
+		const auto chunkHeader = file_.read(12);
+
+		if (chunkHeader.size() != 12 || chunkHeader.mid(8) != "IDAT") {
+			idatDone_ = true;
+			return false;
+		}
+
+		idatRemaining_ = qFromBigEndian<quint32>(chunkHeader.constData() + 4);
+	}
+
+	const auto bytesRead = file_.read(inflateInput_.data(),
+									  qMin<qsizetype>(idatRemaining_, inflateInput_.size()));
+
+	if (bytesRead <= 0) {
+		idatDone_ = true;
+		return false;
+	}
+
+	idatRemaining_ -= quint32(bytesRead);
+
+	inflate_->next_in = reinterpret_cast<Bytef*>(inflateInput_.data());
+	inflate_->avail_in = uInt(bytesRead);
+
+	return true;
+}
+
+const uchar* ImageStripReader::readPngRow()
+{
+	auto* z = inflate_.get();
+
+	z->next_out = reinterpret_cast<Bytef*>(currentRow_.data());
+	z->avail_out = uInt(currentRow_.size());
+
+	while (z->avail_out > 0)
+	{
+		if (z->avail_in == 0 && !fillInflateInput()) {
+			fail(QStringLiteral("Truncated PNG image data"));
+			return nullptr;
+		}
+
+		const auto status = inflate(z, Z_NO_FLUSH);
+
+		if (status == Z_STREAM_END && z->avail_out > 0) {
+			fail(QStringLiteral("Truncated PNG image data"));
+			return nullptr;
+		} else if (status != Z_OK && status != Z_STREAM_END) {
+			fail(QStringLiteral("Corrupted PNG image data"));
+			return nullptr;
+		}
+	}
+
+	auto* row = reinterpret_cast<uchar*>(currentRow_.data()) + 1;
+	const auto* prev = reinterpret_cast<const uchar*>(previousRow_.constData()) + 1;
+	const auto bpp = bytesPerPixel_;
+
+	switch (uchar(currentRow_[0]))
+	{
+		case PngFilterNone:
+			break;
+		case PngFilterSub:
+			for (qsizetype i = bpp; i < rowBytes_; ++i)
+				row[i] += row[i - bpp];
+			break;
+		case PngFilterUp:
+			for (qsizetype i = 0; i < rowBytes_; ++i)
+				row[i] += prev[i];
+			break;
+		case PngFilterAverage:
+			for (qsizetype i = 0; i < rowBytes_; ++i)
+				row[i] += uchar(((i >= bpp ? row[i - bpp] : 0) + prev[i]) / 2);
+			break;
+		case PngFilterPaeth:
+			for (qsizetype i = 0; i < rowBytes_; ++i)
+			{
+				if (i >= bpp)
+					row[i] += paethPredictor(row[i - bpp], prev[i], prev[i - bpp]);
+				else
+					row[i] += prev[i];
+			}
+			break;
+		default:
+			fail(QStringLiteral("Corrupted PNG image data"));
+			return nullptr;
+	}
+
+	// The row just decoded becomes the previous row for the next one
+	std::swap(previousRow_, currentRow_);
+
+	return reinterpret_cast<const uchar*>(previousRow_.constData()) + 1;
+}
+
+QImage ImageStripReader::readPngStrip(int rows)
+{
+	QImage strip{size_.width(), rows, QImage::Format_ARGB32};
+
+	if (strip.isNull()) {
+		fail(QStringLiteral("Out of memory"));
+		return {};
+	}
+
+	const int width = size_.width();
+	const auto* colorTable = colorTable_.constData();
+
+	for (int y = 0; y < rows; ++y)
+	{
+		const auto* in = readPngRow();
+
+		if (!in)
+			return {};
+
+		auto* out = reinterpret_cast<QRgb*>(strip.scanLine(y));
+
+		switch (colorType_)
+		{
+			case PngGray:
+				for (int x = 0; x < width; ++x)
+					out[x] = qRgb(in[x], in[x], in[x]);
+				break;
+			case PngRgb:
+				for (int x = 0; x < width; ++x, in += 3)
+					out[x] = qRgb(in[0], in[1], in[2]);
+				break;
+			case PngPalette:
+				if (bitDepth_ == 8) {
+					for (int x = 0; x < width; ++x)
+						out[x] = colorTable[in[x]];
+				} else {
+					const int pixelsPerByte = 8 / bitDepth_;
+					const int mask = (1 << bitDepth_) - 1;
+
+					for (int x = 0; x < width; ++x)
+					{
+						const int shift = 8 - bitDepth_ * (x % pixelsPerByte + 1);
+						out[x] = colorTable[(in[x / pixelsPerByte] >> shift) & mask];
+					}
+				}
+				break;
+			case PngGrayAlpha:
+				for (int x = 0; x < width; ++x, in += 2)
+					out[x] = qRgba(in[0], in[0], in[0], in[1]);
+				break;
+			case PngRgba:
+				for (int x = 0; x < width; ++x, in += 4)
+					out[x] = qRgba(in[0], in[1], in[2], in[3]);
+				break;
+		}
+	}
+
+	return strip;
+}
+
+bool ImageStripReader::fail(const QString& errorString)
+{
+	errorString_ = errorString.isEmpty()
+				   ? QStringLiteral("Could not read image")
+				   : errorString;
+	image_ = QImage{};
+	file_.close();
+
+	return false;
+}
+
+//
+// PngStreamWriter
+//
+
+PngStreamWriter::PngStreamWriter(QIODevice* device,
+								 int width,
+								 int height,
+								 bool vanityPlate,
+								 PngProfile profile)
+	: device_(device)
+	, width_(width)
+	, height_(height)
+	, rowsWritten_(0)
+	, error_(false)
+	, finished_(false)
+	, profile_(profile)
+	, deflate_()
+	, previousRow_(qsizetype(width) * 4, '\0')
+	, currentRow_(qsizetype(width) * 4, '\0')
+	, filterCandidates_()
+	, idat_()
+	, pending_()
+	, dictionary_()
+	, adler_(quint32(adler32(0, nullptr, 0)))
+	, streamStarted_(false)
+{
+	if (!device_ || !device_->isWritable() || width_ <= 0 || height_ <= 0) {
+		error_ = true;
+		return;
+	}
+
+	if (profile_ != PngProfileFast) {
+		// Smallest is the same as QImageWriter::setCompression(100)
+		const int level = profile_ == PngProfileSmallest
+						  ? Z_BEST_COMPRESSION : Z_DEFAULT_COMPRESSION;
+
+		deflate_.reset(new z_stream_s{});
+
+		if (deflateInit(deflate_.get(), level) != Z_OK) {
+			deflate_.reset();
+			error_ = true;
+			return;
+		}
+
+		filterCandidates_.resize(PngFilterCount * (qsizetype(width) * 4 + 1));
+		idat_.resize(IO_BUFFER_SIZE);
+
+		deflate_->next_out = reinterpret_cast<Bytef*>(idat_.data());
+		deflate_->avail_out = uInt(idat_.size());
+	}
+
+	writeHeader(vanityPlate);
+}
+
+PngStreamWriter::~PngStreamWriter()
+{
+	if (deflate_)
+		deflateEnd(deflate_.get());
+}
+
+bool PngStreamWriter::write(const QImage& strip)
+{
+	MOS_TRACE_SPAN("encode", "PngStreamWriter::write", strip.size());
+
+	if (error_ || finished_)
+		return false;
+
+	if (strip.width() != width_ || rowsWritten_ + strip.height() > height_) {
+		error_ = true;
+		return false;
+	}
+
+	const auto input = strip.convertToFormat(QImage::Format_ARGB32);
+
+	for (int y = 0; y < input.height() && !error_; ++y)
+	{
+		const auto* in = reinterpret_cast<const QRgb*>(input.constScanLine(y));
+		auto* out = reinterpret_cast<uchar*>(currentRow_.data());
+
+		for (int x = 0; x < width_; ++x, out += 4)
+		{
+			out[0] = uchar(qRed(in[x]));
+			out[1] = uchar(qGreen(in[x]));
+			out[2] = uchar(qBlue(in[x]));
+			out[3] = uchar(qAlpha(in[x]));
+		}
+
+		if (profile_ == PngProfileFast)
+			writeFastRow(reinterpret_cast<const uchar*>(currentRow_.constData()));
+		else
+			writeFilteredRow(reinterpret_cast<const uchar*>(currentRow_.constData()));
+
+		std::swap(previousRow_, currentRow_);
+		++rowsWritten_;
+	}
+
+	return !error_;
+}
+
+bool PngStreamWriter::finish()
+{
+	MOS_TRACE_SPAN("encode", "PngStreamWriter::finish");
+
+	if (error_ || finished_)
+		return false;
+
+	if (rowsWritten_ != height_) {
+		error_ = true;
+		return false;
+	}
+
+	if (profile_ == PngProfileFast)
+		deflatePending(true);
+	else
+		deflateData(nullptr, 0, true);
+
+	writeChunk("IEND", {});
+
+	finished_ = true;
+
+	return !error_;
+}
+
+void PngStreamWriter::writeHeader(bool vanityPlate)
+{
+	static const QByteArray stamp = QString{"Wespal v%1"}.arg(MOS_VERSION).toLatin1();
+
+	device_->write(PNG_SIGNATURE);
+
+	QByteArray ihdr(13, '\0');
+
+	qToBigEndian<quint32>(quint32(width_), ihdr.data());
+	qToBigEndian<quint32>(quint32(height_), ihdr.data() + 4);
+	ihdr[8] = 8;		// Bit depth
+	ihdr[9] = PngRgba;	// Color type
+	// Compression method, filter method, and interlace method are all zero
+
+	writeChunk("IHDR", ihdr);
+
+	if (vanityPlate)
+		writeChunk("tEXt", QByteArray{"Software"} + '\0' + stamp);
+}
+
+void PngStreamWriter::writeChunk(const char* type, const QByteArray& data)
+{
+	QByteArray header(8, '\0');
+
+	qToBigEndian<quint32>(quint32(data.size()), header.data());
+	std::memcpy(header.data() + 4, type, 4);
+
+	auto crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+	crc = crc32(crc, reinterpret_cast<const Bytef*>(data.constData()), uInt(data.size()));
+
+	QByteArray trailer(4, '\0');
+	qToBigEndian<quint32>(quint32(crc), trailer.data());
+
+	if (device_->write(header) != header.size() ||
+		device_->write(data) != data.size() ||
+		device_->write(trailer) != trailer.size())
+		error_ = true;
+}
+
+void PngStreamWriter::writeFilteredRow(const uchar* row)
+{
+	// Try every filter type and pick the one with the minimum sum of
+	// absolute differences, which is the same heuristic libpng uses
+	constexpr qsizetype bpp = 4;
+
+	const auto rowBytes = currentRow_.size();
+	const auto* prev = reinterpret_cast<const uchar*>(previousRow_.constData());
+	auto* candidates = reinterpret_cast<uchar*>(filterCandidates_.data());
+
+	const uchar* best = nullptr;
+	quint64 bestSum = ~quint64(0);
+
+	for (int filter = PngFilterNone; filter < PngFilterCount; ++filter)
+	{
+		auto* out = candidates + filter * (rowBytes + 1);
+
+		// The Up, Average and Paeth filters are pointless for the first row
+		if (rowsWritten_ == 0 && filter >= PngFilterUp)
+			break;
+
+		out[0] = uchar(filter);
+
+		for (qsizetype i = 0; i < rowBytes; ++i)
+		{
+			const int left = i >= bpp ? row[i - bpp] : 0;
+			const int upLeft = i >= bpp ? prev[i - bpp] : 0;
+
+			switch (filter)
+			{
+				case PngFilterNone:
+					out[i + 1] = row[i];
+					break;
+				case PngFilterSub:
+					out[i + 1] = uchar(row[i] - left);
+					break;
+				case PngFilterUp:
+					out[i + 1] = uchar(row[i] - prev[i]);
+					break;
+				case PngFilterAverage:
+					out[i + 1] = uchar(row[i] - (left + prev[i]) / 2);
+					break;
+				case PngFilterPaeth:
+					out[i + 1] = uchar(row[i] - paethPredictor(left, prev[i], upLeft));
+					break;
+			}
+		}
+
+		quint64 sum = 0;
+
+		for (qsizetype i = 1; i <= rowBytes; ++i)
+			sum += quint64(std::abs(int(qint8(out[i]))));
+
+		if (sum < bestSum) {
+			best = out;
+			bestSum = sum;
+		}
+	}
+
+	deflateData(best, rowBytes + 1, false);
+}
+
+void PngStreamWriter::deflateData(const uchar* data, qsizetype length, bool finishStream)
+{
+	auto* z = deflate_.get();
+
+	z->next_in = const_cast<Bytef*>(data);
+	z->avail_in = uInt(length);
+
+	forever
+	{
+		const auto status = ::deflate(z, finishStream ? Z_FINISH : Z_NO_FLUSH);
+
+		if (status == Z_STREAM_ERROR) {
+			error_ = true;
+			return;
+		}
+
+		const bool done = finishStream ? status == Z_STREAM_END : z->avail_in == 0;
+
+		if (z->avail_out == 0 || (done && finishStream)) {
+			writeChunk("IDAT", idat_.left(idat_.size() - z->avail_out));
+			z->next_out = reinterpret_cast<Bytef*>(idat_.data());
+			z->avail_out = uInt(idat_.size());
+		}
+
+		if (done)
+			return;
+	}
+}
+
+void PngStreamWriter::writeFastRow(const uchar* row)
+{
+	// The Up filter needs no decisions to be made and does well on sprites
+	// and photos alike. For the first row it's the same as no filter at all.
+	const auto rowBytes = currentRow_.size();
+	const auto* prev = reinterpret_cast<const uchar*>(previousRow_.constData());
+	const auto offset = pending_.size();
+
+	pending_.resize(offset + rowBytes + 1);
+
+	auto* out = reinterpret_cast<uchar*>(pending_.data()) + offset;
+
+	out[0] = PngFilterUp;
+
+	for (qsizetype i = 0; i < rowBytes; ++i)
+		out[i + 1] = uchar(row[i] - prev[i]);
+
+	// Enough data to keep every thread busy
+	static const qsizetype batchSize = FAST_DEFLATE_CHUNK_SIZE * qMax(1, QThread::idealThreadCount());
+
+	if (pending_.size() >= batchSize)
+		deflatePending(false);
+}
+
+void PngStreamWriter::deflatePending(bool finishStream)
+{
+	struct Chunk
+	{
+		qsizetype offset;
+		qsizetype length;
+		QByteArray output;
+		quint32 adler;
+		bool ok;
+	};
+
+	const auto* data = reinterpret_cast<const Bytef*>(pending_.constData());
+	const auto length = pending_.size();
+
+	// The last call must always produce a final deflate block, even if
+	// there is no data left
+	const auto chunkCount = qMax<qsizetype>(1, (length + FAST_DEFLATE_CHUNK_SIZE - 1) / FAST_DEFLATE_CHUNK_SIZE);
+
+	std::vector<Chunk> chunks(chunkCount);
+
+	const auto deflateChunk = [this, data, length, chunkCount, finishStream, &chunks](qsizetype k) {
+		auto& chunk = chunks[k];
+
+		chunk.offset = k * FAST_DEFLATE_CHUNK_SIZE;
+		chunk.length = qMin(FAST_DEFLATE_CHUNK_SIZE, length - chunk.offset);
+		chunk.adler = quint32(adler32(adler32(0, nullptr, 0), data + chunk.offset, uInt(chunk.length)));
+		chunk.ok = false;
+
+		z_stream z{};
+
+		// Raw deflate data, since every chunk's output is concatenated into
+		// a single zlib stream
+		if (deflateInit2(&z, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return;
+
+		// Matches may refer to the data preceding the chunk, which would be
+		// in the sliding window if the whole stream was compressed at once
+		if (k > 0) {
+			const auto dictionaryLength = qMin(DEFLATE_WINDOW_SIZE, chunk.offset);
+			deflateSetDictionary(&z, data + chunk.offset - dictionaryLength, uInt(dictionaryLength));
+		} else if (!dictionary_.isEmpty()) {
+			deflateSetDictionary(&z, reinterpret_cast<const Bytef*>(dictionary_.constData()),
+								 uInt(dictionary_.size()));
+		}
+
+		// Only the last chunk of the stream ends with a final block, the rest
+		// are flushed to a byte boundary so they can be concatenated
+		const int flush = finishStream && k == chunkCount - 1 ? Z_FINISH : Z_SYNC_FLUSH;
+
+		chunk.output.resize(qsizetype(deflateBound(&z, uLong(chunk.length))) + 16);
+
+		z.next_in = const_cast<Bytef*>(data + chunk.offset);
+		z.avail_in = uInt(chunk.length);
+		z.next_out = reinterpret_cast<Bytef*>(chunk.output.data());
+		z.avail_out = uInt(chunk.output.size());
+
+		forever
+		{
+			const auto status = ::deflate(&z, flush);
+
+			if (status == Z_STREAM_END || (status == Z_OK && z.avail_out != 0)) {
+				chunk.ok = true;
+				break;
+			} else if ((status != Z_OK && status != Z_BUF_ERROR) || z.avail_out != 0) {
+				break;
+			}
+
+			// Out of output space, which should not really happen
+			const auto used = chunk.output.size();
+
+			chunk.output.resize(used * 2);
+			z.next_out = reinterpret_cast<Bytef*>(chunk.output.data()) + used;
+			z.avail_out = uInt(used);
+		}
+
+		chunk.output.truncate(qsizetype(z.total_out));
+
+		deflateEnd(&z);
+	};
+
+	if (chunkCount > 1 && parallelCompressionAllowed()) {
+		auto* pool = QThreadPool::globalInstance();
+		QSemaphore done;
+		std::vector<std::unique_ptr<QRunnable>> tasks;
+
+		for (qsizetype k = 1; k < chunkCount; ++k)
+		{
+			auto& task = tasks.emplace_back(QRunnable::create([&deflateChunk, &done, k]() {
+				deflateChunk(k);
+				done.release();
+			}));
+
+			task->setAutoDelete(false);
+			pool->start(task.get());
+		}
+
+		deflateChunk(0);
+
+		// Chunks the pool hasn't got to yet (e.g. because it is busy with
+		// other work) are deflated on this thread instead of waiting
+		for (auto& task : tasks)
+		{
+			if (pool->tryTake(task.get()))
+				task->run();
+		}
+
+		done.acquire(int(chunkCount - 1));
+	} else {
+		for (qsizetype k = 0; k < chunkCount; ++k)
+		{
+			deflateChunk(k);
+		}
+	}
+
+	for (auto& chunk : chunks)
+	{
+		if (!chunk.ok) {
+			error_ = true;
+			return;
+		}
+
+		adler_ = quint32(adler32_combine(adler_, chunk.adler, z_off_t(chunk.length)));
+
+		if (!streamStarted_) {
+			chunk.output.prepend(ZLIB_FAST_HEADER);
+			streamStarted_ = true;
+		}
+
+		if (finishStream && &chunk == &chunks.back()) {
+			QByteArray trailer(4, '\0');
+			qToBigEndian<quint32>(adler_, trailer.data());
+			chunk.output.append(trailer);
+		}
+
+		writeChunk("IDAT", chunk.output);
+	}
+
+	// Keep the end of the data as the dictionary for the next batch
+	dictionary_ = (dictionary_ + pending_.right(DEFLATE_WINDOW_SIZE)).right(DEFLATE_WINDOW_SIZE);
+
+	pending_.truncate(0);
+}
+
+} // end namespace MosIO
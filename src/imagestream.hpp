@@ -0,0 +1,328 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QImage>
+#include <QIODevice>
+#include <QList>
+#include <QSize>
+#include <QString>
+
+#include <memory>
+
+struct z_stream_s;
+
+namespace MosIO {
+
+/**
+ * PNG encoder profiles, trading off encoding speed and file size.
+ */
+enum PngProfile
+{
+	/**
+	 * Fastest encoding. Uses a fixed scanline filter and the fastest zlib
+	 * compression level, compressing large images using multiple threads.
+	 */
+	PngProfileFast,
+	/**
+	 * Adaptive scanline filters and zlib's default compression level.
+	 */
+	PngProfileBalanced,
+	/**
+	 * Adaptive scanline filters and zlib's best compression level.
+	 */
+	PngProfileSmallest,
+};
+
+/**
+ * Reads an image file in strips of scanlines.
+ *
+ * Non-interlaced PNG files with 8-bit samples (or palette images of any bit
+ * depth) are decoded incrementally, so only the current strip and a couple
+ * of scanlines need to be in memory at once. Other formats are read through
+ * QImageReader, a strip at a time if the format plugin can decode clip rects
+ * without decoding the rest of the image first (such as SVG), or all at once
+ * otherwise.
+ *
+ * The strips returned are always in ARGB32 format, and contain exactly the
+ * same pixels that loading the whole file into a QImage and converting it
+ * to ARGB32 would have produced.
+ */
+class ImageStripReader
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param fileName     Image file name.
+	 */
+	explicit ImageStripReader(const QString& fileName);
+
+	~ImageStripReader();
+
+	ImageStripReader(const ImageStripReader&) = delete;
+	ImageStripReader& operator=(const ImageStripReader&) = delete;
+
+	/**
+	 * Opens the image file and reads its header.
+	 *
+	 * @return Whether the file could be opened and is a supported image.
+	 */
+	bool open();
+
+	/**
+	 * Returns the image dimensions. Only valid after calling open().
+	 */
+	QSize size() const
+	{
+		return size_;
+	}
+
+	/**
+	 * Returns the number of scanlines read so far.
+	 */
+	int rowsRead() const
+	{
+		return rowsRead_;
+	}
+
+	/**
+	 * Returns whether all scanlines have been read.
+	 */
+	bool atEnd() const
+	{
+		return rowsRead_ >= size_.height();
+	}
+
+	/**
+	 * Returns whether the image is decoded incrementally rather than being
+	 * loaded into memory in its entirety.
+	 */
+	bool isIncremental() const
+	{
+		return mode_ != ReadWhole;
+	}
+
+	/**
+	 * Reads the next strip of scanlines.
+	 *
+	 * @param maxRows      Maximum number of scanlines to read.
+	 *
+	 * @return An ARGB32 image with the same width as the input image, or a
+	 *         null image if there are no more scanlines or an error occurs.
+	 */
+	QImage read(int maxRows);
+
+	/**
+	 * Returns a description of the last error.
+	 */
+	const QString& errorString() const
+	{
+		return errorString_;
+	}
+
+private:
+	enum ReadMode
+	{
+		ReadPng,
+		ReadClipRect,
+		ReadWhole,
+	};
+
+	bool openPng();
+
+	const uchar* readPngRow();
+
+	bool fillInflateInput();
+
+	QImage readPngStrip(int rows);
+
+	bool fail(const QString& errorString);
+
+	QString fileName_;
+	QString errorString_;
+	QSize size_;
+	int rowsRead_;
+	ReadMode mode_;
+
+	// Whole-image mode
+	QImage image_;
+
+	// PNG mode
+	QFile file_;
+	std::unique_ptr<z_stream_s> inflate_;
+	QByteArray inflateInput_;
+	quint32 idatRemaining_;
+	bool idatDone_;
+	int colorType_;
+	int bitDepth_;
+	int bytesPerPixel_;
+	qsizetype rowBytes_;
+	QByteArray previousRow_;
+	QByteArray currentRow_;
+	QList<QRgb> colorTable_;
+};
+
+/**
+ * Disables parallel compression with PngProfileFast in the calling thread
+ * for as long as the object exists. ImagePathFunctionChain::apply() also
+ * processes images on the calling thread alone within this scope.
+ *
+ * This is meant for code that already runs several encoders at once on
+ * separate threads (such as RecolorJobRunner), where splitting up each one
+ * further would only oversubscribe the CPU.
+ */
+class SerialCompressionScope
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param enable       Whether to actually disable parallel compression.
+	 */
+	explicit SerialCompressionScope(bool enable = true);
+
+	~SerialCompressionScope();
+
+	SerialCompressionScope(const SerialCompressionScope&) = delete;
+	SerialCompressionScope& operator=(const SerialCompressionScope&) = delete;
+
+	/**
+	 * Returns whether an enabled scope exists in the calling thread.
+	 */
+	static bool isActive();
+
+private:
+	bool enabled_;
+};
+
+/**
+ * Encodes a PNG file incrementally.
+ *
+ * Scanlines are filtered and compressed as soon as they are provided, so
+ * that images of any size can be written without ever having the whole
+ * image in memory. The output is always an 8-bit RGBA PNG file, unlike
+ * writePng(), which may write a palette PNG file instead.
+ *
+ * With PngProfileFast, scanlines are buffered and compressed in independent
+ * chunks that are deflated in parallel on the global thread pool, each one
+ * using the end of the previous chunk as its dictionary so as not to lose
+ * much compression. Chunks are deflated one after another instead when
+ * encoding on a thread of the global pool, or within a
+ * SerialCompressionScope.
+ */
+class PngStreamWriter
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param device       Output device, which must already be open for
+	 *                     writing. The device is not owned by the writer.
+	 * @param width        Image width.
+	 * @param height       Image height.
+	 * @param vanityPlate  Whether to include a tEXt chunk for a Software
+	 *                     comment (see writePng()).
+	 * @param profile      Encoder profile.
+	 */
+	PngStreamWriter(QIODevice* device,
+					int width,
+					int height,
+					bool vanityPlate = true,
+					PngProfile profile = PngProfileSmallest);
+
+	~PngStreamWriter();
+
+	PngStreamWriter(const PngStreamWriter&) = delete;
+	PngStreamWriter& operator=(const PngStreamWriter&) = delete;
+
+	/**
+	 * Encodes a strip of scanlines.
+	 *
+	 * @param strip        Strip of scanlines, which must be as wide as the
+	 *                     output image. Formats other than ARGB32 are
+	 *                     converted first.
+	 *
+	 * @return Whether the scanlines were written successfully.
+	 */
+	bool write(const QImage& strip);
+
+	/**
+	 * Finishes encoding the image.
+	 *
+	 * @return Whether the file is complete and was written successfully.
+	 *         This is false if fewer scanlines than the image height were
+	 *         provided.
+	 */
+	bool finish();
+
+	/**
+	 * Returns whether a write error has occurred.
+	 */
+	bool hasError() const
+	{
+		return error_;
+	}
+
+	/**
+	 * Returns the number of scanlines written so far.
+	 */
+	int rowsWritten() const
+	{
+		return rowsWritten_;
+	}
+
+private:
+	void writeHeader(bool vanityPlate);
+
+	void writeChunk(const char* type, const QByteArray& data);
+
+	void writeFilteredRow(const uchar* row);
+
+	void writeFastRow(const uchar* row);
+
+	void deflateData(const uchar* data, qsizetype length, bool finishStream);
+
+	void deflatePending(bool finishStream);
+
+	QIODevice* device_;
+	int width_;
+	int height_;
+	int rowsWritten_;
+	bool error_;
+	bool finished_;
+	PngProfile profile_;
+	std::unique_ptr<z_stream_s> deflate_;
+	QByteArray previousRow_;
+	QByteArray currentRow_;
+	QByteArray filterCandidates_;
+	QByteArray idat_;
+
+	// Fast profile
+	QByteArray pending_;
+	QByteArray dictionary_;
+	quint32 adler_;
+	bool streamStarted_;
+};
+
+} // end namespace MosIO
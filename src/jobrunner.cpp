@@ -0,0 +1,207 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "jobrunner.hpp"
+
+RecolorJobRunner::RecolorJobRunner(QObject* parent)
+	: QObject(parent)
+	, jobs_()
+	, status_()
+	, pool_()
+	, finishedJobs_(0)
+	, canceled_(0)
+	, vanityPlate_(true)
+	, pngProfile_(MosIO::PngProfileBalanced)
+	, started_(false)
+{
+}
+
+RecolorJobRunner::~RecolorJobRunner()
+{
+	cancel();
+	pool_.waitForDone();
+}
+
+void RecolorJobRunner::addJob(const QImage& input,
+							  const CompiledColorMap& colorMap,
+							  const QString& fileName)
+{
+	Q_ASSERT(!started_);
+
+	jobs_.push_back({input, colorMap, {}, false, fileName});
+	status_.push_back(JobPending);
+}
+
+void RecolorJobRunner::addJob(const QImage& input,
+							  const ImagePathFunctionChain& functions,
+							  const QString& fileName)
+{
+	Q_ASSERT(!started_);
+
+	jobs_.push_back({input, {}, functions, true, fileName});
+	status_.push_back(JobPending);
+}
+
+void RecolorJobRunner::start()
+{
+	Q_ASSERT(!started_);
+
+	started_ = true;
+
+	if (jobs_.isEmpty()) {
+		emit finished();
+		return;
+	}
+
+	// Make sure the status list is detached before any workers write to it,
+	// since each worker only ever touches its own job's entry.
+	status_.detach();
+
+	// Jobs sharing the same input are recolored together in a single pass
+	// over the input, after which their outputs are encoded in parallel.
+	QMap<qint64, QList<qsizetype>> batches;
+
+	for (qsizetype k = 0; k < jobs_.count(); ++k)
+	{
+		if (jobs_[k].useFunctions) {
+			pool_.start([this, k]() { runJob(k); });
+		} else {
+			batches[jobs_[k].input.cacheKey()].push_back(k);
+		}
+	}
+
+	for (const auto& batch : std::as_const(batches))
+	{
+		if (batch.count() == 1) {
+			pool_.start([this, index = batch.front()]() { runJob(index); });
+		} else {
+			pool_.start([this, batch]() { runBatch(batch); });
+		}
+	}
+}
+
+void RecolorJobRunner::wait()
+{
+	pool_.waitForDone();
+}
+
+void RecolorJobRunner::cancel()
+{
+	canceled_.storeRelease(1);
+}
+
+QStringList RecolorJobRunner::succeeded() const
+{
+	return fileNamesWithStatus(JobSucceeded);
+}
+
+QStringList RecolorJobRunner::failed() const
+{
+	return fileNamesWithStatus(JobFailed);
+}
+
+void RecolorJobRunner::runJob(qsizetype index)
+{
+	if (isCanceled()) {
+		finishJob(index, JobCanceled);
+		return;
+	}
+
+	const auto& job = jobs_.at(index);
+
+	if (job.useFunctions) {
+		// Other jobs are already being processed on the remaining threads
+		const MosIO::SerialCompressionScope serialCompression{jobCount() > 1};
+		writeJob(index, job.functions.apply(job.input));
+	} else {
+		writeJob(index, recolorImage(job.input, job.colorMap));
+	}
+}
+
+void RecolorJobRunner::runBatch(const QList<qsizetype>& indexes)
+{
+	if (isCanceled()) {
+		for (auto index : indexes)
+		{
+			finishJob(index, JobCanceled);
+		}
+		return;
+	}
+
+	QList<CompiledColorMap> colorMaps;
+
+	for (auto index : indexes)
+	{
+		colorMaps.push_back(jobs_.at(index).colorMap);
+	}
+
+	auto outputs = recolorImages(jobs_.at(indexes.front()).input, colorMaps);
+
+	// Encode the last output on this thread and hand off the rest
+	for (qsizetype k = 0; k < indexes.count() - 1; ++k)
+	{
+		pool_.start([this, index = indexes[k], rc = std::move(outputs[k])]() {
+			writeJob(index, rc);
+		});
+	}
+
+	writeJob(indexes.back(), std::move(outputs.back()));
+}
+
+void RecolorJobRunner::writeJob(qsizetype index, QImage rc)
+{
+	const auto& job = jobs_.at(index);
+
+	// Other jobs are already being encoded on the remaining threads
+	const MosIO::SerialCompressionScope serialCompression{jobCount() > 1};
+
+	finishJob(index, MosIO::writePng(rc, job.fileName, vanityPlate_, pngProfile_)
+					 ? JobSucceeded
+					 : JobFailed);
+}
+
+void RecolorJobRunner::finishJob(qsizetype index, JobStatus status)
+{
+	status_.data()[index] = status;
+
+	// The release half publishes the status above to whoever reads the
+	// finished job count afterwards.
+	auto finishedJobs = finishedJobs_.fetchAndAddAcqRel(1) + 1;
+
+	emit progressChanged(finishedJobs, jobCount());
+
+	if (finishedJobs == jobCount()) {
+		emit finished();
+	}
+}
+
+QStringList RecolorJobRunner::fileNamesWithStatus(JobStatus status) const
+{
+	QStringList fileNames;
+
+	for (qsizetype k = 0; k < jobs_.count(); ++k)
+	{
+		if (status_[k] == status) {
+			fileNames.push_back(jobs_[k].fileName);
+		}
+	}
+
+	return fileNames;
+}
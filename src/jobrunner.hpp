@@ -0,0 +1,222 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include "wesnothrc.hpp"
+
+#include <QAtomicInt>
+#include <QImage>
+#include <QObject>
+#include <QThreadPool>
+
+/**
+ * Runs batches of recolor-and-save jobs in parallel.
+ *
+ * Each job recolors an input image with a color map and writes the result to
+ * disk as a PNG file. Jobs are distributed across a private thread pool, so
+ * that recoloring and PNG encoding of different jobs overlap on all available
+ * CPU cores while the calling thread remains free to process events. Jobs
+ * sharing the same input image are recolored together in a single pass using
+ * recolorImages(). Jobs may also use image path function chains instead of
+ * color maps, in which case they are always run separately.
+ *
+ * Jobs are added with addJob() and executed by calling start(). Progress is
+ * reported through signals, which are emitted from worker threads and thus
+ * delivered through queued connections to receivers living in other threads.
+ * Results become available after finished() is emitted or wait() returns.
+ *
+ * A runner may only be started once.
+ */
+class RecolorJobRunner : public QObject
+{
+	Q_OBJECT
+public:
+	explicit RecolorJobRunner(QObject* parent = nullptr);
+
+	/**
+	 * Destructor.
+	 *
+	 * Any pending jobs are canceled, and running jobs are waited on.
+	 */
+	virtual ~RecolorJobRunner() override;
+
+	/**
+	 * Sets whether to include a Software comment in the output PNG files.
+	 *
+	 * @see MosIO::writePng()
+	 */
+	void setVanityPlate(bool vanityPlate)
+	{
+		vanityPlate_ = vanityPlate;
+	}
+
+	/**
+	 * Sets the encoder profile used for the output PNG files. The default is
+	 * MosIO::PngProfileBalanced.
+	 *
+	 * @see MosIO::writePng()
+	 */
+	void setPngProfile(MosIO::PngProfile profile)
+	{
+		pngProfile_ = profile;
+	}
+
+	/**
+	 * Adds a job to the queue. This must be done before calling start().
+	 *
+	 * @param input        Input image. Images are implicitly shared, so the
+	 *                     same image may be used for many jobs at no cost.
+	 * @param colorMap     Color map used for recoloring @a input.
+	 * @param fileName     Output file name.
+	 */
+	void addJob(const QImage& input,
+				const CompiledColorMap& colorMap,
+				const QString& fileName);
+
+	/**
+	 * Adds a job using an image path function chain rather than a color map.
+	 * This must be done before calling start().
+	 *
+	 * @param input        Input image.
+	 * @param functions    Image path functions used for recoloring @a input.
+	 * @param fileName     Output file name.
+	 */
+	void addJob(const QImage& input,
+				const ImagePathFunctionChain& functions,
+				const QString& fileName);
+
+	/**
+	 * Returns the number of jobs queued.
+	 */
+	int jobCount() const
+	{
+		return int(jobs_.count());
+	}
+
+	/**
+	 * Returns the number of jobs completed, failed, or canceled so far.
+	 */
+	int finishedJobCount() const
+	{
+		return finishedJobs_.loadAcquire();
+	}
+
+	/**
+	 * Returns whether the runner has been started and still has jobs left.
+	 */
+	bool isRunning() const
+	{
+		return started_ && finishedJobCount() < jobCount();
+	}
+
+	/**
+	 * Returns whether cancel() has been called.
+	 */
+	bool isCanceled() const
+	{
+		return canceled_.loadAcquire() != 0;
+	}
+
+	/**
+	 * Starts running all queued jobs and returns immediately.
+	 *
+	 * If there are no jobs queued, finished() is emitted right away.
+	 */
+	void start();
+
+	/**
+	 * Blocks until all jobs have finished running.
+	 */
+	void wait();
+
+	/**
+	 * Returns the output file names of jobs that completed successfully.
+	 *
+	 * This is only meaningful once all jobs have finished. File names are
+	 * listed in the same order their jobs were added.
+	 */
+	QStringList succeeded() const;
+
+	/**
+	 * Returns the output file names of jobs that failed.
+	 *
+	 * This is only meaningful once all jobs have finished. File names are
+	 * listed in the same order their jobs were added.
+	 */
+	QStringList failed() const;
+
+public slots:
+	/**
+	 * Cancels any jobs that have not started running yet.
+	 *
+	 * Jobs already running are allowed to complete, so no partially-written
+	 * files are left behind.
+	 */
+	void cancel();
+
+signals:
+	/**
+	 * Emitted every time a job finishes running, or is canceled.
+	 */
+	void progressChanged(int finishedJobs, int totalJobs);
+
+	/**
+	 * Emitted once after the last job has finished running.
+	 */
+	void finished();
+
+private:
+	enum JobStatus
+	{
+		JobPending,
+		JobSucceeded,
+		JobFailed,
+		JobCanceled,
+	};
+
+	struct Job
+	{
+		QImage input;
+		CompiledColorMap colorMap;
+		ImagePathFunctionChain functions;
+		bool useFunctions;
+		QString fileName;
+	};
+
+	void runJob(qsizetype index);
+
+	void runBatch(const QList<qsizetype>& indexes);
+
+	void writeJob(qsizetype index, QImage rc);
+
+	void finishJob(qsizetype index, JobStatus status);
+
+	QStringList fileNamesWithStatus(JobStatus status) const;
+
+	QList<Job> jobs_;
+	QList<JobStatus> status_;
+	QThreadPool pool_;
+	QAtomicInt finishedJobs_;
+	QAtomicInt canceled_;
+	bool vanityPlate_;
+	MosIO::PngProfile pngProfile_;
+	bool started_;
+};
@@ -18,7 +18,9 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include "appconfig.hpp"
 #include "mainwindow.hpp"
+#include "tracing.hpp"
 #include "version.hpp"
 
 #include <QApplication>
@@ -53,6 +55,9 @@ int main(int argc, char *argv[])
 	// Required on Wayland
 	QGuiApplication::setDesktopFileName("me.irydacea.Wespal");
 
+	if (!MosTrace::startFromEnvironment())
+		MosTrace::start(MosCurrentConfig().traceFile());
+
 	MainWindow w;
 
 	if (!initialFile.isEmpty())
@@ -60,5 +65,10 @@ int main(int argc, char *argv[])
 
 	w.show();
 
-	return a.exec();
+	const auto status = a.exec();
+
+	MosCurrentConfig().flush();
+	MosTrace::stop();
+
+	return status;
 }
@@ -21,9 +21,14 @@
 #include "appconfig.hpp"
 #include "codesnippetdialog.hpp"
 #include "defs.hpp"
+#include "imageloader.hpp"
+#include "imagemimedata.hpp"
+#include "jobrunner.hpp"
 #include "mainwindow.hpp"
 #include "paletteitem.hpp"
+#include "previewrenderer.hpp"
 #include "settingsdialog.hpp"
+#include "tracing.hpp"
 #include "ui_mainwindow.h"
 #include "util.hpp"
 
@@ -35,13 +40,19 @@
 #include <QDrag>
 #include <QDragEnterEvent>
 #include <QDropEvent>
+#include <QEventLoop>
 #include <QFileDialog>
+#include <QImageReader>
 #include <QPainter>
+#include <QPixmapCache>
 #include <QMessageBox>
 #include <QMimeData>
+#include <QProgressDialog>
+#include <QScopeGuard>
 #include <QScrollBar>
 #include <QSplitter>
 #include <QStringBuilder>
+#include <QStyledItemDelegate>
 #include <QWhatsThis>
 
 namespace {
@@ -61,6 +72,119 @@ enum WorkAreaPage {
 	WorkAreaCompositeRc,
 };
 
+/**
+ * Item delegate for the recent files list that only decodes the thumbnails
+ * of items that are actually painted.
+ *
+ * Laying out the list only requires knowing whether an item has a thumbnail,
+ * which does not involve decoding it (see MruEntry::hasThumbnail()).
+ */
+class MruItemDelegate : public QStyledItemDelegate
+{
+public:
+	using QStyledItemDelegate::QStyledItemDelegate;
+
+	virtual void paint(QPainter* painter,
+					   const QStyleOptionViewItem& option,
+					   const QModelIndex& index) const override
+	{
+		painting_ = true;
+		QStyledItemDelegate::paint(painter, option, index);
+		painting_ = false;
+	}
+
+protected:
+	virtual void initStyleOption(QStyleOptionViewItem* option,
+								 const QModelIndex& index) const override
+	{
+		QStyledItemDelegate::initStyleOption(option, index);
+
+		const auto* entry = MosCurrentConfig().recentFiles().find(index.data(Qt::UserRole).toString());
+
+		if (!entry || !entry->hasThumbnail())
+			return;
+
+		// The view's icon size is used for the decoration either way
+		option->features |= QStyleOptionViewItem::HasDecoration;
+
+		if (painting_)
+			option->icon = QPixmap::fromImage(entry->thumbnail());
+	}
+
+private:
+	mutable bool painting_ = false;
+};
+
+/**
+ * Returns the encoded image format (e.g. image/png) to use for reading an
+ * image from the clipboard, or an empty string if there are none.
+ *
+ * Checking the list of formats does not require retrieving or decoding the
+ * clipboard contents.
+ */
+QString encodedClipboardImageFormat(const QMimeData* mimeData)
+{
+	static const QList<QByteArray> supportedTypes = QImageReader::supportedMimeTypes();
+
+	const auto& formats = mimeData->formats();
+
+	// Prefer lossless formats when there is a choice
+	if (formats.contains("image/png"))
+		return "image/png";
+
+	for (const auto& format : formats)
+	{
+		if (supportedTypes.contains(format.toLatin1()))
+			return format;
+	}
+
+	return {};
+}
+
+/**
+ * Returns a translucent thumbnail of an image for use as a drag pixmap.
+ *
+ * Thumbnails are cached by image, so dragging the same image repeatedly
+ * does not require scaling it down every time.
+ */
+QPixmap dragPixmapFor(const QImage& image)
+{
+	static constexpr QSize maxDragPixmapSize{128, 128};
+
+	const auto& key = QStringLiteral("wespal-drag-%1").arg(image.cacheKey());
+	QPixmap dragPixmap;
+
+	if (QPixmapCache::find(key, &dragPixmap))
+		return dragPixmap;
+
+	auto dragPixmapSize = image.size();
+
+	if (dragPixmapSize.width() > maxDragPixmapSize.width() ||
+		dragPixmapSize.height() > maxDragPixmapSize.height())
+	{
+		dragPixmapSize.scale(maxDragPixmapSize, Qt::KeepAspectRatio);
+	}
+
+	// Nearest-neighbor sampling only reads the source pixels that end up in
+	// the thumbnail, instead of filtering the whole image
+	const auto& thumbnail = image.scaled(dragPixmapSize,
+										 Qt::IgnoreAspectRatio,
+										 Qt::FastTransformation);
+
+	dragPixmap = QPixmap{dragPixmapSize};
+	dragPixmap.fill(Qt::transparent);
+
+	{
+		QPainter painter{&dragPixmap};
+		painter.setOpacity(0.80);
+		painter.drawImage(0, 0, thumbnail);
+	}
+
+	QPixmapCache::insert(key, dragPixmap);
+
+	return dragPixmap;
+}
+
 } // end unnamed namespace
 
 MainWindow::MainWindow(QWidget* parent)
@@ -80,6 +204,8 @@ MainWindow::MainWindow(QWidget* parent)
 
 	, originalImage_()
 	, transformedImage_()
+	, keyColorIndex_()
+	, colorMapCache_()
 
 	, viewMode_()
 	, rcMode_()
@@ -101,11 +227,17 @@ MainWindow::MainWindow(QWidget* parent)
 	, panStart_(false)
 	, panStartPos_()
 
+	, runningJobs_(false)
+
 	, recentFileActions_()
 	, zoomActions_()
 	, viewModeActions_()
 
 	, compositeShortcutsGroup_(nullptr)
+	, previewRenderer_(new PreviewRenderer(this))
+	, imageLoader_(new ImageLoader(this))
+	, loadProgress_()
+	, reloadingFile_(false)
 
 	, supportedImageFileFormats_(MosPlatform::supportedImageFileFormats())
 {
@@ -115,6 +247,9 @@ MainWindow::MainWindow(QWidget* parent)
 
 	ui->setupUi(this);
 
+	connect(previewRenderer_, &PreviewRenderer::ready, this, &MainWindow::onPreviewRendered);
+	connect(imageLoader_, &ImageLoader::finished, this, &MainWindow::onImageLoaded);
+
 #ifdef Q_OS_MACOS
 	// smol sliders c:
 	ui->viewSlider->setAttribute(Qt::WA_MacMiniSize);
@@ -250,9 +385,22 @@ MainWindow::MainWindow(QWidget* parent)
 	ui->listMru->setIconSize(MosConfig::MruEntry::thumbnailSize() * 0.66);
 	ui->listMru->setWordWrap(true);
 	ui->listMru->setWrapping(false);
+	ui->listMru->setItemDelegate(new MruItemDelegate(ui->listMru));
 
 	connect(ui->listMru, SIGNAL(itemDoubleClicked(QListWidgetItem*)), this, SLOT(handleRecent()));
 
+	connect(ui->menuMru, &QMenu::aboutToShow, this, [this]() {
+		int k = 0;
+
+		for (const auto& entry : MosCurrentConfig().recentFiles())
+		{
+			if (k >= recentFileActions_.size())
+				break;
+
+			recentFileActions_[k++]->setIcon(QPixmap::fromImage(entry.miniThumbnail()));
+		}
+	});
+
 	updateRecentFilesMenu();
 
 	//
@@ -689,13 +837,11 @@ void MainWindow::updateRecentFilesMenu()
 		const auto& fileName = QFileInfo(filePath).fileName();
 		const auto& label =
 				QString("&%1 %2").arg(k + 1).arg(fileName);
-		const auto& thumbnail =
-				QPixmap::fromImage(entry.thumbnail());
-		const auto& miniThumbnail =
-				QPixmap::fromImage(entry.miniThumbnail());
 
+		// Menu icons are only set when the menu is about to be shown, and
+		// list icons are provided by MruItemDelegate when painted
 		act.setText(label);
-		act.setIcon(miniThumbnail);
+		act.setIcon({});
 		act.setData(filePath);
 
 		act.setEnabled(true);
@@ -706,7 +852,6 @@ void MainWindow::updateRecentFilesMenu()
 		listItem->setFlags(Qt::ItemIsSelectable | Qt::ItemIsEnabled);
 		listItem->setText(fileName);
 		listItem->setToolTip(filePath);
-		listItem->setIcon(thumbnail);
 		listItem->setData(Qt::UserRole, filePath);
 
 		++k;
@@ -732,6 +877,22 @@ void MainWindow::updateRecentFilesMenu()
 	ui->panelMru->setVisible(!MosCurrentConfig().recentFiles().empty());
 }
 
+void MainWindow::updateRecentFileThumbnail(const QString& filePath)
+{
+	for (int k = 0; k < ui->listMru->count(); ++k)
+	{
+		auto* listItem = ui->listMru->item(k);
+
+		if (listItem->data(Qt::UserRole).toString() == filePath) {
+			// The item may have had no thumbnail before, which changes its
+			// size. Other items' thumbnails are not decoded again.
+			ui->listMru->doItemsLayout();
+			ui->listMru->viewport()->update(ui->listMru->visualItemRect(listItem));
+			break;
+		}
+	}
+}
+
 void MainWindow::changeEvent(QEvent* event)
 {
 	QMainWindow::changeEvent(event);
@@ -746,8 +907,15 @@ void MainWindow::changeEvent(QEvent* event)
     }
 }
 
-void MainWindow::closeEvent(QCloseEvent*)
+void MainWindow::closeEvent(QCloseEvent* event)
 {
+	if (runningJobs_) {
+		// Files are still being written, the progress dialog must be used
+		// to cancel first
+		event->ignore();
+		return;
+	}
+
 	if (MosCurrentConfig().rememberMainWindowSize()) {
 		MosCurrentConfig().setMainWindowSize(size());
 	}
@@ -835,34 +1003,18 @@ void MainWindow::mouseMoveEvent(QMouseEvent* event)
 		if (delta.manhattanLength() < QApplication::startDragDistance())
 			return;
 
-		QImage& source = dragUseRecolored_ ? transformedImage_ : originalImage_;
-
-		static constexpr QSize maxDragPixmapSize{128, 128};
-		auto dragPixmapSize = source.size();
+		if (dragUseRecolored_)
+			previewRenderer_->flush();
 
-		if (dragPixmapSize.width() > maxDragPixmapSize.width() ||
-			dragPixmapSize.height() > maxDragPixmapSize.height())
-		{
-			dragPixmapSize.scale(maxDragPixmapSize, Qt::KeepAspectRatio);
-		}
-
-		QPixmap dragPixmap{dragPixmapSize};
-
-		dragPixmap.fill(Qt::transparent);
-
-		{
-			QPainter painter{&dragPixmap};
-			painter.setOpacity(0.80);
-			painter.drawImage(QRect{{0, 0}, dragPixmapSize}, source);
-		}
+		const QImage& source = dragUseRecolored_ ? transformedImage_ : originalImage_;
+		const auto& dragPixmap = dragPixmapFor(source);
 
 		auto* drag = new QDrag(this);
-		auto* mime = new QMimeData();
 
-		mime->setImageData(source);
-		drag->setMimeData(mime);
+		// Image data is only encoded if and when the drop target asks for it
+		drag->setMimeData(new ImageMimeData(source));
 		drag->setPixmap(dragPixmap);
-		drag->setHotSpot({dragPixmapSize.width() / 2, dragPixmapSize.height()});
+		drag->setHotSpot({dragPixmap.width() / 2, dragPixmap.height()});
 
 		ignoreDrops_ = true;
 		drag->exec(Qt::CopyAction);
@@ -938,7 +1090,10 @@ void MainWindow::dropEvent(QDropEvent* event)
 		return;
 	}
 
-	originalImage_ = newimg.convertToFormat(QImage::Format_ARGB32);
+	// A file still being loaded must not replace the dropped image later
+	cancelImageLoading();
+
+	originalImage_ = toWorkingFormat(newimg);
 
 	// Refresh UI
 	if (newpath.isEmpty() != true) {
@@ -1016,6 +1171,8 @@ void MainWindow::on_action_Reload_triggered()
 
 void MainWindow::openFile(const QString& fileName)
 {
+	MOS_TRACE_SPAN("ui", "MainWindow::openFile");
+
 	QString selectedPath;
 	QString initialDirPath = searchDirPath_;
 
@@ -1041,17 +1198,59 @@ void MainWindow::openFile(const QString& fileName)
 		);
 	}
 
-	if (selectedPath.isEmpty() && !hasImage()) {
+	if (selectedPath.isEmpty()) {
 		return;
 	}
 
-	QImage selectedImage{selectedPath};
+	startLoadingFile(selectedPath, false);
+}
 
-	if (selectedImage.isNull()) {
-		if (!selectedPath.isEmpty()) {
-			MosUi::error(
-				this, tr("Could not load %1.").arg(selectedPath));
-		}
+void MainWindow::startLoadingFile(const QString& filePath, bool reload)
+{
+	// The current image remains usable while the new one is decoded in the
+	// background, superseding any file that was still being loaded
+	delete loadProgress_;
+
+	reloadingFile_ = reload;
+
+	loadProgress_ = new QProgressDialog{
+		tr("Loading %1...").arg(QFileInfo{filePath}.fileName()),
+		tr("Cancel"), 0, 100, this};
+
+	loadProgress_->setMinimumDuration(500);
+	loadProgress_->setValue(0);
+
+	connect(imageLoader_, &ImageLoader::progressChanged, loadProgress_, &QProgressDialog::setValue);
+	connect(loadProgress_, &QProgressDialog::canceled, imageLoader_, &ImageLoader::cancel);
+	connect(loadProgress_, &QProgressDialog::canceled, loadProgress_, &QObject::deleteLater);
+
+	imageLoader_->load(filePath);
+}
+
+void MainWindow::cancelImageLoading()
+{
+	imageLoader_->cancel();
+	delete loadProgress_;
+}
+
+void MainWindow::onImageLoaded(const QString& fileName, const QImage& image)
+{
+	delete loadProgress_;
+
+	// Only images from the clipboard have no file name
+	if (fileName.isEmpty()) {
+		setClipboardImage(image);
+		return;
+	}
+
+	// The reloaded file may have been closed or replaced in the meantime
+	if (reloadingFile_ && (fileName != imagePath_ || !hasImage())) {
+		return;
+	}
+
+	if (image.isNull()) {
+		MosUi::error(
+			this, (reloadingFile_ ? tr("Could not reload %1.") : tr("Could not load %1.")).arg(fileName));
 
 		// TODO
 		//MosCurrentConfig().removeRecentFile(path_temp);
@@ -1059,17 +1258,25 @@ void MainWindow::openFile(const QString& fileName)
 		return;
 	}
 
-	imagePath_ = selectedPath;
+	if (reloadingFile_) {
+		originalImage_ = image;
+		refreshPreviews();
+		return;
+	}
+
+	imagePath_ = fileName;
 
 	// Persist the parent dir path as the search path for future file
 	// operations
-	searchDirPath_ = QFileInfo{selectedPath}.absolutePath();
+	searchDirPath_ = QFileInfo{fileName}.absolutePath();
 
-	// We want to work on actual ARGB data
-	originalImage_ = selectedImage.convertToFormat(QImage::Format_ARGB32);
+	// Already converted to the working format by the loader
+	originalImage_ = image;
 
 	// Refresh UI
-	MosCurrentConfig().addRecentFile(imagePath_, originalImage_);
+	MosCurrentConfig().addRecentFile(imagePath_, originalImage_, this, [this, filePath = imagePath_]() {
+		updateRecentFileThumbnail(filePath);
+	});
 	updateRecentFilesMenu();
 	updateWindowTitle(true, imagePath_);
 	refreshPreviews();
@@ -1079,56 +1286,88 @@ void MainWindow::openFile(const QString& fileName)
 
 void MainWindow::doReloadFile()
 {
-	QImage img{imagePath_};
-	if (img.isNull()) {
-		MosUi::error(this, tr("Could not reload %1.").arg(imagePath_));
-		return;
-	}
-
-	originalImage_ = img.convertToFormat(QImage::Format_ARGB32);
-
-	// Refresh UI
-	refreshPreviews();
+	// The result is handled by onImageLoaded()
+	startLoadingFile(imagePath_, true);
 }
 
 void MainWindow::refreshPreviews(bool skipRerender)
 {
+	MOS_TRACE_SPAN("ui", "MainWindow::refreshPreviews", originalImage_.size());
+
 	if (!hasImage() || signalsBlocked())
 		return;
 
-	if (!skipRerender) {
-		switch (rcMode_)
-		{
-			case RcPaletteSwap:
-			case RcColorRange: {
-				const auto& keyPalette = currentPalette();
-				ColorMap conversionMap;
+	if (skipRerender) {
+		// Make sure we aren't about to display a stale transform next to
+		// a newer original image
+		previewRenderer_->flush();
+		updatePreviewWidgets();
+		return;
+	}
 
-				if (rcMode_ == RcPaletteSwap) {
-					const auto& newPalette = currentPalette(true);
-					conversionMap = generateColorMap(keyPalette, newPalette);
-				} else {
-					const auto& colorRange = colorRanges_.value(ui->listRanges->currentIndex().data(Qt::UserRole).toString());
-					conversionMap = colorRange.applyToPalette(keyPalette);
-				}
+	// Everything the render function needs must be captured by value since
+	// it runs on a worker thread.
+	PreviewRenderer::RenderFunction renderFunction;
 
-				transformedImage_ = recolorImage(originalImage_, conversionMap);
+	switch (rcMode_)
+	{
+		case RcPaletteSwap:
+		case RcColorRange: {
+			const auto& keyPalette = currentPalette();
 
-				break;
+			// Only the key palette's pixels ever change, so we index them
+			// once for every image and key palette combination.
+			if (!keyColorIndex_.matches(originalImage_, keyPalette)) {
+				keyColorIndex_ = KeyColorIndex{originalImage_, keyPalette};
 			}
-			case RcColorBlend: {
-				transformedImage_ = colorBlendImage(originalImage_, blendColor_, blendFactor_);
 
-				break;
-			}
-			case RcColorShift: {
-				transformedImage_ = colorShiftImage(originalImage_, colorShiftRed_, colorShiftGreen_, colorShiftBlue_);
+			CompiledColorMap conversionMap;
 
-				break;
+			if (rcMode_ == RcPaletteSwap) {
+				const auto& newPalette = currentPalette(true);
+				conversionMap = colorMapCache_.paletteSwapMap(keyPalette, newPalette);
+			} else {
+				const auto& colorRange = colorRanges_.value(ui->listRanges->currentIndex().data(Qt::UserRole).toString());
+				conversionMap = colorMapCache_.colorRangeMap(colorRange, keyPalette);
 			}
+
+			renderFunction = [index = keyColorIndex_, conversionMap]() {
+				return index.recolor(conversionMap);
+			};
+
+			break;
+		}
+		case RcColorBlend: {
+			renderFunction = [input = originalImage_, color = blendColor_, factor = blendFactor_]() {
+				return colorBlendImage(input, color, factor);
+			};
+
+			break;
+		}
+		case RcColorShift: {
+			renderFunction = [input = originalImage_, r = colorShiftRed_, g = colorShiftGreen_, b = colorShiftBlue_]() {
+				return colorShiftImage(input, r, g, b);
+			};
+
+			break;
 		}
 	}
 
+	previewRenderer_->render(std::move(renderFunction));
+}
+
+void MainWindow::onPreviewRendered(const QImage& image)
+{
+	if (!hasImage())
+		return;
+
+	transformedImage_ = image;
+
+	updatePreviewWidgets();
+}
+
+void MainWindow::updatePreviewWidgets()
+{
 	switch (viewMode_)
 	{
 		case MosConfig::ImageViewSwipe:
@@ -1170,6 +1409,9 @@ void MainWindow::resetPreviewLayout(QAbstractScrollArea* scrollArea,
 
 void MainWindow::doSaveFile()
 {
+	if (runningJobs_)
+		return;
+
 	QString initialDirPath = saveDirPath_;
 
 	if (initialDirPath.isEmpty())
@@ -1218,7 +1460,11 @@ void MainWindow::doCloseFile()
 {
 	enableWorkArea(false);
 
+	cancelImageLoading();
+	previewRenderer_->cancel();
+
 	originalImage_ = transformedImage_ = QImage{};
+	keyColorIndex_ = KeyColorIndex{};
 
 	ui->previewOriginal->clear();
 	ui->previewComposite->clear();
@@ -1423,7 +1669,11 @@ QStringList MainWindow::doSaveCurrentTransform(const QString& dirPath, const QSt
 
 	setEnabled(false);
 
-	if (!MosIO::writePng(transformedImage_, filePath, MosCurrentConfig().pngVanityPlate())) {
+	previewRenderer_->flush();
+
+	const auto& config = MosCurrentConfig();
+
+	if (!MosIO::writePng(transformedImage_, filePath, config.pngVanityPlate(), config.pngProfile())) {
 		throw QStringList{fileName};
 	}
 
@@ -1434,7 +1684,7 @@ QStringList MainWindow::doSaveCurrentTransform(const QString& dirPath, const QSt
 
 QStringList MainWindow::doSaveColorRanges(const QString &base)
 {
-	QMap<QString, ColorMap> jobs;
+	QMap<QString, CompiledColorMap> jobs;
 
 	const auto& palId = currentPaletteName();
 	const auto& palData = currentPalette();
@@ -1454,7 +1704,7 @@ QStringList MainWindow::doSaveColorRanges(const QString &base)
 					"-" + rangeId + ".png";
 
 			const auto& colorRange = colorRanges_.value(rangeId);
-			jobs[filePath] = colorRange.applyToPalette(palData);
+			jobs[filePath] = colorMapCache_.colorRangeMap(colorRange, palData);
 
 			if (QFileInfo::exists(filePath)) {
 				needOverwriteFiles.push_back(cleanFileName(filePath));
@@ -1502,27 +1752,65 @@ QStringList MainWindow::doSaveColorShift(const QString& dirPath)
 	return doSaveCurrentTransform(dirPath, suffix);
 }
 
-QStringList MainWindow::doRunJobs(const QMap<QString, ColorMap>& jobs)
+QStringList MainWindow::doRunJobs(const QMap<QString, CompiledColorMap>& jobs)
 {
-	QStringList failed, succeeded;
+	// The nested event loop below must not start another batch
+	if (runningJobs_) {
+		throw canceled_job();
+	}
 
-	ScopedCursor sc{*this, {Qt::WaitCursor}};
+	runningJobs_ = true;
 
-	setEnabled(false);
+	const auto runningGuard = qScopeGuard([this]() {
+		runningJobs_ = false;
+	});
+
+	RecolorJobRunner runner;
+
+	runner.setVanityPlate(MosCurrentConfig().pngVanityPlate());
+	runner.setPngProfile(MosCurrentConfig().pngProfile());
 
 	for (const auto& [fileName, colorMap] : jobs.asKeyValueRange())
 	{
-		const auto& plainName = cleanFileName(fileName);
-		auto rc = recolorImage(originalImage_, colorMap);
+		runner.addJob(originalImage_, colorMap, fileName);
+	}
 
-		if (MosIO::writePng(rc, fileName, MosCurrentConfig().pngVanityPlate())) {
-			succeeded.push_back(plainName);
-		} else {
-			failed.push_back(plainName);
-		}
+	QProgressDialog progress{tr("Saving files..."), tr("Cancel"), 0, runner.jobCount(), this};
+	QEventLoop loop;
+
+	// Shown right away so that the main window does not take any input
+	// (e.g. opening or pasting another image) while files are being written
+	progress.setWindowModality(Qt::WindowModal);
+	progress.setMinimumDuration(0);
+	progress.show();
+
+	connect(&runner, &RecolorJobRunner::progressChanged, &progress, &QProgressDialog::setValue);
+	connect(&runner, &RecolorJobRunner::finished, &loop, &QEventLoop::quit);
+	connect(&progress, &QProgressDialog::canceled, &runner, &RecolorJobRunner::cancel);
+
+	runner.start();
+
+	if (runner.isRunning()) {
+		loop.exec();
 	}
 
-	setEnabled(true);
+	progress.reset();
+
+	if (runner.isCanceled()) {
+		throw canceled_job();
+	}
+
+	QStringList failed, succeeded;
+
+	for (const auto& fileName : runner.failed())
+	{
+		failed.push_back(cleanFileName(fileName));
+	}
+
+	for (const auto& fileName : runner.succeeded())
+	{
+		succeeded.push_back(cleanFileName(fileName));
+	}
 
 	if (failed.isEmpty() != true) {
 		throw failed;
@@ -1733,6 +2021,9 @@ void MainWindow::on_actionAppSettings_triggered()
 	userColorRanges_ = MosCurrentConfig().customColorRanges();
 	userPalettes_ = MosCurrentConfig().customPalettes();
 
+	// Drop color maps for definitions that may no longer exist
+	colorMapCache_.clear();
+
 	{
 		ObjectLock l{this};
 		generateMergedRcDefinitions();
@@ -1762,8 +2053,11 @@ void MainWindow::on_actionBase64_triggered()
 	if (originalImage_.isNull())
 		return;
 
-	const auto& ogBase64 = MosIO::writeBase64Png(originalImage_, true);
-	const auto& rcBase64 = MosIO::writeBase64Png(transformedImage_, true);
+	previewRenderer_->flush();
+
+	const auto pngProfile = MosCurrentConfig().pngProfile();
+	const auto& ogBase64 = MosIO::writeBase64Png(originalImage_, true, pngProfile);
+	const auto& rcBase64 = MosIO::writeBase64Png(transformedImage_, true, pngProfile);
 
 	CodeSnippetDialog dlg{this};
 
@@ -1893,6 +2187,8 @@ void MainWindow::on_actionCopy_triggered()
 {
 	auto* clipboard = QGuiApplication::clipboard();
 
+	previewRenderer_->flush();
+
 	if (!clipboard || transformedImage_.isNull())
 		return;
 
@@ -1912,12 +2208,34 @@ void MainWindow::on_actionCopyOriginal_triggered()
 void MainWindow::on_actionPaste_triggered()
 {
 	auto* clipboard = QGuiApplication::clipboard();
+	const auto* mimeData = clipboard ? clipboard->mimeData() : nullptr;
+
+	if (!mimeData)
+		return;
+
+	const auto& format = encodedClipboardImageFormat(mimeData);
 
-	if (!clipboard || clipboard->image().isNull())
+	if (format.isEmpty()) {
+		// Platform-specific formats (e.g. DIB on Windows) can only be
+		// retrieved already decoded
+		cancelImageLoading();
+		setClipboardImage(toWorkingFormat(qvariant_cast<QImage>(mimeData->imageData())));
+		return;
+	}
+
+	// The clipboard may only be accessed from the GUI thread, but decoding
+	// can happen in the background. This supersedes any file still being
+	// loaded, and vice versa.
+	delete loadProgress_;
+	imageLoader_->loadData(mimeData->data(format));
+}
+
+void MainWindow::setClipboardImage(const QImage& image)
+{
+	if (image.isNull())
 		return;
 
-	// Normalize image format from unknown source
-	originalImage_ = clipboard->image().convertToFormat(QImage::Format_ARGB32);
+	originalImage_ = image;
 
 	// Refresh UI
 	imagePath_ = tr("Clipboard image") % ".png";
@@ -1933,6 +2251,10 @@ void MainWindow::onClipboardChanged(QClipboard::Mode mode)
 		return;
 
 	auto* clipboard = QGuiApplication::clipboard();
+	const auto* mimeData = clipboard ? clipboard->mimeData() : nullptr;
 
-	ui->actionPaste->setEnabled(clipboard && !clipboard->image().isNull());
+	// Only look at the available formats, since retrieving the image itself
+	// would mean decoding it every time anything is copied anywhere
+	ui->actionPaste->setEnabled(mimeData && (mimeData->hasImage() ||
+											 !encodedClipboardImageFormat(mimeData).isEmpty()));
 }
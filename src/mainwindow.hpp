@@ -26,6 +26,7 @@
 
 #include <QClipboard>
 #include <QMainWindow>
+#include <QPointer>
 
 namespace Ui {
     class MainWindow;
@@ -36,6 +37,9 @@ class QAbstractScrollArea;
 class QButtonGroup;
 class QDragEnterEvent;
 class QDropEvent;
+class ImageLoader;
+class PreviewRenderer;
+class QProgressDialog;
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -48,7 +52,7 @@ public:
 	 */
 	void openFile(const QString& fileName = {});
 
-	QStringList doRunJobs(const QMap<QString, ColorMap>& jobs);
+	QStringList doRunJobs(const QMap<QString, CompiledColorMap>& jobs);
 
 protected:
 	virtual void changeEvent(QEvent* event) override;
@@ -120,6 +124,9 @@ private:
 	QImage originalImage_;
 	QImage transformedImage_;
 
+	KeyColorIndex keyColorIndex_;
+	ColorMapCache colorMapCache_;
+
 	ViewMode viewMode_;
 	RcMode   rcMode_;
 
@@ -140,12 +147,19 @@ private:
 	bool panStart_;
 	QPointF panStartPos_;
 
+	bool runningJobs_;
+
 	QList<QAction*> recentFileActions_;
 	QList<QAction*> zoomActions_;
 	QList<QAction*> viewModeActions_;
 
 	QButtonGroup* compositeShortcutsGroup_;
 
+	PreviewRenderer* previewRenderer_;
+	ImageLoader* imageLoader_;
+	QPointer<QProgressDialog> loadProgress_;
+	bool reloadingFile_;
+
 	QString supportedImageFileFormats_;
 
 	bool hasImage() const
@@ -168,6 +182,35 @@ private:
 
 	void updateRecentFilesMenu();
 
+	/**
+	 * Repaints the recent files list item for a file after its thumbnail
+	 * has changed.
+	 */
+	void updateRecentFileThumbnail(const QString& filePath);
+
+	/**
+	 * Starts loading an image file in the background, with a progress
+	 * dialog. The result is handled by onImageLoaded().
+	 *
+	 * @param filePath     Image file path.
+	 * @param reload       Whether this reloads the current file rather than
+	 *                     opening a new one.
+	 */
+	void startLoadingFile(const QString& filePath, bool reload);
+
+	/**
+	 * Cancels loading or decoding an image in the background, if any.
+	 */
+	void cancelImageLoading();
+
+	/**
+	 * Replaces the current image with one pasted from the clipboard.
+	 *
+	 * @param image        Image in the working format. Nothing happens if
+	 *                     this is a null image.
+	 */
+	void setClipboardImage(const QImage& image);
+
 	void updateWindowTitle(bool hasImage,
 						   const QString& filename = {},
 						   ImageOrigin origin = ImageOriginFile);
@@ -191,8 +234,17 @@ private:
 	QStringList doSaveColorBlend(const QString& dirPath);
 	QStringList doSaveColorShift(const QString& dirPath);
 
+	/**
+	 * Updates the preview widgets.
+	 *
+	 * Unless @a skipRerender is true, the transformed image is rendered
+	 * asynchronously and the preview widgets are only updated once it is
+	 * ready.
+	 */
 	void refreshPreviews(bool skipRerender = false);
 
+	void updatePreviewWidgets();
+
 	QString currentPaletteName(bool paletteSwitchMode = false) const;
 	ColorList currentPalette(bool paletteSwitchMode = false) const;
 
@@ -253,4 +305,8 @@ private slots:
 	void on_actionPaste_triggered();
 
 	void onClipboardChanged(QClipboard::Mode mode);
+
+	void onPreviewRendered(const QImage& image);
+
+	void onImageLoaded(const QString& fileName, const QImage& image);
 };
@@ -0,0 +1,128 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "previewrenderer.hpp"
+
+PreviewRenderer::PreviewRenderer(QObject* parent)
+	: QObject(parent)
+	, mutex_()
+	, pool_()
+	, pending_()
+	, result_()
+	, requested_(0)
+	, rendered_(0)
+	, delivered_(0)
+	, running_(false)
+{
+	// Requests are processed strictly one after another
+	pool_.setMaxThreadCount(1);
+}
+
+PreviewRenderer::~PreviewRenderer()
+{
+	cancel();
+	pool_.waitForDone();
+}
+
+void PreviewRenderer::render(RenderFunction renderFunction)
+{
+	QMutexLocker lock{&mutex_};
+
+	pending_ = std::move(renderFunction);
+	++requested_;
+
+	if (!running_) {
+		running_ = true;
+		pool_.start([this]() { runPending(); });
+	}
+}
+
+void PreviewRenderer::cancel()
+{
+	QMutexLocker lock{&mutex_};
+
+	pending_ = nullptr;
+	// Invalidates whatever is running right now
+	++requested_;
+}
+
+void PreviewRenderer::flush()
+{
+	pool_.waitForDone();
+
+	quint64 generation;
+
+	{
+		QMutexLocker lock{&mutex_};
+		generation = requested_;
+	}
+
+	deliver(generation);
+}
+
+void PreviewRenderer::runPending()
+{
+	QMutexLocker lock{&mutex_};
+
+	while (pending_)
+	{
+		auto renderFunction = std::move(pending_);
+		auto generation = requested_;
+
+		pending_ = nullptr;
+
+		lock.unlock();
+		auto image = renderFunction();
+		lock.relock();
+
+		if (generation == requested_) {
+			result_ = image;
+			rendered_ = generation;
+
+			// If the request is superseded in the meantime, deliver() will
+			// just drop the result.
+			QMetaObject::invokeMethod(this, [this, generation]() {
+				deliver(generation);
+			}, Qt::QueuedConnection);
+		}
+	}
+
+	running_ = false;
+}
+
+void PreviewRenderer::deliver(quint64 generation)
+{
+	QImage image;
+
+	{
+		QMutexLocker lock{&mutex_};
+
+		if (generation != requested_ ||
+			generation != rendered_ ||
+			generation == delivered_)
+			return;
+
+		delivered_ = generation;
+		image = result_;
+		result_ = QImage{};
+	}
+
+	emit ready(image);
+}
@@ -0,0 +1,97 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QThreadPool>
+
+#include <functional>
+
+/**
+ * Renders preview images on a background thread.
+ *
+ * Render requests are coalesced: while a request is being processed, any
+ * number of new requests may be submitted, but only the last one will be
+ * processed next. Results from requests that have been superseded by the
+ * time they are done are dropped, so ready() is only ever emitted with the
+ * result of the most recent request.
+ *
+ * The ready() signal is always emitted in the thread the renderer lives in.
+ */
+class PreviewRenderer : public QObject
+{
+	Q_OBJECT
+public:
+	using RenderFunction = std::function<QImage()>;
+
+	explicit PreviewRenderer(QObject* parent = nullptr);
+
+	/**
+	 * Destructor.
+	 *
+	 * Any pending request is canceled, and a running one is waited on.
+	 */
+	virtual ~PreviewRenderer() override;
+
+	/**
+	 * Submits a render request, superseding any previous ones.
+	 *
+	 * @param renderFunction Function that produces the preview image. It is
+	 *                       called from a worker thread, so it must capture
+	 *                       everything it needs by value.
+	 */
+	void render(RenderFunction renderFunction);
+
+	/**
+	 * Cancels any pending request and discards the result of a running one.
+	 */
+	void cancel();
+
+	/**
+	 * Waits for the most recent request to be processed.
+	 *
+	 * If its result has not been delivered yet, ready() is emitted before
+	 * returning.
+	 */
+	void flush();
+
+signals:
+	/**
+	 * Emitted when the result of the most recent request is available.
+	 */
+	void ready(const QImage& image);
+
+private:
+	void runPending();
+
+	void deliver(quint64 generation);
+
+	QMutex mutex_;
+	QThreadPool pool_;
+	RenderFunction pending_;
+	QImage result_;
+	quint64 requested_;
+	quint64 rendered_;
+	quint64 delivered_;
+	bool running_;
+};
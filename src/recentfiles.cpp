@@ -20,6 +20,8 @@
 
 #include "recentfiles.hpp"
 
+#include <QBuffer>
+
 #include <algorithm>
 
 namespace MosConfig {
@@ -44,39 +46,105 @@ const QSize& MruEntry::miniThumbnailSize()
 
 MruEntry::MruEntry(const QString& filePath, const QString& thumbnailData)
 	: filePath_(filePath)
+	, thumbnailData_(thumbnailData.toLatin1())
 	, thumbnail_()
+	, miniThumbnail_()
+	, thumbnailLoaded_(false)
+{
+}
+
+MruEntry::MruEntry(const QString& filePath, const QImage& image)
+	: MruEntry()
+{
+	filePath_ = filePath;
+
+	if (!image.isNull())
+		setThumbnail(makeThumbnail(image));
+}
+
+void MruEntry::setThumbnail(const QImage& thumbnail, const QByteArray& thumbnailData)
+{
+	thumbnailData_ = thumbnailData;
+	thumbnail_ = thumbnail;
+	miniThumbnail_ = thumbnail_.isNull()
+					 ? QImage{}
+					 : thumbnail_.scaled(MRU_MINI_THUMBNAIL_SIZE,
+										 Qt::KeepAspectRatio,
+										 Qt::FastTransformation);
+	thumbnailLoaded_ = true;
+}
+
+QImage MruEntry::makeThumbnail(const QImage& image)
+{
+	return image.scaled(MRU_THUMBNAIL_SIZE,
+						Qt::KeepAspectRatio,
+						Qt::SmoothTransformation);
+}
+
+QByteArray MruEntry::encodeThumbnail(const QImage& thumbnail)
 {
-	auto rawThumbnail = QByteArray::fromBase64(thumbnailData.toLatin1());
-	thumbnail_ = QImage::fromData(rawThumbnail);
+	QBuffer buffer;
 
-	if (thumbnail_.size() != MRU_THUMBNAIL_SIZE) {
-		thumbnail_ = thumbnail_.scaled(MRU_THUMBNAIL_SIZE,
-									   Qt::KeepAspectRatio,
-									   Qt::SmoothTransformation);
+	buffer.open(QIODevice::WriteOnly);
+	thumbnail.save(&buffer, "PNG");
+
+	return buffer.data().toBase64();
+}
+
+void MruEntry::loadThumbnail() const
+{
+	if (thumbnailLoaded_)
+		return;
+
+	thumbnailLoaded_ = true;
+	thumbnail_ = QImage::fromData(QByteArray::fromBase64(thumbnailData_));
+
+	// Thumbnails are normally saved at the right size already, but they may
+	// have been written by an older version using a different one
+	if (thumbnail_.width() > MRU_THUMBNAIL_SIZE.width() ||
+		thumbnail_.height() > MRU_THUMBNAIL_SIZE.height())
+	{
+		thumbnail_ = makeThumbnail(thumbnail_);
 	}
 
-	miniThumbnail_ = thumbnail_.scaled(MRU_MINI_THUMBNAIL_SIZE,
-									   Qt::KeepAspectRatio,
-									   Qt::FastTransformation);
+	if (!thumbnail_.isNull()) {
+		miniThumbnail_ = thumbnail_.scaled(MRU_MINI_THUMBNAIL_SIZE,
+										   Qt::KeepAspectRatio,
+										   Qt::FastTransformation);
+	}
 }
 
-MruEntry::MruEntry(const QString& filePath, const QImage& image)
-	: filePath_(filePath)
-	, thumbnail_()
+MruEntry* MruList::find(const QString& filePath)
 {
-	if (!image.isNull()) {
-		thumbnail_ = image.scaled(MRU_THUMBNAIL_SIZE,
-								  Qt::KeepAspectRatio,
-								  Qt::SmoothTransformation);
-		miniThumbnail_ = image.scaled(MRU_MINI_THUMBNAIL_SIZE,
-									  Qt::KeepAspectRatio,
-									  Qt::FastTransformation);
+	for (auto& entry : mru_)
+	{
+		if (entry.filePath() == filePath)
+			return &entry;
 	}
+
+	return nullptr;
+}
+
+const MruEntry* MruList::find(const QString& filePath) const
+{
+	for (const auto& entry : mru_)
+	{
+		if (entry.filePath() == filePath)
+			return &entry;
+	}
+
+	return nullptr;
 }
 
 void MruList::pushPrivate(MruEntry&& incoming)
 {
 	if (!mru_.empty()) {
+		// Keep the previous thumbnail around until a new one is set
+		if (!incoming.hasThumbnail()) {
+			if (const auto* existing = find(incoming.filePath()); existing)
+				incoming = *existing;
+		}
+
 		auto first = mru_.begin();
 		auto oldLast = mru_.end();
 
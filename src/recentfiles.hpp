@@ -24,6 +24,13 @@
 
 namespace MosConfig {
 
+/**
+ * Recent file entry.
+ *
+ * Thumbnails read from the configuration are only decoded the first time
+ * they are requested, so thumbnail() and miniThumbnail() must be called from
+ * the GUI thread.
+ */
 class MruEntry
 {
 public:
@@ -32,8 +39,10 @@ public:
 	 */
 	MruEntry()
 		: filePath_()
+		, thumbnailData_()
 		, thumbnail_()
 		, miniThumbnail_()
+		, thumbnailLoaded_(true)
 	{
 	}
 
@@ -41,7 +50,8 @@ public:
 	 * Constructs a new MRU entry.
 	 *
 	 * @param filePath         Path to the file.
-	 * @param thumbnailData    Thumbnail as base 64 data.
+	 * @param thumbnailData    Thumbnail as base 64 data. This is not decoded
+	 *                         until needed.
 	 */
 	MruEntry(const QString& filePath,
 			 const QString& thumbnailData);
@@ -71,11 +81,20 @@ public:
 		return filePath_;
 	}
 
+	/**
+	 * Returns whether this entry has a thumbnail, without decoding it.
+	 */
+	bool hasThumbnail() const
+	{
+		return thumbnailLoaded_ ? !thumbnail_.isNull() : !thumbnailData_.isEmpty();
+	}
+
 	/**
 	 * Returns the current associated thumbnail.
 	 */
 	const QImage& thumbnail() const
 	{
+		loadThumbnail();
 		return thumbnail_;
 	}
 
@@ -84,17 +103,29 @@ public:
 	 */
 	const QImage& miniThumbnail() const
 	{
+		loadThumbnail();
 		return miniThumbnail_;
 	}
 
 	/**
-	 * Replaces the previously-set thumbnail.
+	 * Returns the thumbnail as base 64 PNG data.
+	 *
+	 * This is empty if the thumbnail was not read from the configuration or
+	 * set along with its encoded form.
 	 */
-	void setThumbnail(const QImage& thumbnail)
+	const QByteArray& thumbnailData() const
 	{
-		thumbnail_ = thumbnail;
+		return thumbnailData_;
 	}
 
+	/**
+	 * Replaces the previously-set thumbnail.
+	 *
+	 * @param thumbnail        Thumbnail as generated by makeThumbnail().
+	 * @param thumbnailData    Thumbnail as base 64 data, if available.
+	 */
+	void setThumbnail(const QImage& thumbnail, const QByteArray& thumbnailData = {});
+
 	/**
 	 * Returns the standard thumbnail size.
 	 */
@@ -105,17 +136,28 @@ public:
 	 */
 	static const QSize& miniThumbnailSize();
 
+	/**
+	 * Generates a thumbnail from an image.
+	 *
+	 * This may be called from any thread.
+	 */
+	static QImage makeThumbnail(const QImage& image);
+
+	/**
+	 * Encodes a thumbnail as base 64 PNG data.
+	 *
+	 * This may be called from any thread.
+	 */
+	static QByteArray encodeThumbnail(const QImage& thumbnail);
+
 private:
-	MruEntry(const QString& filePath)
-		: filePath_(filePath)
-		, thumbnail_()
-		, miniThumbnail_()
-	{
-	}
+	void loadThumbnail() const;
 
 	QString filePath_;
-	QImage thumbnail_;
-	QImage miniThumbnail_;
+	QByteArray thumbnailData_;
+	mutable QImage thumbnail_;
+	mutable QImage miniThumbnail_;
+	mutable bool thumbnailLoaded_;
 };
 
 class MruList
@@ -145,7 +187,8 @@ public:
 
 		// Just update the thumbnail if the top entry has the same path
 		if (!empty() && mru_.back().filePath() == entry.filePath()) {
-			mru_.back().setThumbnail(entry.thumbnail());
+			if (entry.hasThumbnail())
+				mru_.back() = std::move(entry);
 			return;
 		}
 
@@ -212,6 +255,15 @@ public:
 		return size_;
 	}
 
+	/**
+	 * Finds the entry for the specified file.
+	 *
+	 * @return The entry, or nullptr if the file is not in the list.
+	 */
+	MruEntry* find(const QString& filePath);
+
+	const MruEntry* find(const QString& filePath) const;
+
 private:
 	void pushPrivate(MruEntry&& incoming);
 
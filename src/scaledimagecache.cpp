@@ -0,0 +1,172 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "scaledimagecache.hpp"
+
+#include <QPainter>
+#include <QtMath>
+
+#include <cstring>
+
+namespace {
+
+/**
+ * Returns the integer scale factor mapping @a sourceSize to @a targetSize,
+ * or 0 if there is no such factor (or it is not worth caching tiles for).
+ */
+int integerScaleFactor(const QSize& sourceSize, const QSize& targetSize)
+{
+	if (sourceSize.isEmpty()
+		|| targetSize.width() % sourceSize.width() != 0
+		|| targetSize.height() % sourceSize.height() != 0)
+		return 0;
+
+	const auto scale = targetSize.width() / sourceSize.width();
+
+	if (scale < 2 || scale > ScaledImageCache::TILE_SIZE
+		|| targetSize.height() / sourceSize.height() != scale)
+		return 0;
+
+	return scale;
+}
+
+} // end unnamed namespace
+
+ScaledImageCache::ScaledImageCache(qsizetype maxCost)
+	: image_()
+	, tiles_(maxCost)
+{
+}
+
+void ScaledImageCache::setImage(const QImage& image)
+{
+	image_ = image.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	tiles_.clear();
+}
+
+void ScaledImageCache::clear()
+{
+	setImage({});
+}
+
+void ScaledImageCache::paint(QPainter& painter,
+							 const QRect& targetRect,
+							 const QRect& exposedRect,
+							 const QRect& sourceRect)
+{
+	if (image_.isNull() || targetRect.isEmpty())
+		return;
+
+	const auto scaleX = qreal(targetRect.width()) / image_.width();
+	const auto scaleY = qreal(targetRect.height()) / image_.height();
+
+	// Map the exposed area back to the image pixels it covers
+
+	const auto& exposed = exposedRect.intersected(targetRect)
+									 .translated(-targetRect.topLeft());
+
+	if (exposed.isEmpty())
+		return;
+
+	QRect visible{
+		QPoint{int(qFloor(exposed.left() / scaleX)),
+			   int(qFloor(exposed.top() / scaleY))},
+		QPoint{int(qCeil((exposed.right() + 1) / scaleX)) - 1,
+			   int(qCeil((exposed.bottom() + 1) / scaleY)) - 1}};
+
+	visible &= sourceRect.isNull() ? image_.rect() : sourceRect & image_.rect();
+
+	if (visible.isEmpty())
+		return;
+
+	const auto scale = integerScaleFactor(image_.size(), targetRect.size());
+
+	if (!scale) {
+		const QRectF target{
+			targetRect.left() + visible.left() * scaleX,
+			targetRect.top() + visible.top() * scaleY,
+			visible.width() * scaleX,
+			visible.height() * scaleY};
+
+		painter.drawImage(target, image_, QRectF{visible});
+		return;
+	}
+
+	// Each tile covers this many image pixels in each direction
+	const auto tileSpan = TILE_SIZE / scale;
+
+	for (int row = visible.top() / tileSpan; row <= visible.bottom() / tileSpan; ++row)
+	{
+		for (int column = visible.left() / tileSpan; column <= visible.right() / tileSpan; ++column)
+		{
+			const QPoint tileOrigin{column * tileSpan, row * tileSpan};
+			const auto& part = visible & QRect{tileOrigin, QSize{tileSpan, tileSpan}};
+			const QRect target{targetRect.topLeft() + part.topLeft() * scale, part.size() * scale};
+
+			if (const auto* scaledTile = tile(scale, column, row)) {
+				painter.drawImage(target.topLeft(),
+								  *scaledTile,
+								  QRect{(part.topLeft() - tileOrigin) * scale, target.size()});
+			} else {
+				painter.drawImage(target, image_, part);
+			}
+		}
+	}
+}
+
+const QImage* ScaledImageCache::tile(int scale, int column, int row)
+{
+	const auto key = (quint64(scale) << 48) | (quint64(column) << 24) | quint64(row);
+
+	if (const auto* cached = tiles_.object(key))
+		return cached;
+
+	const auto tileSpan = TILE_SIZE / scale;
+	const auto& source = QRect{column * tileSpan, row * tileSpan, tileSpan, tileSpan}
+							 & image_.rect();
+	auto* scaledTile = new QImage{source.size() * scale, QImage::Format_ARGB32_Premultiplied};
+	const auto lineBytes = std::size_t(scaledTile->width()) * sizeof(QRgb);
+
+	for (int y = 0; y < source.height(); ++y)
+	{
+		const auto* in = reinterpret_cast<const QRgb*>(image_.constScanLine(source.top() + y))
+						 + source.left();
+		auto* out = reinterpret_cast<QRgb*>(scaledTile->scanLine(y * scale));
+
+		for (int x = 0; x < source.width(); ++x)
+		{
+			for (int k = 0; k < scale; ++k)
+				*out++ = in[x];
+		}
+
+		// The remaining lines in the row are identical to the first one
+		for (int k = 1; k < scale; ++k)
+			std::memcpy(scaledTile->scanLine(y * scale + k), scaledTile->constScanLine(y * scale), lineBytes);
+	}
+
+	const auto cost = qMax(qsizetype(1), qsizetype(scaledTile->sizeInBytes() / 1024));
+
+	// QCache deletes the tile right away if it doesn't fit, so tiles too large
+	// for the cache are simply not cached.
+	if (!tiles_.insert(key, scaledTile, cost))
+		return nullptr;
+
+	return scaledTile;
+}
@@ -0,0 +1,108 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QCache>
+#include <QImage>
+
+class QPainter;
+
+/**
+ * Paints an image scaled to a target rectangle, only processing the source
+ * pixels that are actually exposed.
+ *
+ * For integer upscaling factors (such as the 2x to 16x zoom levels used by
+ * the preview widgets), nearest-neighbor scaled tiles of the image are
+ * generated on demand and cached for each scale factor, so that repainting
+ * after scrolling or panning only needs to blit the tiles in view. Other
+ * scale factors are drawn directly from the relevant part of the image.
+ */
+class ScaledImageCache
+{
+public:
+	/**
+	 * Size of the cached tiles after scaling, in pixels.
+	 */
+	static constexpr int TILE_SIZE = 256;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param maxCost      Maximum amount of memory used by cached tiles, in
+	 *                     KiB.
+	 */
+	explicit ScaledImageCache(qsizetype maxCost = 32 * 1024);
+
+	/**
+	 * Retrieves the current image.
+	 */
+	const QImage& image() const
+	{
+		return image_;
+	}
+
+	/**
+	 * Sets the image to paint, discarding all cached tiles.
+	 *
+	 * The image is converted to ARGB32_Premultiplied if necessary.
+	 */
+	void setImage(const QImage& image);
+
+	/**
+	 * Removes the image and discards all cached tiles.
+	 */
+	void clear();
+
+	/**
+	 * Paints part of the image.
+	 *
+	 * @param painter      Painter to use. No transformation other than a
+	 *                     translation or device pixel ratio should be set.
+	 * @param targetRect   Rectangle the whole image is scaled to.
+	 * @param exposedRect  Part of the target that needs to be painted.
+	 * @param sourceRect   Part of the image that may be painted, in image
+	 *                     coordinates. A null rectangle means the whole
+	 *                     image.
+	 */
+	void paint(QPainter& painter,
+			   const QRect& targetRect,
+			   const QRect& exposedRect,
+			   const QRect& sourceRect = {});
+
+	/**
+	 * Returns the number of tiles currently cached.
+	 */
+	qsizetype tileCount() const
+	{
+		return tiles_.count();
+	}
+
+private:
+	/**
+	 * Retrieves a scaled tile, generating it if necessary.
+	 *
+	 * @return The tile, or nullptr if it does not fit in the cache.
+	 */
+	const QImage* tile(int scale, int column, int row);
+
+	QImage image_;
+	QCache<quint64, QImage> tiles_;
+};
@@ -131,6 +131,7 @@ void SettingsDialog::onDialogAccepted()
 	config.setRememberImageViewMode(ui->rememberImageViewModeCheckbox->isChecked());
 	config.setDefaultZoom(defaultZoom);
 	config.setPngVanityPlate(ui->vanityPlateCheckbox->isChecked());
+	config.setPngProfile(MosIO::PngProfile(ui->pngProfileList->currentData().toInt()));
 	config.setCustomColorRanges(ranges_);
 	config.setCustomPalettes(palettes_);
 }
@@ -311,6 +312,12 @@ void SettingsDialog::initGeneralPage()
 	}
 
 	ui->vanityPlateCheckbox->setChecked(config.pngVanityPlate());
+
+	ui->pngProfileList->addItem(tr("Fastest"), MosIO::PngProfileFast);
+	ui->pngProfileList->addItem(tr("Balanced"), MosIO::PngProfileBalanced);
+	ui->pngProfileList->addItem(tr("Smallest files"), MosIO::PngProfileSmallest);
+
+	ui->pngProfileList->setCurrentIndex(ui->pngProfileList->findData(config.pngProfile()));
 }
 
 //
@@ -1025,9 +1032,10 @@ void SettingsDialog::onPaletteFromImage()
 	if (referenceImage_.isNull())
 		return;
 
-	const auto& colors = uniqueColorsFromImage(referenceImage_);
+	// List the most common colors in the image first
+	const auto& histogram = colorHistogramFromImage(referenceImage_);
 
-	appendToCurrentPalette(ColorList{colors.begin(), colors.end()});
+	appendToCurrentPalette(histogram.mostFrequentColors());
 }
 
 void SettingsDialog::onPaletteToWml()
@@ -0,0 +1,134 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "settingsstore.hpp"
+
+#include <QSettings>
+
+#include <memory>
+
+namespace MosConfig {
+
+SettingsStore::SettingsStore(const QString& fileName, int delay, QObject* parent)
+	: QObject(parent)
+	, fileName_(fileName)
+	, mutex_()
+	, pending_()
+	, timer_()
+	, pool_()
+{
+	// A single writer thread guarantees that batches are applied in order
+	pool_.setMaxThreadCount(1);
+
+	timer_.setSingleShot(true);
+	timer_.setInterval(delay);
+
+	connect(&timer_, &QTimer::timeout, this, &SettingsStore::writePending);
+}
+
+SettingsStore::~SettingsStore()
+{
+	flush();
+}
+
+void SettingsStore::setValue(const QString& key, const QVariant& value)
+{
+	{
+		QMutexLocker lock{&mutex_};
+
+		pending_.removeIf([&](const Change& change) {
+			return change.first == key;
+		});
+
+		pending_.emplaceBack(key, value);
+	}
+
+	scheduleFlush();
+}
+
+void SettingsStore::remove(const QString& key)
+{
+	{
+		QMutexLocker lock{&mutex_};
+
+		// Earlier changes to the key or anything under it are moot now
+		const auto& prefix = key + '/';
+
+		pending_.removeIf([&](const Change& change) {
+			return change.first == key || change.first.startsWith(prefix);
+		});
+
+		pending_.emplaceBack(key, std::nullopt);
+	}
+
+	scheduleFlush();
+}
+
+qsizetype SettingsStore::pendingCount() const
+{
+	QMutexLocker lock{&mutex_};
+
+	return pending_.count();
+}
+
+void SettingsStore::flush()
+{
+	timer_.stop();
+	writePending();
+	pool_.waitForDone();
+}
+
+void SettingsStore::scheduleFlush()
+{
+	// Restarting the timer on every change means bursts of changes (such as
+	// accepting the settings dialog) are written in a single batch
+	timer_.start();
+}
+
+void SettingsStore::writePending()
+{
+	QList<Change> batch;
+
+	{
+		QMutexLocker lock{&mutex_};
+		batch.swap(pending_);
+	}
+
+	if (batch.isEmpty())
+		return;
+
+	pool_.start([fileName = fileName_, batch = std::move(batch)]() {
+		auto qs = fileName.isEmpty()
+				  ? std::make_unique<QSettings>()
+				  : std::make_unique<QSettings>(fileName, QSettings::IniFormat);
+
+		for (const auto& [key, value] : batch)
+		{
+			if (value)
+				qs->setValue(key, *value);
+			else
+				qs->remove(key);
+		}
+
+		qs->sync();
+	});
+}
+
+} // end namespace MosConfig
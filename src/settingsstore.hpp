@@ -0,0 +1,107 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVariant>
+
+#include <optional>
+
+namespace MosConfig {
+
+/**
+ * Write-behind settings store.
+ *
+ * Changes are queued in memory and written to QSettings on a background
+ * thread after a short delay, so that callers never wait for the settings
+ * backend (e.g. the Windows registry or an INI file on a slow disk). Repeated
+ * writes to the same key before the next flush are coalesced into one.
+ *
+ * Writes are applied in the order they were requested, so removing a group
+ * and then writing a key within it behaves as expected.
+ *
+ * This only handles writing. Values are normally read once at startup by
+ * the owner, which is expected to keep its own copy of the current state.
+ */
+class SettingsStore : public QObject
+{
+	Q_OBJECT
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param fileName     INI file to write to. If empty, the default
+	 *                     QSettings location for the application is used.
+	 * @param delay        Time to wait for further changes before writing,
+	 *                     in milliseconds.
+	 * @param parent       Parent object.
+	 */
+	explicit SettingsStore(const QString& fileName = {},
+						   int delay = 500,
+						   QObject* parent = nullptr);
+
+	/**
+	 * Destructor.
+	 *
+	 * Any pending changes are written before returning.
+	 */
+	virtual ~SettingsStore() override;
+
+	/**
+	 * Queues a value to be written.
+	 */
+	void setValue(const QString& key, const QVariant& value);
+
+	/**
+	 * Queues a key to be removed, along with any keys under it.
+	 */
+	void remove(const QString& key);
+
+	/**
+	 * Returns the number of changes waiting to be written.
+	 */
+	qsizetype pendingCount() const;
+
+	/**
+	 * Writes all pending changes and waits until they are done.
+	 */
+	void flush();
+
+private:
+	void scheduleFlush();
+
+	void writePending();
+
+	/** Key, and value to set (if absent, the key is to be removed). */
+	using Change = std::pair<QString, std::optional<QVariant>>;
+
+	QString fileName_;
+	mutable QMutex mutex_;
+	QList<Change> pending_;
+	QTimer timer_;
+	QThreadPool pool_;
+};
+
+} // end namespace MosConfig
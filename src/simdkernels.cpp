@@ -0,0 +1,566 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "simdkernels.hpp"
+
+//
+// SSE2 is part of the x86-64 baseline, so it's always available at compile
+// time and runtime on that architecture. AVX2 needs to be detected at runtime
+// and is compiled using per-function target attributes so that the rest of
+// the program doesn't require it. NEON is part of the AArch64 baseline.
+//
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MOS_KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#define MOS_KERNELS_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define MOS_TARGET_AVX2
+#else
+#define MOS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+#define MOS_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace MosKernels {
+
+namespace {
+
+//
+// Scalar implementations. These are the reference for everything else, and
+// are also used for the leftover pixels at the end of each scanline.
+//
+
+void colorBlendScalar(QRgb* line, qsizetype count, QRgb color, quint16 ratio)
+{
+	// Formula from Wesnoth src/sdl/utils.cpp blend_surface()
+
+	const quint16 redShift = ratio * qRed(color);
+	const quint16 greenShift = ratio * qGreen(color);
+	const quint16 blueShift = ratio * qBlue(color);
+
+	const quint16 keep = 256 - ratio;
+
+	for (qsizetype x = 0; x < count; ++x)
+	{
+		quint8 r = (keep * static_cast<quint8>(line[x] >> 16) + redShift) >> 8;
+		quint8 g = (keep * static_cast<quint8>(line[x] >> 8) + greenShift) >> 8;
+		quint8 b = (keep * static_cast<quint8>(line[x]) + blueShift) >> 8;
+
+		line[x] = (line[x] & 0xFF000000U) | (r << 16) | (g << 8) | b;
+	}
+}
+
+void colorShiftScalar(QRgb* line, qsizetype count, int redShift, int greenShift, int blueShift)
+{
+	// Formula from Wesnoth src/sdl/utils.cpp adjust_surface_color()
+
+	for (qsizetype x = 0; x < count; ++x)
+	{
+		if (line[x] & 0xFF000000U) {
+			auto r = qBound(0, qRed(line[x]) + redShift, 255);
+			auto g = qBound(0, qGreen(line[x]) + greenShift, 255);
+			auto b = qBound(0, qBlue(line[x]) + blueShift, 255);
+
+			line[x] = (line[x] & 0xFF000000U) | (r << 16) | (g << 8) | b;
+		}
+	}
+}
+
+void crossFadeScalar(QRgb* dest, const QRgb* from, const QRgb* to, qsizetype count, quint16 ratio)
+{
+	const quint32 keep = 256 - ratio;
+
+	for (qsizetype x = 0; x < count; ++x)
+	{
+		quint32 res = 0;
+
+		for (int shift = 0; shift < 32; shift += 8)
+		{
+			const quint32 a = (from[x] >> shift) & 0xFFU;
+			const quint32 b = (to[x] >> shift) & 0xFFU;
+
+			res |= ((a * keep + b * ratio + 128) >> 8) << shift;
+		}
+
+		dest[x] = res;
+	}
+}
+
+//
+// The color shift kernels use saturating byte arithmetic. Since each shift
+// value is split into a positive and a negative part (at least one of which
+// is always zero), adding one and subtracting the other with saturation is
+// equivalent to qBound(0, channel + shift, 255).
+//
+
+struct ShiftVectors
+{
+	quint32 add;
+	quint32 sub;
+};
+
+ShiftVectors makeShiftVectors(int redShift, int greenShift, int blueShift)
+{
+	auto pos = [](int v) { return quint32(qBound(0, v, 255)); };
+	auto neg = [](int v) { return quint32(qBound(0, -v, 255)); };
+
+	return {
+		(pos(redShift) << 16) | (pos(greenShift) << 8) | pos(blueShift),
+		(neg(redShift) << 16) | (neg(greenShift) << 8) | neg(blueShift),
+	};
+}
+
+//
+// The color blend kernels widen each channel to 16 bits. The products never
+// exceed 256 * 255 and the keep/shift terms always add up to at most that, so
+// there is no risk of overflow. The alpha channel is multiplied by 256 and
+// shifted back down unchanged.
+//
+
+//
+// The cross-fade kernels also widen each channel to 16 bits. Since both
+// weights add up to 256, the weighted sum plus the rounding term is at most
+// 255 * 256 + 128, which still fits.
+//
+
+#ifdef MOS_KERNELS_SSE2
+
+void colorBlendSse2(QRgb* line, qsizetype count, QRgb color, quint16 ratio)
+{
+	const short keep = short(256 - ratio);
+	const short redShift = short(ratio * qRed(color));
+	const short greenShift = short(ratio * qGreen(color));
+	const short blueShift = short(ratio * qBlue(color));
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mul = _mm_set_epi16(256, keep, keep, keep, 256, keep, keep, keep);
+	const __m128i add = _mm_set_epi16(0, redShift, greenShift, blueShift, 0, redShift, greenShift, blueShift);
+
+	qsizetype x = 0;
+
+	for (; x + 4 <= count; x += 4)
+	{
+		auto* p = reinterpret_cast<__m128i*>(line + x);
+		const __m128i px = _mm_loadu_si128(p);
+
+		__m128i lo = _mm_unpacklo_epi8(px, zero);
+		__m128i hi = _mm_unpackhi_epi8(px, zero);
+
+		lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, mul), add), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, mul), add), 8);
+
+		_mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+	}
+
+	colorBlendScalar(line + x, count - x, color, ratio);
+}
+
+void colorShiftSse2(QRgb* line, qsizetype count, int redShift, int greenShift, int blueShift)
+{
+	const auto shift = makeShiftVectors(redShift, greenShift, blueShift);
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alphaMask = _mm_set1_epi32(int(0xFF000000U));
+	const __m128i add = _mm_set1_epi32(int(shift.add));
+	const __m128i sub = _mm_set1_epi32(int(shift.sub));
+
+	qsizetype x = 0;
+
+	for (; x + 4 <= count; x += 4)
+	{
+		auto* p = reinterpret_cast<__m128i*>(line + x);
+		const __m128i px = _mm_loadu_si128(p);
+
+		const __m128i shifted = _mm_subs_epu8(_mm_adds_epu8(px, add), sub);
+		// All ones for fully transparent pixels, which must be left alone
+		const __m128i keep = _mm_cmpeq_epi32(_mm_and_si128(px, alphaMask), zero);
+
+		_mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(keep, px),
+										 _mm_andnot_si128(keep, shifted)));
+	}
+
+	colorShiftScalar(line + x, count - x, redShift, greenShift, blueShift);
+}
+
+void crossFadeSse2(QRgb* dest, const QRgb* from, const QRgb* to, qsizetype count, quint16 ratio)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i keep = _mm_set1_epi16(short(256 - ratio));
+	const __m128i mul = _mm_set1_epi16(short(ratio));
+	const __m128i round = _mm_set1_epi16(128);
+
+	qsizetype x = 0;
+
+	for (; x + 4 <= count; x += 4)
+	{
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + x));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(to + x));
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), keep),
+								   _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), mul));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), keep),
+								   _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), mul));
+
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + x), _mm_packus_epi16(lo, hi));
+	}
+
+	crossFadeScalar(dest + x, from + x, to + x, count - x, ratio);
+}
+
+#endif // MOS_KERNELS_SSE2
+
+#ifdef MOS_KERNELS_AVX2
+
+MOS_TARGET_AVX2
+void colorBlendAvx2(QRgb* line, qsizetype count, QRgb color, quint16 ratio)
+{
+	const short keep = short(256 - ratio);
+	const short redShift = short(ratio * qRed(color));
+	const short greenShift = short(ratio * qGreen(color));
+	const short blueShift = short(ratio * qBlue(color));
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i mul = _mm256_set_epi16(256, keep, keep, keep, 256, keep, keep, keep,
+										 256, keep, keep, keep, 256, keep, keep, keep);
+	const __m256i add = _mm256_set_epi16(0, redShift, greenShift, blueShift,
+										 0, redShift, greenShift, blueShift,
+										 0, redShift, greenShift, blueShift,
+										 0, redShift, greenShift, blueShift);
+
+	qsizetype x = 0;
+
+	// Unpacking and packing both work within 128-bit lanes, so the pixel
+	// order is preserved without any cross-lane shuffles.
+	for (; x + 8 <= count; x += 8)
+	{
+		auto* p = reinterpret_cast<__m256i*>(line + x);
+		const __m256i px = _mm256_loadu_si256(p);
+
+		__m256i lo = _mm256_unpacklo_epi8(px, zero);
+		__m256i hi = _mm256_unpackhi_epi8(px, zero);
+
+		lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(lo, mul), add), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(hi, mul), add), 8);
+
+		_mm256_storeu_si256(p, _mm256_packus_epi16(lo, hi));
+	}
+
+	colorBlendScalar(line + x, count - x, color, ratio);
+}
+
+MOS_TARGET_AVX2
+void colorShiftAvx2(QRgb* line, qsizetype count, int redShift, int greenShift, int blueShift)
+{
+	const auto shift = makeShiftVectors(redShift, greenShift, blueShift);
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i alphaMask = _mm256_set1_epi32(int(0xFF000000U));
+	const __m256i add = _mm256_set1_epi32(int(shift.add));
+	const __m256i sub = _mm256_set1_epi32(int(shift.sub));
+
+	qsizetype x = 0;
+
+	for (; x + 8 <= count; x += 8)
+	{
+		auto* p = reinterpret_cast<__m256i*>(line + x);
+		const __m256i px = _mm256_loadu_si256(p);
+
+		const __m256i shifted = _mm256_subs_epu8(_mm256_adds_epu8(px, add), sub);
+		const __m256i keep = _mm256_cmpeq_epi32(_mm256_and_si256(px, alphaMask), zero);
+
+		_mm256_storeu_si256(p, _mm256_blendv_epi8(shifted, px, keep));
+	}
+
+	colorShiftScalar(line + x, count - x, redShift, greenShift, blueShift);
+}
+
+MOS_TARGET_AVX2
+void crossFadeAvx2(QRgb* dest, const QRgb* from, const QRgb* to, qsizetype count, quint16 ratio)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i keep = _mm256_set1_epi16(short(256 - ratio));
+	const __m256i mul = _mm256_set1_epi16(short(ratio));
+	const __m256i round = _mm256_set1_epi16(128);
+
+	qsizetype x = 0;
+
+	for (; x + 8 <= count; x += 8)
+	{
+		const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + x));
+		const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(to + x));
+
+		__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), keep),
+									  _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), mul));
+		__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), keep),
+									  _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), mul));
+
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, round), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, round), 8);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + x), _mm256_packus_epi16(lo, hi));
+	}
+
+	crossFadeScalar(dest + x, from + x, to + x, count - x, ratio);
+}
+
+bool cpuHasAvx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// The OS must also have enabled saving the YMM registers (OSXSAVE + AVX,
+	// then XCR0 bits 1 and 2).
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+		return false;
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // MOS_KERNELS_AVX2
+
+#ifdef MOS_KERNELS_NEON
+
+void colorBlendNeon(QRgb* line, qsizetype count, QRgb color, quint16 ratio)
+{
+	const quint16 keep = 256 - ratio;
+	const quint16 redShift = ratio * qRed(color);
+	const quint16 greenShift = ratio * qGreen(color);
+	const quint16 blueShift = ratio * qBlue(color);
+
+	// Lane order matches the in-memory byte order of ARGB32: B, G, R, A
+	const quint16 mulLanes[8] = { keep, keep, keep, 256, keep, keep, keep, 256 };
+	const quint16 addLanes[8] = { blueShift, greenShift, redShift, 0,
+								  blueShift, greenShift, redShift, 0 };
+
+	const uint16x8_t mul = vld1q_u16(mulLanes);
+	const uint16x8_t add = vld1q_u16(addLanes);
+
+	qsizetype x = 0;
+
+	for (; x + 4 <= count; x += 4)
+	{
+		auto* p = reinterpret_cast<quint8*>(line + x);
+		const uint8x16_t px = vld1q_u8(p);
+
+		uint16x8_t lo = vmovl_u8(vget_low_u8(px));
+		uint16x8_t hi = vmovl_u8(vget_high_u8(px));
+
+		lo = vshrq_n_u16(vmlaq_u16(add, lo, mul), 8);
+		hi = vshrq_n_u16(vmlaq_u16(add, hi, mul), 8);
+
+		vst1q_u8(p, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+	}
+
+	colorBlendScalar(line + x, count - x, color, ratio);
+}
+
+void colorShiftNeon(QRgb* line, qsizetype count, int redShift, int greenShift, int blueShift)
+{
+	const auto shift = makeShiftVectors(redShift, greenShift, blueShift);
+
+	const uint32x4_t alphaMask = vdupq_n_u32(0xFF000000U);
+	const uint8x16_t add = vreinterpretq_u8_u32(vdupq_n_u32(shift.add));
+	const uint8x16_t sub = vreinterpretq_u8_u32(vdupq_n_u32(shift.sub));
+
+	qsizetype x = 0;
+
+	for (; x + 4 <= count; x += 4)
+	{
+		auto* p = reinterpret_cast<quint32*>(line + x);
+		const uint32x4_t px = vld1q_u32(p);
+
+		const uint8x16_t shifted = vqsubq_u8(vqaddq_u8(vreinterpretq_u8_u32(px), add), sub);
+		const uint32x4_t keep = vceqq_u32(vandq_u32(px, alphaMask), vdupq_n_u32(0));
+
+		vst1q_u32(p, vbslq_u32(keep, px, vreinterpretq_u32_u8(shifted)));
+	}
+
+	colorShiftScalar(line + x, count - x, redShift, greenShift, blueShift);
+}
+
+void crossFadeNeon(QRgb* dest, const QRgb* from, const QRgb* to, qsizetype count, quint16 ratio)
+{
+	const uint16x8_t keep = vdupq_n_u16(256 - ratio);
+	const uint16x8_t mul = vdupq_n_u16(ratio);
+	const uint16x8_t round = vdupq_n_u16(128);
+
+	qsizetype x = 0;
+
+	for (; x + 4 <= count; x += 4)
+	{
+		const uint8x16_t a = vld1q_u8(reinterpret_cast<const quint8*>(from + x));
+		const uint8x16_t b = vld1q_u8(reinterpret_cast<const quint8*>(to + x));
+
+		uint16x8_t lo = vmlaq_u16(vmulq_u16(vmovl_u8(vget_low_u8(a)), keep),
+								  vmovl_u8(vget_low_u8(b)), mul);
+		uint16x8_t hi = vmlaq_u16(vmulq_u16(vmovl_u8(vget_high_u8(a)), keep),
+								  vmovl_u8(vget_high_u8(b)), mul);
+
+		lo = vshrq_n_u16(vaddq_u16(lo, round), 8);
+		hi = vshrq_n_u16(vaddq_u16(hi, round), 8);
+
+		vst1q_u8(reinterpret_cast<quint8*>(dest + x), vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+	}
+
+	crossFadeScalar(dest + x, from + x, to + x, count - x, ratio);
+}
+
+#endif // MOS_KERNELS_NEON
+
+} // end unnamed namespace
+
+QList<InstructionSet> supportedInstructionSets()
+{
+	static const QList<InstructionSet> sets = []() {
+		QList<InstructionSet> res{InstructionSetScalar};
+#ifdef MOS_KERNELS_SSE2
+		res.push_back(InstructionSetSse2);
+#endif
+#ifdef MOS_KERNELS_AVX2
+		if (cpuHasAvx2())
+			res.push_back(InstructionSetAvx2);
+#endif
+#ifdef MOS_KERNELS_NEON
+		res.push_back(InstructionSetNeon);
+#endif
+		return res;
+	}();
+
+	return sets;
+}
+
+InstructionSet preferredInstructionSet()
+{
+	static const InstructionSet set = supportedInstructionSets().back();
+	return set;
+}
+
+void colorBlendLine(QRgb* line,
+					qsizetype count,
+					QRgb color,
+					quint16 ratio,
+					InstructionSet set)
+{
+	switch (set)
+	{
+#ifdef MOS_KERNELS_SSE2
+		case InstructionSetSse2:
+			colorBlendSse2(line, count, color, ratio);
+			break;
+#endif
+#ifdef MOS_KERNELS_AVX2
+		case InstructionSetAvx2:
+			colorBlendAvx2(line, count, color, ratio);
+			break;
+#endif
+#ifdef MOS_KERNELS_NEON
+		case InstructionSetNeon:
+			colorBlendNeon(line, count, color, ratio);
+			break;
+#endif
+		default:
+			colorBlendScalar(line, count, color, ratio);
+	}
+}
+
+void colorShiftLine(QRgb* line,
+					qsizetype count,
+					int redShift,
+					int greenShift,
+					int blueShift,
+					InstructionSet set)
+{
+	switch (set)
+	{
+#ifdef MOS_KERNELS_SSE2
+		case InstructionSetSse2:
+			colorShiftSse2(line, count, redShift, greenShift, blueShift);
+			break;
+#endif
+#ifdef MOS_KERNELS_AVX2
+		case InstructionSetAvx2:
+			colorShiftAvx2(line, count, redShift, greenShift, blueShift);
+			break;
+#endif
+#ifdef MOS_KERNELS_NEON
+		case InstructionSetNeon:
+			colorShiftNeon(line, count, redShift, greenShift, blueShift);
+			break;
+#endif
+		default:
+			colorShiftScalar(line, count, redShift, greenShift, blueShift);
+	}
+}
+
+void crossFadeLine(QRgb* dest,
+				   const QRgb* from,
+				   const QRgb* to,
+				   qsizetype count,
+				   quint16 ratio,
+				   InstructionSet set)
+{
+	switch (set)
+	{
+#ifdef MOS_KERNELS_SSE2
+		case InstructionSetSse2:
+			crossFadeSse2(dest, from, to, count, ratio);
+			break;
+#endif
+#ifdef MOS_KERNELS_AVX2
+		case InstructionSetAvx2:
+			crossFadeAvx2(dest, from, to, count, ratio);
+			break;
+#endif
+#ifdef MOS_KERNELS_NEON
+		case InstructionSetNeon:
+			crossFadeNeon(dest, from, to, count, ratio);
+			break;
+#endif
+		default:
+			crossFadeScalar(dest, from, to, count, ratio);
+	}
+}
+
+} // end namespace MosKernels
@@ -0,0 +1,123 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QColor>
+#include <QList>
+
+/**
+ * Per-scanline pixel kernels with vectorized implementations.
+ *
+ * Unless stated otherwise, kernels operate in-place on ARGB32
+ * (non-premultiplied) pixel data. All kernels produce bit-identical results
+ * regardless of the instruction set used. The
+ * best instruction set supported by the CPU is picked at runtime by default,
+ * but callers (e.g. the test suite) may explicitly request a specific one.
+ */
+namespace MosKernels {
+
+enum InstructionSet
+{
+	/** Plain C++ fallback, always available. */
+	InstructionSetScalar,
+	/** x86 SSE2 (4 pixels per iteration). */
+	InstructionSetSse2,
+	/** x86 AVX2 (8 pixels per iteration). */
+	InstructionSetAvx2,
+	/** ARM NEON/AdvSIMD (4 pixels per iteration). */
+	InstructionSetNeon,
+};
+
+/**
+ * Returns the instruction sets usable on the current CPU.
+ *
+ * The list always includes InstructionSetScalar first, and is sorted by
+ * order of preference.
+ */
+QList<InstructionSet> supportedInstructionSets();
+
+/**
+ * Returns the best instruction set usable on the current CPU.
+ */
+InstructionSet preferredInstructionSet();
+
+/**
+ * Tints a scanline with the specified color.
+ *
+ * This uses the same formula as Wesnoth's blend_surface().
+ *
+ * @param line         Pixel data.
+ * @param count        Number of pixels in @a line.
+ * @param color        Blending color. The alpha channel is ignored.
+ * @param ratio        Blending ratio, between 0 and 256 (inclusive).
+ * @param set          Instruction set to use. Must be one of the values
+ *                     returned by supportedInstructionSets().
+ */
+void colorBlendLine(QRgb* line,
+					qsizetype count,
+					QRgb color,
+					quint16 ratio,
+					InstructionSet set = preferredInstructionSet());
+
+/**
+ * Applies a color shift to a scanline.
+ *
+ * This uses the same formula as Wesnoth's adjust_surface_color(). Pixels
+ * with an alpha value of 0 are left untouched.
+ *
+ * @param line         Pixel data.
+ * @param count        Number of pixels in @a line.
+ * @param redShift     Shift value for the red channel between -255 and 255.
+ * @param greenShift   Shift value for the green channel between -255 and 255.
+ * @param blueShift    Shift value for the blue channel between -255 and 255.
+ * @param set          Instruction set to use. Must be one of the values
+ *                     returned by supportedInstructionSets().
+ */
+void colorShiftLine(QRgb* line,
+					qsizetype count,
+					int redShift,
+					int greenShift,
+					int blueShift,
+					InstructionSet set = preferredInstructionSet());
+
+/**
+ * Cross-fades between two scanlines.
+ *
+ * All four channels are interpolated linearly with rounding, so this works on
+ * both premultiplied and non-premultiplied pixel data without conversions.
+ *
+ * @param dest         Output pixel data. May be the same as @a from or
+ *                     @a to.
+ * @param from         Pixel data displayed with a ratio of 0.
+ * @param to           Pixel data displayed with a ratio of 256.
+ * @param count        Number of pixels in each scanline.
+ * @param ratio        Cross-fade ratio, between 0 and 256 (inclusive).
+ * @param set          Instruction set to use. Must be one of the values
+ *                     returned by supportedInstructionSets().
+ */
+void crossFadeLine(QRgb* dest,
+				   const QRgb* from,
+				   const QRgb* to,
+				   qsizetype count,
+				   quint16 ratio,
+				   InstructionSet set = preferredInstructionSet());
+
+} // end namespace MosKernels
@@ -23,10 +23,34 @@
 #include "tests.hpp"
 
 #include "defs.hpp"
+#include "imageloader.hpp"
+#include "imagemimedata.hpp"
+#include "imagestream.hpp"
+#include "jobrunner.hpp"
+#include "previewrenderer.hpp"
 #include "recentfiles.hpp"
+#include "scaledimagecache.hpp"
+#include "settingsstore.hpp"
+#include "simdkernels.hpp"
+#include "tracing.hpp"
+#include "version.hpp"
 #include "wesnothrc.hpp"
 
+#include <QBuffer>
 #include <QColorSpace>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QRandomGenerator>
+#include <QSet>
+#include <QSettings>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+
+#include <numeric>
+#include <thread>
 
 QTEST_MAIN(TestMorningStar)
 ;
@@ -87,6 +111,66 @@ constexpr std::array<unsigned, SWATCH_SIZE> magentaSwatch{
 
 static_assert(magentaSwatch.size() == tcSwatches[0].size());
 
+/**
+ * Single precision floating point implementation of the Wesnoth color range
+ * transform, which ColorRange::applyToColor() must match bit for bit.
+ */
+QRgb floatColorRangeTransform(const ColorRange& colorRange,
+							  QRgb referenceColor,
+							  QRgb color)
+{
+	const auto referenceAvg = (qRed(referenceColor) + qGreen(referenceColor) + qBlue(referenceColor)) / 3;
+	const auto oldAvg = (qRed(color) + qGreen(color) + qBlue(color)) / 3;
+
+	const bool lower = referenceAvg && oldAvg <= referenceAvg;
+	const auto bound = lower ? colorRange.min() : colorRange.max();
+	const float ratio = lower
+						? float(oldAvg) / float(referenceAvg)
+						: (255.0f - float(oldAvg)) / (255.0f - float(referenceAvg));
+
+	return qRgb(int(ratio * qRed(colorRange.mid()) + (1 - ratio) * qRed(bound)),
+				int(ratio * qGreen(colorRange.mid()) + (1 - ratio) * qGreen(bound)),
+				int(ratio * qBlue(colorRange.mid()) + (1 - ratio) * qBlue(bound)));
+}
+
+/**
+ * Converts an image with at most 256 colors to Indexed8 format exactly.
+ *
+ * QImage::convertToFormat() may quantize colors in some cases (e.g. images
+ * with an alpha channel), which is not acceptable for comparing results.
+ */
+QImage toIndexed8(const QImage& image)
+{
+	const auto source = image.convertToFormat(QImage::Format_ARGB32);
+
+	QImage ret{source.size(), QImage::Format_Indexed8};
+	QList<QRgb> colorTable;
+	QHash<QRgb, uchar> indices;
+
+	for (int y = 0; y < source.height(); ++y)
+	{
+		const auto* line = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+		auto* indexedLine = ret.scanLine(y);
+
+		for (int x = 0; x < source.width(); ++x)
+		{
+			if (!indices.contains(line[x])) {
+				indices.insert(line[x], uchar(colorTable.count()));
+				colorTable.push_back(line[x]);
+			}
+
+			indexedLine[x] = indices.value(line[x]);
+		}
+	}
+
+	Q_ASSERT(colorTable.count() <= 256);
+
+	ret.setColorTable(colorTable);
+	ret.setColorSpace(source.colorSpace());
+
+	return ret;
+}
+
 } // end unnamed namespace
 
 void TestMorningStar::testBuiltinObjects()
@@ -141,6 +225,78 @@ void TestMorningStar::testRecolorAlgorithm()
 	}
 }
 
+void TestMorningStar::testColorRangeFixedPoint()
+{
+	QList<ColorRange> colorRanges;
+
+	for (const auto* colorRange : wesnoth::builtinColorRanges.orderedObjects())
+	{
+		colorRanges.push_back(*colorRange);
+	}
+
+	// Extremes plus some arbitrary ranges for good measure
+	colorRanges.push_back({ 0xFFFFFF, 0xFFFFFF, 0xFFFFFF });
+	colorRanges.push_back({ 0x000000, 0x000000, 0x000000 });
+	colorRanges.push_back({ 0x000000, 0xFFFFFF, 0xFFFFFF });
+	colorRanges.push_back({ 0xFFFFFF, 0x000000, 0x000000 });
+
+	QRandomGenerator rng{0x5EED};
+
+	for (int k = 0; k < 16; ++k)
+	{
+		colorRanges.push_back({ rng.generate() & 0xFFFFFF,
+								rng.generate() & 0xFFFFFF,
+								rng.generate() & 0xFFFFFF });
+	}
+
+	// Only the average of each color matters, so grays cover every case
+	for (int referenceAvg = 0; referenceAvg < 256; ++referenceAvg)
+	{
+		const auto referenceColor = qRgb(referenceAvg, referenceAvg, referenceAvg);
+
+		for (int oldAvg = 0; oldAvg < 256; ++oldAvg)
+		{
+			const auto color = qRgb(oldAvg, oldAvg, oldAvg);
+
+			for (const auto& colorRange : std::as_const(colorRanges))
+			{
+				QCOMPARE(colorRange.applyToColor(referenceColor, color),
+						 floatColorRangeTransform(colorRange, referenceColor, color));
+			}
+		}
+	}
+}
+
+void TestMorningStar::testPrecomputedColorMaps()
+{
+	using namespace wesnoth;
+
+	const auto& colorRangeHandles = builtinColorRanges.orderedObjects();
+	const auto& paletteHandles = builtinPalettes.orderedObjects();
+
+	for (const auto* palette : paletteHandles)
+	{
+		for (const auto* colorRange : colorRangeHandles)
+		{
+			ColorMap colorMap;
+
+			QVERIFY(precomputedColorMap(*colorRange, *palette, colorMap));
+			QCOMPARE(colorMap, colorRange->applyToPalette(*palette));
+		}
+	}
+
+	ColorMap colorMap;
+
+	// Anything other than built-ins must be calculated at runtime
+	QVERIFY(!precomputedColorMap({ 0x123456 }, builtinPalettes["magenta"], colorMap));
+
+	auto palModified = builtinPalettes["magenta"];
+	palModified.back() = 0x123456;
+
+	QVERIFY(!precomputedColorMap(builtinColorRanges["red"], palModified, colorMap));
+	QVERIFY(!precomputedColorMap(builtinColorRanges["red"], palModified.mid(1), colorMap));
+}
+
 void TestMorningStar::testWesnothRcImage()
 {
 	using namespace wesnoth;
@@ -238,6 +394,173 @@ void TestMorningStar::testPaletteSwapImage()
 	QCOMPARE_NE(idempotentRcOutput, imgMagentaSwatch);
 }
 
+void TestMorningStar::testCompiledColorMap()
+{
+	using namespace wesnoth;
+
+	const auto& palMagenta = builtinPalettes["magenta"];
+	const auto& colorMap = builtinColorRanges["teal"].applyToPalette(palMagenta);
+
+	CompiledColorMap compiledMap{colorMap};
+
+	QCOMPARE(compiledMap.count(), colorMap.count());
+
+	for (const auto& [key, value] : colorMap.asKeyValueRange())
+	{
+		QRgb result = 0;
+
+		// Alpha must be ignored on lookup and stripped from the result
+		QVERIFY(compiledMap.find(key, result));
+		QCOMPARE(result, value & 0xFFFFFFU);
+		QVERIFY(compiledMap.find((key & 0xFFFFFFU) | 0x7F000000U, result));
+		QCOMPARE(result, value & 0xFFFFFFU);
+	}
+
+	QRgb unused = 0xDEADBEEFU;
+
+	QVERIFY(!compiledMap.find(0xFF123456U, unused));
+	QCOMPARE(unused, 0xDEADBEEFU);
+
+	CompiledColorMap emptyMap;
+
+	QVERIFY(emptyMap.isEmpty());
+	QVERIFY(!emptyMap.find(palMagenta.front(), unused));
+
+	// Recoloring through a compiled map must match the plain ColorMap path
+	// (which also doubles as a check that a compiled map can be reused).
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch{pathMagentaSwatch, "PNG"};
+
+	auto pathAlphaMagentaSwatch = QFINDTESTDATA("../tests/alpha-magenta.png");
+	QImage imgAlphaMagentaSwatch{pathAlphaMagentaSwatch, "PNG"};
+
+	QCOMPARE(recolorImage(imgMagentaSwatch, compiledMap),
+			 recolorImage(imgMagentaSwatch, colorMap));
+	QCOMPARE(recolorImage(imgAlphaMagentaSwatch, compiledMap),
+			 recolorImage(imgAlphaMagentaSwatch, colorMap));
+	QCOMPARE(recolorImage(imgMagentaSwatch, emptyMap),
+			 imgMagentaSwatch.convertToFormat(QImage::Format_ARGB32));
+}
+
+void TestMorningStar::testRecolorImages()
+{
+	using namespace wesnoth;
+
+	const auto& palMagenta = builtinPalettes["magenta"];
+
+	QList<CompiledColorMap> colorMaps;
+
+	for (const auto* colorRange : builtinColorRanges.orderedObjects())
+	{
+		colorMaps.emplaceBack(colorRange->applyToPalette(palMagenta));
+	}
+
+	// Maps with different key sets must only affect their own outputs
+	colorMaps.emplaceBack(generateColorMap(palMagenta.mid(0, 5), builtinPalettes["flag_green"]));
+	colorMaps.emplaceBack();
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch{pathMagentaSwatch, "PNG"};
+
+	auto pathAlphaMagentaSwatch = QFINDTESTDATA("../tests/alpha-magenta.png");
+	QImage imgAlphaMagentaSwatch{pathAlphaMagentaSwatch, "PNG"};
+
+	for (const auto& input : {imgMagentaSwatch, imgAlphaMagentaSwatch})
+	{
+		const auto& outputs = recolorImages(input, colorMaps);
+
+		QCOMPARE(outputs.count(), colorMaps.count());
+
+		for (qsizetype k = 0; k < colorMaps.count(); ++k)
+		{
+			QCOMPARE(outputs[k], recolorImage(input, colorMaps[k]));
+		}
+	}
+
+	QVERIFY(recolorImages(imgMagentaSwatch, {}).isEmpty());
+}
+
+void TestMorningStar::testKeyColorIndex()
+{
+	using namespace wesnoth;
+
+	const auto& palMagenta = builtinPalettes["magenta"];
+	const auto& palFlagGreen = builtinPalettes["flag_green"];
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch{pathMagentaSwatch, "PNG"};
+
+	auto pathAlphaMagentaSwatch = QFINDTESTDATA("../tests/alpha-magenta.png");
+	QImage imgAlphaMagentaSwatch{pathAlphaMagentaSwatch, "PNG"};
+
+	for (const auto& input : {imgMagentaSwatch, imgAlphaMagentaSwatch})
+	{
+		KeyColorIndex index{input, palMagenta};
+
+		QVERIFY(index.pixelCount() > 0);
+		QVERIFY(index.pixelCount() < qsizetype(input.width()) * input.height());
+		QVERIFY(index.matches(index.image(), palMagenta));
+		QVERIFY(!index.matches(index.image(), palFlagGreen));
+
+		for (const auto* colorRange : builtinColorRanges.orderedObjects())
+		{
+			CompiledColorMap colorMap{colorRange->applyToPalette(palMagenta)};
+			QCOMPARE(index.recolor(colorMap), recolorImage(input, colorMap));
+		}
+
+		CompiledColorMap swapMap{generateColorMap(palMagenta, palFlagGreen)};
+		QCOMPARE(index.recolor(swapMap), recolorImage(input, swapMap));
+
+		// Colors outside the key palette are never touched
+		CompiledColorMap unrelatedMap{generateColorMap(palFlagGreen, palMagenta)};
+		QCOMPARE(index.recolor(unrelatedMap), index.image());
+	}
+
+	KeyColorIndex emptyIndex;
+
+	QCOMPARE(emptyIndex.pixelCount(), qsizetype(0));
+	QVERIFY(!emptyIndex.matches(QImage{}, {}));
+}
+
+void TestMorningStar::testColorMapCache()
+{
+	using namespace wesnoth;
+
+	const auto& palMagenta = builtinPalettes["magenta"];
+	const auto& palFlagGreen = builtinPalettes["flag_green"];
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch{pathMagentaSwatch, "PNG"};
+
+	ColorMapCache cache;
+
+	// Repeat lookups to exercise both cache misses and hits
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (const auto* colorRange : builtinColorRanges.orderedObjects())
+		{
+			const auto& colorMap = cache.colorRangeMap(*colorRange, palMagenta);
+			QCOMPARE(recolorImage(imgMagentaSwatch, colorMap),
+					 recolorImage(imgMagentaSwatch, colorRange->applyToPalette(palMagenta)));
+		}
+
+		const auto& swapMap = cache.paletteSwapMap(palMagenta, palFlagGreen);
+		QCOMPARE(recolorImage(imgMagentaSwatch, swapMap),
+				 recolorImage(imgMagentaSwatch, generateColorMap(palMagenta, palFlagGreen)));
+	}
+
+	// Different palettes must never share entries
+	const auto& colorRangeRed = builtinColorRanges["red"];
+	QCOMPARE_NE(recolorImage(imgMagentaSwatch, cache.colorRangeMap(colorRangeRed, palMagenta)),
+				recolorImage(imgMagentaSwatch, cache.colorRangeMap(colorRangeRed, palFlagGreen)));
+
+	cache.clear();
+
+	QCOMPARE(recolorImage(imgMagentaSwatch, cache.colorRangeMap(colorRangeRed, palMagenta)),
+			 recolorImage(imgMagentaSwatch, colorRangeRed.applyToPalette(palMagenta)));
+}
+
 void TestMorningStar::testColorShiftImage()
 {
 	auto pathTestInput = QFINDTESTDATA("../tests/shift-test-input.png");
@@ -316,6 +639,289 @@ void TestMorningStar::testColorBlendImage()
 	QCOMPARE(imgTestOutput, imgTestReference);
 }
 
+void TestMorningStar::testImagePathFunctionChain()
+{
+	using namespace wesnoth;
+
+	const auto& colorRanges = builtinColorRanges.objects();
+	const auto& palettes = builtinPalettes.objects();
+	const auto& palMagenta = builtinPalettes["magenta"];
+	const auto& palFlagGreen = builtinPalettes["flag_green"];
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch{pathMagentaSwatch, "PNG"};
+	imgMagentaSwatch.convertTo(QImage::Format_ARGB32);
+
+	const auto parsed = [&](const QString& functions) {
+		ImagePathFunctionChain chain;
+		QString error;
+		if (!chain.parse(functions, colorRanges, palettes, &error))
+			qWarning() << functions << error;
+		return chain;
+	};
+
+	const CompiledColorMap rangeMap{builtinColorRanges["red"].applyToPalette(palMagenta)};
+
+	// Fused results must match running each function separately
+	const auto& chain = parsed("~RC(magenta>red)~CS(10,0,-5)~BLEND(255,0,0,0.3)");
+
+	QCOMPARE(chain.stepCount(), qsizetype(3));
+	QCOMPARE(chain.apply(imgMagentaSwatch),
+			 colorBlendImage(colorShiftImage(recolorImage(imgMagentaSwatch, rangeMap), 10, 0, -5),
+							 QColor{255, 0, 0}, 0.3));
+
+	// Consecutive color maps are merged
+	const auto& mapChain = parsed("~PAL(magenta>flag_green)~RC(flag_green>blue)~RC(magenta>red)");
+
+	QCOMPARE(mapChain.stepCount(), qsizetype(1));
+	QCOMPARE(mapChain.apply(imgMagentaSwatch),
+			 recolorImage(recolorImage(recolorImage(imgMagentaSwatch, generateColorMap(palMagenta, palFlagGreen)),
+									   builtinColorRanges["blue"].applyToPalette(palFlagGreen)),
+						  rangeMap));
+
+	// Color maps run before other functions wherever they appear, like in
+	// Wesnoth, and are merged with each other
+	const auto& lateMapChain = parsed("~CS(10,0,-5)~RC(magenta>red)~BLEND(255,0,0,0.3)~PAL(magenta>flag_green)");
+
+	QCOMPARE(lateMapChain.stepCount(), qsizetype(3));
+	QCOMPARE(lateMapChain.apply(imgMagentaSwatch),
+			 colorBlendImage(colorShiftImage(recolorImage(recolorImage(imgMagentaSwatch, rangeMap),
+														  generateColorMap(palMagenta, palFlagGreen)),
+											 10, 0, -5),
+							 QColor{255, 0, 0}, 0.3));
+
+	// Functions with no effect are dropped
+	QVERIFY(parsed("").isEmpty());
+	QVERIFY(parsed("~CS(0,0,0)~R(0)~BLEND(255,0,0,0)").isEmpty());
+	QCOMPARE(parsed("").apply(imgMagentaSwatch), imgMagentaSwatch);
+
+	// Alternative argument forms
+	QCOMPARE(parsed("~RC(magenta>1)").apply(imgMagentaSwatch), recolorImage(imgMagentaSwatch, rangeMap));
+	QCOMPARE(parsed("~BLEND(255,0,0,30%)").apply(imgMagentaSwatch),
+			 colorBlendImage(imgMagentaSwatch, QColor{255, 0, 0}, 0.3));
+	QCOMPARE(parsed("~G(-40)").apply(imgMagentaSwatch), colorShiftImage(imgMagentaSwatch, 0, -40, 0));
+	QCOMPARE(parsed("~CS(300)").apply(imgMagentaSwatch), colorShiftImage(imgMagentaSwatch, 255, 0, 0));
+
+	const ColorRange customRange{0x3F00FF, 0xFFFFFF, 0x000033, 0x3F00FF};
+
+	QCOMPARE(parsed("~RC(magenta>3F00FF,FFFFFF,000033)").apply(imgMagentaSwatch),
+			 recolorImage(imgMagentaSwatch, customRange.applyToPalette(palMagenta)));
+
+	// Indexed8 images only have their color table transformed
+	const auto& imgIndexed = toIndexed8(imgMagentaSwatch);
+	const auto& indexedOutput = chain.apply(imgIndexed);
+
+	QCOMPARE(indexedOutput.format(), QImage::Format_Indexed8);
+	QCOMPARE(indexedOutput.convertToFormat(QImage::Format_ARGB32), chain.apply(imgMagentaSwatch));
+
+	// Large enough to be processed in parallel, with rows spanning several
+	// blocks
+	QImage imgLarge{3000, 700, QImage::Format_ARGB32};
+
+	for (int y = 0; y < imgLarge.height(); ++y)
+	{
+		for (int x = 0; x < imgLarge.width(); ++x)
+		{
+			imgLarge.setPixel(x, y, imgMagentaSwatch.pixel(x % imgMagentaSwatch.width(),
+														   y % imgMagentaSwatch.height()));
+		}
+	}
+
+	QCOMPARE(chain.apply(imgLarge),
+			 colorBlendImage(colorShiftImage(recolorImage(imgLarge, rangeMap), 10, 0, -5),
+							 QColor{255, 0, 0}, 0.3));
+
+	// Errors leave the chain untouched
+	const QStringList invalidChains{
+		"RC(magenta>red)",
+		"~RC(magenta>red",
+		"~RC(magenta)",
+		"~RC(nonexistent>red)",
+		"~RC(magenta>nonexistent)",
+		"~RC(magenta>99)",
+		"~PAL(magenta>nonexistent)",
+		"~BLEND(255,0,0)",
+		"~BLEND(255,0,0,x)",
+		"~CS(1,2,3,4)",
+		"~CS(a)",
+		"~FL()",
+	};
+
+	for (const auto& functions : invalidChains)
+	{
+		auto invalidChain = chain;
+		QString error;
+
+		QVERIFY2(!invalidChain.parse(functions, colorRanges, palettes, &error), qPrintable(functions));
+		QVERIFY(!error.isEmpty());
+		QCOMPARE(invalidChain.stepCount(), chain.stepCount());
+	}
+}
+
+void TestMorningStar::testIndexedImages()
+{
+	using namespace wesnoth;
+
+	// Indexed8 images are transformed through their color table, and must
+	// produce exactly the same results as transforming every pixel of their
+	// ARGB32 counterparts.
+
+	const auto& palMagenta = builtinPalettes["magenta"];
+	const auto& palFlagGreen = builtinPalettes["flag_green"];
+	const auto& colorRangeRed = builtinColorRanges["red"];
+
+	auto pathTestInput = QFINDTESTDATA("../tests/blend-test-input.png");
+	QImage imgTestInput{pathTestInput, "PNG"};
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch = toIndexed8(QImage{pathMagentaSwatch, "PNG"});
+
+	QCOMPARE(imgTestInput.format(), QImage::Format_Indexed8);
+	QCOMPARE(imgMagentaSwatch.format(), QImage::Format_Indexed8);
+
+	const auto expanded = [](const QImage& image) {
+		return image.convertToFormat(QImage::Format_ARGB32);
+	};
+
+	// Indexed8 images are only shared, everything else is converted
+	QCOMPARE(toWorkingFormat(imgTestInput).cacheKey(), imgTestInput.cacheKey());
+	QCOMPARE(toWorkingFormat(imgTestInput.convertToFormat(QImage::Format_RGB32)).format(),
+			 QImage::Format_ARGB32);
+
+	QImage imgBlendOutput = colorBlendImage(imgTestInput, QColor{127, 89, 32}, 0.54);
+
+	QCOMPARE(imgBlendOutput.format(), QImage::Format_Indexed8);
+	QCOMPARE(expanded(imgBlendOutput),
+			 colorBlendImage(expanded(imgTestInput), QColor{127, 89, 32}, 0.54));
+
+	QImage imgShiftOutput = colorShiftImage(imgTestInput, -228, 90, 164);
+
+	QCOMPARE(imgShiftOutput.format(), QImage::Format_Indexed8);
+	QCOMPARE(expanded(imgShiftOutput),
+			 colorShiftImage(expanded(imgTestInput), -228, 90, 164));
+
+	const CompiledColorMap rangeMap{colorRangeRed.applyToPalette(palMagenta)};
+	const CompiledColorMap swapMap{generateColorMap(palMagenta, palFlagGreen)};
+
+	QImage imgRecolorOutput = recolorImage(imgMagentaSwatch, rangeMap);
+
+	QCOMPARE(imgRecolorOutput.format(), QImage::Format_Indexed8);
+	QVERIFY(imgRecolorOutput.colorTable() != imgMagentaSwatch.colorTable());
+	QCOMPARE(expanded(imgRecolorOutput), recolorImage(expanded(imgMagentaSwatch), rangeMap));
+
+	const auto outputs = recolorImages(imgMagentaSwatch, {rangeMap, swapMap});
+
+	QCOMPARE(outputs.count(), qsizetype(2));
+	QCOMPARE(outputs[0], imgRecolorOutput);
+	QCOMPARE(outputs[1].format(), QImage::Format_Indexed8);
+	QCOMPARE(expanded(outputs[1]), recolorImage(expanded(imgMagentaSwatch), swapMap));
+
+	KeyColorIndex index{imgMagentaSwatch, palMagenta};
+	KeyColorIndex expandedIndex{expanded(imgMagentaSwatch), palMagenta};
+
+	QCOMPARE(index.image().format(), QImage::Format_Indexed8);
+	QCOMPARE(index.pixelCount(), expandedIndex.pixelCount());
+	QVERIFY(index.matches(imgMagentaSwatch, palMagenta));
+	QCOMPARE(index.recolor(rangeMap), imgRecolorOutput);
+	QCOMPARE(expanded(index.recolor(swapMap)), expandedIndex.recolor(swapMap));
+}
+
+void TestMorningStar::testSimdKernels()
+{
+	using namespace MosKernels;
+
+	// Every vectorized kernel must be bit-exact with the scalar version,
+	// including the leftover pixels at the end of each scanline (hence the
+	// odd-sized input).
+
+	auto pathTestInput = QFINDTESTDATA("../tests/blend-test-input.png");
+	QImage imgTestInput{pathTestInput, "PNG"};
+
+	imgTestInput = imgTestInput.convertToFormat(QImage::Format_ARGB32)
+							   .copy(0, 0, imgTestInput.width() - 3, imgTestInput.height());
+
+	QCOMPARE(supportedInstructionSets().front(), InstructionSetScalar);
+
+	const quint16 ratios[] = { 0, 1, 127, 138, 255, 256 };
+	const int shifts[][3] = { { -228, 90, 164 }, { 255, -255, 0 }, { 17, 17, 17 } };
+
+	for (auto ratio : ratios)
+	{
+		QImage reference = imgTestInput.copy();
+
+		for (int y = 0; y < reference.height(); ++y)
+			colorBlendLine(reinterpret_cast<QRgb*>(reference.scanLine(y)), reference.width(),
+						   qRgb(127, 89, 32), ratio, InstructionSetScalar);
+
+		for (auto set : supportedInstructionSets())
+		{
+			QImage output = imgTestInput.copy();
+
+			for (int y = 0; y < output.height(); ++y)
+				colorBlendLine(reinterpret_cast<QRgb*>(output.scanLine(y)), output.width(),
+							   qRgb(127, 89, 32), ratio, set);
+
+			QCOMPARE(output, reference);
+		}
+	}
+
+	for (const auto& shift : shifts)
+	{
+		QImage reference = imgTestInput.copy();
+
+		for (int y = 0; y < reference.height(); ++y)
+			colorShiftLine(reinterpret_cast<QRgb*>(reference.scanLine(y)), reference.width(),
+						   shift[0], shift[1], shift[2], InstructionSetScalar);
+
+		for (auto set : supportedInstructionSets())
+		{
+			QImage output = imgTestInput.copy();
+
+			for (int y = 0; y < output.height(); ++y)
+				colorShiftLine(reinterpret_cast<QRgb*>(output.scanLine(y)), output.width(),
+							   shift[0], shift[1], shift[2], set);
+
+			QCOMPARE(output, reference);
+		}
+	}
+
+	// Cross-fading works on premultiplied data, and must return either input
+	// exactly at both ends of the range.
+
+	const auto& fadeFrom = imgTestInput.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	const auto& fadeTo = colorShiftImage(imgTestInput, 64, -32, 96)
+							 .convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+	for (auto ratio : ratios)
+	{
+		QImage reference{fadeFrom.size(), fadeFrom.format()};
+
+		for (int y = 0; y < reference.height(); ++y)
+			crossFadeLine(reinterpret_cast<QRgb*>(reference.scanLine(y)),
+						  reinterpret_cast<const QRgb*>(fadeFrom.constScanLine(y)),
+						  reinterpret_cast<const QRgb*>(fadeTo.constScanLine(y)),
+						  reference.width(), ratio, InstructionSetScalar);
+
+		if (ratio == 0)
+			QCOMPARE(reference, fadeFrom);
+		else if (ratio == 256)
+			QCOMPARE(reference, fadeTo);
+
+		for (auto set : supportedInstructionSets())
+		{
+			QImage output{fadeFrom.size(), fadeFrom.format()};
+
+			for (int y = 0; y < output.height(); ++y)
+				crossFadeLine(reinterpret_cast<QRgb*>(output.scanLine(y)),
+							  reinterpret_cast<const QRgb*>(fadeFrom.constScanLine(y)),
+							  reinterpret_cast<const QRgb*>(fadeTo.constScanLine(y)),
+							  output.width(), ratio, set);
+
+			QCOMPARE(output, reference);
+		}
+	}
+}
+
 void TestMorningStar::testMru()
 {
 	using namespace MosConfig;
@@ -387,6 +993,29 @@ void TestMorningStar::testMru()
 
 	QCOMPARE_NE(subject.begin(), subject.begin() + 1);
 	QCOMPARE((subject.begin() + 1)->filePath(), QFINDTESTDATA(newMru[1]));
+
+	// Thumbnails survive being moved to the top without a new image
+	const QImage thumbnail = subject.find(mruBack2)->thumbnail();
+
+	QVERIFY(!thumbnail.isNull());
+	QVERIFY(thumbnail.width() <= MruEntry::thumbnailSize().width());
+	QVERIFY(thumbnail.height() <= MruEntry::thumbnailSize().height());
+
+	subject.push(mruBack2, QImage{});
+
+	QCOMPARE(subject.front().filePath(), mruBack2);
+	QCOMPARE(subject.front().thumbnail(), thumbnail);
+	QVERIFY(!subject.find(QFINDTESTDATA("../tests/magenta-palette-RC-magenta-4-purple.png")));
+
+	// Encoded thumbnails are only decoded on demand
+	const auto& thumbnailData = MruEntry::encodeThumbnail(thumbnail);
+	MruEntry stored{mruFront, QString::fromLatin1(thumbnailData)};
+
+	QVERIFY(stored.hasThumbnail());
+	QCOMPARE(stored.thumbnailData(), thumbnailData);
+	QCOMPARE(stored.thumbnail().size(), thumbnail.size());
+	QVERIFY(!stored.miniThumbnail().isNull());
+	QVERIFY(!MruEntry{mruFront, QString{}}.hasThumbnail());
 }
 
 void TestMorningStar::testUniqueColorsFromImage()
@@ -407,6 +1036,95 @@ void TestMorningStar::testUniqueColorsFromImage()
 	const auto& result = uniqueColorsFromImage(imgMagentaSwatch);
 
 	QCOMPARE(result, reference);
+
+	// Indexed8 images take a different path
+	const auto& indexedResult = uniqueColorsFromImage(toIndexed8(imgMagentaSwatch));
+
+	QCOMPARE(indexedResult, reference);
+}
+
+void TestMorningStar::testColorHistogramFromImage()
+{
+	// Large enough to be scanned by multiple threads, with runs of the same
+	// color mixed with lots of different colors
+	QImage imgNoise{1021, 1031, QImage::Format_ARGB32};
+	QRandomGenerator random{1337};
+
+	for (int y = 0; y < imgNoise.height(); ++y)
+	{
+		auto* line = reinterpret_cast<QRgb*>(imgNoise.scanLine(y));
+		for (int x = 0; x < imgNoise.width(); ++x)
+		{
+			line[x] = (x / 16) % 2 == 0 ? random.generate() : qRgba(255, 0, 255, x % 256);
+		}
+	}
+
+	QMap<QRgb, qsizetype> reference;
+
+	for (int y = 0; y < imgNoise.height(); ++y)
+	{
+		const auto* line = reinterpret_cast<const QRgb*>(imgNoise.constScanLine(y));
+		for (int x = 0; x < imgNoise.width(); ++x)
+		{
+			++reference[line[x] & 0xFFFFFFU];
+		}
+	}
+
+	const auto& histogram = colorHistogramFromImage(imgNoise);
+
+	QCOMPARE(histogram.colors, reference.keys());
+	QCOMPARE(histogram.counts, reference.values());
+
+	const auto& uniqueColors = uniqueColorsFromImage(imgNoise);
+	const auto& referenceKeys = reference.keys();
+
+	QCOMPARE(uniqueColors, ColorSet(referenceKeys.cbegin(), referenceKeys.cend()));
+
+	const auto& mostFrequent = histogram.mostFrequentColors();
+
+	QCOMPARE(mostFrequent.count(), histogram.colors.count());
+	QCOMPARE(mostFrequent.front(), QRgb(0xFF00FFU));
+
+	// Small images are scanned using a hash table instead of a bitset, and
+	// must produce the same results
+	const auto& imgSmallNoise = imgNoise.copy(0, 0, 67, 71);
+	QMap<QRgb, qsizetype> smallReference;
+
+	for (int y = 0; y < imgSmallNoise.height(); ++y)
+	{
+		const auto* line = reinterpret_cast<const QRgb*>(imgSmallNoise.constScanLine(y));
+		for (int x = 0; x < imgSmallNoise.width(); ++x)
+		{
+			++smallReference[line[x] & 0xFFFFFFU];
+		}
+	}
+
+	const auto& smallHistogram = colorHistogramFromImage(imgSmallNoise);
+	const auto& smallReferenceKeys = smallReference.keys();
+
+	QCOMPARE(smallHistogram.colors, smallReferenceKeys);
+	QCOMPARE(smallHistogram.counts, smallReference.values());
+	QCOMPARE(uniqueColorsFromImage(imgSmallNoise),
+			 ColorSet(smallReferenceKeys.cbegin(), smallReferenceKeys.cend()));
+
+	// Indexed8 images must produce the same results as their ARGB32
+	// counterparts
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch = toIndexed8(QImage{pathMagentaSwatch, "PNG"});
+
+	const auto& indexedHistogram = colorHistogramFromImage(imgMagentaSwatch);
+	const auto& expandedHistogram = colorHistogramFromImage(
+		imgMagentaSwatch.convertToFormat(QImage::Format_ARGB32));
+
+	QCOMPARE(indexedHistogram.colors, expandedHistogram.colors);
+	QCOMPARE(indexedHistogram.counts, expandedHistogram.counts);
+	QCOMPARE(std::accumulate(indexedHistogram.counts.cbegin(), indexedHistogram.counts.cend(), qsizetype(0)),
+			 qsizetype(imgMagentaSwatch.width()) * imgMagentaSwatch.height());
+
+	const auto& emptyHistogram = colorHistogramFromImage(QImage{});
+
+	QVERIFY(emptyHistogram.colors.isEmpty());
+	QVERIFY(emptyHistogram.counts.isEmpty());
 }
 
 void TestMorningStar::testWriteBase64()
@@ -424,5 +1142,707 @@ void TestMorningStar::testWriteBase64()
 	QVERIFY(imgMagentaSwatch.isNull() == false);
 	QVERIFY(imgDecoded.isNull() == false);
 
-	QCOMPARE(imgMagentaSwatch, imgDecoded);
+	// Few colors, so the output must use a palette
+	QCOMPARE(imgDecoded.format(), QImage::Format_Indexed8);
+	QCOMPARE(imgDecoded.convertToFormat(QImage::Format_ARGB32),
+			 imgMagentaSwatch.convertToFormat(QImage::Format_ARGB32));
+}
+
+void TestMorningStar::testImageMimeData()
+{
+	auto pathTestInput = QFINDTESTDATA("../tests/blend-test-input.png");
+	const auto& imgTestInput = QImage{pathTestInput, "PNG"}.convertToFormat(QImage::Format_ARGB32);
+
+	QVERIFY(imgTestInput.isNull() == false);
+
+	ImageMimeData mime{imgTestInput};
+
+	QVERIFY(mime.hasImage());
+	QVERIFY(mime.hasFormat("image/png"));
+	QVERIFY(mime.hasFormat("text/plain") == false);
+
+	// In-process consumers get the image itself
+	QCOMPARE(qvariant_cast<QImage>(mime.imageData()), imgTestInput);
+
+	const auto& pngData = mime.data("image/png");
+	QImage imgDecoded;
+
+	QVERIFY(imgDecoded.loadFromData(pngData, "PNG"));
+	QCOMPARE(imgDecoded.convertToFormat(QImage::Format_ARGB32), imgTestInput);
+
+	// Encoded data is reused for later requests
+	QCOMPARE(mime.data("image/png").constData(), pngData.constData());
+
+	QVERIFY(ImageMimeData{QImage{}}.formats().isEmpty());
+}
+
+void TestMorningStar::testImageLoader()
+{
+	auto pathTestInput = QFINDTESTDATA("../tests/blend-test-input.png");
+	const auto& imgExpected = toWorkingFormat(QImage{pathTestInput, "PNG"});
+
+	ImageLoader loader;
+	QSignalSpy finishedSpy{&loader, &ImageLoader::finished};
+	QSignalSpy progressSpy{&loader, &ImageLoader::progressChanged};
+
+	loader.load(pathTestInput);
+	loader.wait();
+	QCoreApplication::processEvents();
+
+	QCOMPARE(finishedSpy.count(), qsizetype(1));
+	QCOMPARE(finishedSpy.at(0).at(0).toString(), pathTestInput);
+	QCOMPARE(finishedSpy.at(0).at(1).value<QImage>(), imgExpected);
+	QVERIFY(progressSpy.isEmpty() == false);
+	QCOMPARE(progressSpy.last().at(0).toInt(), 99);
+
+	// Superseded and canceled requests never deliver anything
+	finishedSpy.clear();
+
+	loader.load(QFINDTESTDATA("../tests/magenta-palette.png"));
+	loader.load(pathTestInput);
+	loader.wait();
+	QCoreApplication::processEvents();
+
+	QCOMPARE(finishedSpy.count(), qsizetype(1));
+	QCOMPARE(finishedSpy.at(0).at(0).toString(), pathTestInput);
+
+	finishedSpy.clear();
+
+	loader.load(pathTestInput);
+	loader.cancel();
+	loader.wait();
+	QCoreApplication::processEvents();
+
+	QVERIFY(finishedSpy.isEmpty());
+
+	// Data requests supersede file requests, and have no file name
+	finishedSpy.clear();
+
+	QFile inputFile{pathTestInput};
+	QVERIFY(inputFile.open(QIODevice::ReadOnly));
+
+	loader.load(pathTestInput);
+	loader.loadData(inputFile.readAll());
+	loader.wait();
+	QCoreApplication::processEvents();
+
+	QCOMPARE(finishedSpy.count(), qsizetype(1));
+	QVERIFY(finishedSpy.at(0).at(0).toString().isEmpty());
+	QCOMPARE(finishedSpy.at(0).at(1).value<QImage>(), imgExpected);
+
+	finishedSpy.clear();
+
+	// Failures are reported with a null image
+	QTemporaryDir tempDir;
+	QVERIFY(tempDir.isValid());
+
+	const auto& pathMissing = tempDir.filePath("missing.png");
+
+	loader.load(pathMissing);
+	loader.wait();
+	QCoreApplication::processEvents();
+
+	QCOMPARE(finishedSpy.count(), qsizetype(1));
+	QCOMPARE(finishedSpy.at(0).at(0).toString(), pathMissing);
+	QVERIFY(finishedSpy.at(0).at(1).value<QImage>().isNull());
+}
+
+void TestMorningStar::testImageStripReader()
+{
+	QTemporaryDir tempDir;
+	QVERIFY(tempDir.isValid());
+
+	// Formats without native strip support are read in full
+	const auto& pathBmp = tempDir.filePath("magenta-palette.bmp");
+	QVERIFY(QImage{QFINDTESTDATA("../tests/magenta-palette.png")}.save(pathBmp, "BMP"));
+
+	// JPEG supports clip rects, but would have to be decoded from the start
+	// for every strip
+	const auto& pathJpeg = tempDir.filePath("magenta-palette.jpg");
+	QVERIFY(QImage{QFINDTESTDATA("../tests/magenta-palette.png")}.save(pathJpeg, "JPEG"));
+
+	const QList<std::pair<QString, bool>> testFiles{
+		{ QFINDTESTDATA("../tests/magenta-palette.png"), true },	// RGBA
+		{ QFINDTESTDATA("../tests/alpha-magenta.png"), true },		// RGBA
+		{ QFINDTESTDATA("../tests/blend-test-input.png"), true },	// Palette
+		{ pathBmp, false },
+		{ pathJpeg, false },
+	};
+
+	for (const auto& [path, incremental] : testFiles)
+	{
+		QImage expected{path};
+		expected.convertTo(QImage::Format_ARGB32);
+		expected.setColorSpace({});
+
+		MosIO::ImageStripReader reader{path};
+
+		QVERIFY(reader.open());
+		QCOMPARE(reader.isIncremental(), incremental);
+		QCOMPARE(reader.size(), expected.size());
+
+		while (!reader.atEnd())
+		{
+			const auto y = reader.rowsRead();
+			const auto& strip = reader.read(7);
+
+			QVERIFY(!strip.isNull());
+			QCOMPARE(strip, expected.copy(0, y, expected.width(), strip.height()));
+		}
+
+		QCOMPARE(reader.rowsRead(), expected.height());
+		QVERIFY(reader.read(7).isNull());
+	}
+
+	MosIO::ImageStripReader missingReader{tempDir.filePath("missing.png")};
+	QVERIFY(!missingReader.open());
+}
+
+void TestMorningStar::testPngStreamWriter()
+{
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch{pathMagentaSwatch, "PNG"};
+
+	QByteArray data;
+	QBuffer buf{&data};
+	QVERIFY(buf.open(QIODevice::WriteOnly));
+
+	MosIO::PngStreamWriter writer{&buf, imgMagentaSwatch.width(), imgMagentaSwatch.height()};
+
+	for (int y = 0; y < imgMagentaSwatch.height(); y += 5)
+	{
+		const auto rows = qMin(5, imgMagentaSwatch.height() - y);
+		QVERIFY(writer.write(imgMagentaSwatch.copy(0, y, imgMagentaSwatch.width(), rows)));
+	}
+
+	QVERIFY(writer.finish());
+	QCOMPARE(writer.rowsWritten(), imgMagentaSwatch.height());
+
+	QImage imgDecoded;
+	QVERIFY(imgDecoded.loadFromData(data, "PNG"));
+	QCOMPARE(imgDecoded.text("Software"), QString{"Wespal v%1"}.arg(MOS_VERSION));
+	QCOMPARE(imgDecoded, imgMagentaSwatch);
+
+	// Missing scanlines result in failure
+	QBuffer incompleteBuf;
+	QVERIFY(incompleteBuf.open(QIODevice::WriteOnly));
+
+	MosIO::PngStreamWriter incompleteWriter{&incompleteBuf, imgMagentaSwatch.width(), imgMagentaSwatch.height()};
+
+	QVERIFY(incompleteWriter.write(imgMagentaSwatch.copy(0, 0, imgMagentaSwatch.width(), 1)));
+	QVERIFY(!incompleteWriter.finish());
+	QVERIFY(incompleteWriter.hasError());
+}
+
+void TestMorningStar::testPngProfiles()
+{
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch{pathMagentaSwatch, "PNG"};
+	imgMagentaSwatch.convertTo(QImage::Format_ARGB32);
+
+	// Large enough to be split into several deflate chunks by the fast
+	// profile, with repeating content so that back-references cross chunk
+	// boundaries
+	QImage imgLarge{1024, 1024, QImage::Format_ARGB32};
+	auto* rng = QRandomGenerator::global();
+
+	for (int y = 0; y < imgLarge.height(); ++y)
+	{
+		auto* row = reinterpret_cast<QRgb*>(imgLarge.scanLine(y));
+
+		for (int x = 0; x < imgLarge.width(); ++x)
+		{
+			row[x] = y % 3 == 0
+					 ? rng->generate()
+					 : imgMagentaSwatch.pixel(x % imgMagentaSwatch.width(),
+											  y % imgMagentaSwatch.height());
+		}
+	}
+
+	const QList<MosIO::PngProfile> profiles{
+		MosIO::PngProfileFast,
+		MosIO::PngProfileBalanced,
+		MosIO::PngProfileSmallest,
+	};
+
+	for (const auto& profile : profiles)
+	{
+		for (const auto& input : {imgMagentaSwatch, imgLarge})
+		{
+			QByteArray data;
+			QBuffer buf{&data};
+			QVERIFY(buf.open(QIODevice::WriteOnly));
+
+			MosIO::PngStreamWriter writer{&buf, input.width(), input.height(), true, profile};
+
+			for (int y = 0; y < input.height(); y += 100)
+			{
+				const auto rows = qMin(100, input.height() - y);
+				QVERIFY(writer.write(input.copy(0, y, input.width(), rows)));
+			}
+
+			QVERIFY(writer.finish());
+
+			QImage imgDecoded;
+			QVERIFY(imgDecoded.loadFromData(data, "PNG"));
+			imgDecoded.convertTo(QImage::Format_ARGB32);
+			QCOMPARE(imgDecoded, input);
+		}
+
+		auto imgCopy = imgLarge;
+		QImage imgDecoded;
+		imgDecoded.loadFromData(QByteArray::fromBase64(MosIO::writeBase64Png(imgCopy, false, profile).toUtf8()), "PNG");
+		imgDecoded.convertTo(QImage::Format_ARGB32);
+		imgDecoded.setColorSpace({});
+		QCOMPARE(imgDecoded, imgLarge);
+	}
+
+	// Palette output goes through QImageWriter, which must still compress
+	// the image data with the fast profile
+	QImage imgTiled{512, 512, QImage::Format_ARGB32};
+
+	for (int y = 0; y < imgTiled.height(); ++y)
+	{
+		for (int x = 0; x < imgTiled.width(); ++x)
+		{
+			imgTiled.setPixel(x, y, imgMagentaSwatch.pixel(x % imgMagentaSwatch.width(),
+														   y % imgMagentaSwatch.height()));
+		}
+	}
+
+	auto imgCopy = imgTiled;
+	const auto fastData = MosIO::writePngData(imgCopy, false, MosIO::PngProfileFast);
+
+	QVERIFY(!fastData.isEmpty());
+	QVERIFY(fastData.size() < qsizetype(imgTiled.width()) * imgTiled.height());
+}
+
+void TestMorningStar::testPalettedPng()
+{
+	using namespace wesnoth;
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch{pathMagentaSwatch, "PNG"};
+	imgMagentaSwatch.convertTo(QImage::Format_ARGB32);
+	imgMagentaSwatch.setColorSpace({});
+
+	// Conversion must be lossless, including fully transparent pixels with
+	// different colors
+	auto imgTranslucent = imgMagentaSwatch;
+	imgTranslucent.setPixel(0, 0, qRgba(0x12, 0x34, 0x56, 0));
+	imgTranslucent.setPixel(1, 0, qRgba(0x65, 0x43, 0x21, 0));
+	imgTranslucent.setPixel(2, 0, qRgba(0x65, 0x43, 0x21, 0x80));
+
+	const auto& imgIndexed = toIndexedImage(imgTranslucent);
+
+	QCOMPARE(imgIndexed.format(), QImage::Format_Indexed8);
+	QCOMPARE(imgIndexed, toIndexed8(imgTranslucent));
+	QCOMPARE(imgIndexed.convertToFormat(QImage::Format_ARGB32), imgTranslucent);
+
+	// Indexed8 images are only shared
+	QCOMPARE(toIndexedImage(imgIndexed).cacheKey(), imgIndexed.cacheKey());
+
+	// Exactly 256 colors fit, 257 don't
+	QImage imgManyColors{257, 1, QImage::Format_ARGB32};
+
+	for (int x = 0; x < imgManyColors.width(); ++x)
+	{
+		imgManyColors.setPixel(x, 0, qRgba(x & 0xFF, x >> 8, 0, 0xFF));
+	}
+
+	QCOMPARE(toIndexedImage(imgManyColors.copy(0, 0, 256, 1)).colorCount(), 256);
+	QVERIFY(toIndexedImage(imgManyColors).isNull());
+
+	QTemporaryDir tempDir;
+	QVERIFY(tempDir.isValid());
+
+	const QList<MosIO::PngProfile> profiles{
+		MosIO::PngProfileFast,
+		MosIO::PngProfileBalanced,
+		MosIO::PngProfileSmallest,
+	};
+
+	for (const auto& profile : profiles)
+	{
+		const auto& fileName = tempDir.filePath(QString{"paletted-%1.png"}.arg(int(profile)));
+		auto input = imgTranslucent;
+
+		QVERIFY(MosIO::writePng(input, fileName, true, profile));
+
+		QImage output{fileName, "PNG"};
+
+		QCOMPARE(output.format(), QImage::Format_Indexed8);
+		QCOMPARE(output.text("Software"), QString{"Wespal v%1"}.arg(MOS_VERSION));
+		QCOMPARE(output.convertToFormat(QImage::Format_ARGB32), imgTranslucent);
+
+		// Too many colors for a palette
+		const auto& trueColorFileName = tempDir.filePath(QString{"truecolor-%1.png"}.arg(int(profile)));
+
+		QVERIFY(MosIO::writePng(imgManyColors, trueColorFileName, true, profile));
+
+		QImage trueColorOutput{trueColorFileName, "PNG"};
+
+		QVERIFY(trueColorOutput.format() != QImage::Format_Indexed8);
+		QCOMPARE(trueColorOutput.convertToFormat(QImage::Format_ARGB32), imgManyColors);
+	}
+}
+
+void TestMorningStar::testRecolorImageFile()
+{
+	using namespace wesnoth;
+
+	const auto& palMagenta = builtinPalettes["magenta"];
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch{pathMagentaSwatch, "PNG"};
+
+	QTemporaryDir tempDir;
+	QVERIFY(tempDir.isValid());
+
+	QList<CompiledColorMap> colorMaps;
+	QStringList fileNames;
+
+	for (const auto& rangeId : builtinColorRanges.orderedNames())
+	{
+		colorMaps.emplaceBack(builtinColorRanges[rangeId].applyToPalette(palMagenta));
+		fileNames.push_back(tempDir.filePath(rangeId + ".png"));
+	}
+
+	// Writing to a missing directory must fail without affecting other outputs
+	colorMaps.emplaceBack();
+	fileNames.push_back(tempDir.filePath("missing/bad.png"));
+
+	QStringList failed;
+
+	QVERIFY(MosIO::recolorImageFile(pathMagentaSwatch, colorMaps, fileNames, failed));
+	QCOMPARE(failed, QStringList{fileNames.back()});
+
+	for (qsizetype k = 0; k < fileNames.count() - 1; ++k)
+	{
+		QImage output{fileNames[k], "PNG"};
+		output.convertTo(QImage::Format_ARGB32);
+		QCOMPARE(output, recolorImage(imgMagentaSwatch, colorMaps[k]));
+	}
+
+	// Nothing is written if the input can't be read
+	const auto& orphanFileName = tempDir.filePath("orphan.png");
+
+	QVERIFY(!MosIO::recolorImageFile(tempDir.filePath("missing.png"),
+									 {CompiledColorMap{}},
+									 {orphanFileName},
+									 failed));
+	QCOMPARE(failed, QStringList{orphanFileName});
+	QVERIFY(!QFileInfo::exists(orphanFileName));
+}
+
+void TestMorningStar::testRecolorJobRunner()
+{
+	using namespace wesnoth;
+
+	const auto& palMagenta = builtinPalettes["magenta"];
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QImage imgMagentaSwatch{pathMagentaSwatch, "PNG"};
+
+	QTemporaryDir tempDir;
+	QVERIFY(tempDir.isValid());
+
+	QMap<QString, QImage> expected;
+	RecolorJobRunner runner;
+
+	for (const auto& rangeId : builtinColorRanges.orderedNames())
+	{
+		const auto& colorMap = builtinColorRanges[rangeId].applyToPalette(palMagenta);
+		const auto& fileName = tempDir.filePath(rangeId + ".png");
+
+		expected[fileName] = recolorImage(imgMagentaSwatch, colorMap);
+		runner.addJob(imgMagentaSwatch, CompiledColorMap{colorMap}, fileName);
+	}
+
+	// Writing to a missing directory must fail without affecting other jobs
+	const auto& badFileName = tempDir.filePath("missing/bad.png");
+	runner.addJob(imgMagentaSwatch, CompiledColorMap{}, badFileName);
+
+	runner.start();
+	runner.wait();
+
+	QVERIFY(!runner.isRunning());
+	QCOMPARE(runner.finishedJobCount(), runner.jobCount());
+	QCOMPARE(runner.failed(), QStringList{badFileName});
+
+	auto succeeded = runner.succeeded();
+	succeeded.sort();
+
+	QCOMPARE(succeeded, expected.keys());
+
+	for (const auto& [fileName, image] : expected.asKeyValueRange())
+	{
+		QImage output{fileName, "PNG"};
+		output.convertTo(QImage::Format_ARGB32);
+		QCOMPARE(output, image);
+	}
+
+	// Canceling before starting skips every job
+	RecolorJobRunner canceledRunner;
+	canceledRunner.addJob(imgMagentaSwatch, CompiledColorMap{}, tempDir.filePath("canceled.png"));
+	canceledRunner.cancel();
+	canceledRunner.start();
+	canceledRunner.wait();
+
+	QVERIFY(canceledRunner.isCanceled());
+	QVERIFY(canceledRunner.succeeded().isEmpty());
+	QVERIFY(canceledRunner.failed().isEmpty());
+	QVERIFY(!QFileInfo::exists(tempDir.filePath("canceled.png")));
+}
+
+void TestMorningStar::testPreviewRenderer()
+{
+	auto pathTestInput = QFINDTESTDATA("../tests/blend-test-input.png");
+	QImage imgTestInput{pathTestInput, "PNG"};
+
+	PreviewRenderer renderer;
+	QSignalSpy readySpy{&renderer, &PreviewRenderer::ready};
+
+	// Only the result of the last request may ever be delivered
+	for (int shift = -64; shift <= 64; shift += 32)
+	{
+		renderer.render([imgTestInput, shift]() {
+			return colorShiftImage(imgTestInput, shift, shift, shift);
+		});
+	}
+
+	renderer.flush();
+
+	QCOMPARE(readySpy.count(), qsizetype(1));
+	QCOMPARE(readySpy.at(0).at(0).value<QImage>(),
+			 colorShiftImage(imgTestInput, 64, 64, 64));
+
+	// Stale results already queued for delivery must be dropped
+	QCoreApplication::processEvents();
+	QCOMPARE(readySpy.count(), qsizetype(1));
+
+	// Canceled requests never deliver anything
+	renderer.render([imgTestInput]() {
+		return colorBlendImage(imgTestInput, Qt::red, 0.5);
+	});
+	renderer.cancel();
+	renderer.flush();
+	QCoreApplication::processEvents();
+
+	QCOMPARE(readySpy.count(), qsizetype(1));
+}
+
+void TestMorningStar::testScaledImageCache()
+{
+	auto pathTestInput = QFINDTESTDATA("../tests/alpha-magenta.png");
+	const auto& source = QImage{pathTestInput, "PNG"}
+							 .convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+	ScaledImageCache cache;
+	cache.setImage(source);
+
+	QCOMPARE(cache.image(), source);
+
+	// Integer upscaling factors use cached tiles, the rest don't. Either way,
+	// only the exposed area may be painted, and it must look the same as if
+	// the whole image had been painted.
+	const QSize targetSizes[] = {
+		source.size(),
+		source.size() * 2,
+		source.size() * 16,
+		QSize{source.width() * 3, source.height() * 2},
+	};
+
+	for (const auto& targetSize : targetSizes)
+	{
+		const QRect target{QPoint{}, targetSize};
+
+		QImage blank{targetSize, QImage::Format_ARGB32_Premultiplied};
+		blank.fill(0);
+
+		QImage expected = blank.copy();
+
+		{
+			QPainter p{&expected};
+			p.drawImage(target, source);
+		}
+
+		const QRect exposed{targetSize.width() / 3, targetSize.height() / 4,
+							targetSize.width() / 2, targetSize.height() / 2};
+
+		QImage canvas = blank.copy();
+
+		{
+			QPainter p{&canvas};
+			cache.paint(p, target, exposed);
+		}
+
+		QCOMPARE(canvas.copy(exposed), expected.copy(exposed));
+		QCOMPARE(canvas.pixel(0, 0), 0U);
+		QCOMPARE(canvas.pixel(target.bottomRight()), 0U);
+
+		// Restricting the source area (e.g. to the left half of the image)
+		// must leave everything else untouched
+		const auto splitColumn = source.width() / 2;
+		const auto splitX = splitColumn * targetSize.width() / source.width();
+		const QRect leftSide{0, 0, splitX, targetSize.height()},
+					rightSide{splitX, 0, targetSize.width() - splitX, targetSize.height()};
+
+		canvas = blank.copy();
+
+		{
+			QPainter p{&canvas};
+			cache.paint(p, target, target, QRect{0, 0, splitColumn, source.height()});
+		}
+
+		QCOMPARE(canvas.copy(leftSide), expected.copy(leftSide));
+		QCOMPARE(canvas.copy(rightSide), blank.copy(rightSide));
+	}
+
+	QVERIFY(cache.tileCount() > 0);
+
+	cache.clear();
+
+	QVERIFY(cache.image().isNull());
+	QCOMPARE(cache.tileCount(), qsizetype(0));
+}
+
+void TestMorningStar::testSettingsStore()
+{
+	QTemporaryDir tempDir;
+	QVERIFY(tempDir.isValid());
+
+	const auto& fileName = tempDir.filePath("settings.ini");
+
+	{
+		MosConfig::SettingsStore store{fileName, 10};
+
+		// Repeated writes to the same key are coalesced
+		store.setValue("zoom", 1.0);
+		store.setValue("zoom", 2.0);
+		store.setValue("group/a", 1);
+		store.setValue("group/b", 2);
+
+		QCOMPARE(store.pendingCount(), qsizetype(3));
+
+		// Removing a group drops earlier writes under it, but not later ones
+		store.remove("group");
+		store.setValue("group/c", 3);
+
+		QCOMPARE(store.pendingCount(), qsizetype(3));
+
+		store.flush();
+
+		QCOMPARE(store.pendingCount(), qsizetype(0));
+
+		QSettings qs{fileName, QSettings::IniFormat};
+
+		QCOMPARE(qs.value("zoom").toReal(), 2.0);
+		QVERIFY(!qs.contains("group/a"));
+		QVERIFY(!qs.contains("group/b"));
+		QCOMPARE(qs.value("group/c").toInt(), 3);
+
+		// Changes are written in the background after a short delay
+		store.setValue("zoom", 4.0);
+
+		QTRY_COMPARE(store.pendingCount(), qsizetype(0));
+
+		// Destroying the store writes anything still pending
+		store.remove("group");
+	}
+
+	QSettings qs{fileName, QSettings::IniFormat};
+
+	QCOMPARE(qs.value("zoom").toReal(), 4.0);
+	QVERIFY(!qs.contains("group/c"));
+}
+
+void TestMorningStar::testTracing()
+{
+#ifndef MOS_ENABLE_TRACING
+	QVERIFY(!MosTrace::start("unused.json"));
+	QSKIP("Tracing is disabled in this build");
+#else
+	QTemporaryDir tempDir;
+	QVERIFY(tempDir.isValid());
+
+	const auto& traceFileName = tempDir.filePath("trace.json");
+
+	QVERIFY(!MosTrace::isActive());
+	QVERIFY(!MosTrace::stop());
+	QVERIFY(!MosTrace::start({}));
+
+	{
+		// Spans started before recording are never recorded
+		MosTrace::Span earlySpan{"test", "early"};
+
+		QVERIFY(MosTrace::start(traceFileName));
+		QVERIFY(MosTrace::isActive());
+		QVERIFY(!MosTrace::start(traceFileName));
+	}
+
+	{
+		MosTrace::Span outerSpan{"test", "outer", QSize{72, 36}};
+		MosTrace::Span innerSpan{"test", "inner"};
+		innerSpan.setImageSize(QSize{8, 4});
+	}
+
+	std::thread worker{[]() {
+		MosTrace::Span workerSpan{"test", "worker"};
+	}};
+	worker.join();
+
+	QVERIFY(MosTrace::stop());
+	QVERIFY(!MosTrace::isActive());
+
+	{
+		// Spans finishing after recording stopped are never recorded
+		MosTrace::Span lateSpan{"test", "late"};
+	}
+
+	QFile traceFile{traceFileName};
+	QVERIFY(traceFile.open(QIODevice::ReadOnly));
+
+	const auto& events = QJsonDocument::fromJson(traceFile.readAll())
+							 .object().value("traceEvents").toArray();
+
+	QMap<QString, QJsonObject> spans;
+	QSet<int> threadIds, namedThreadIds;
+
+	for (const auto& value : events)
+	{
+		const auto& event = value.toObject();
+		const auto& phase = event.value("ph").toString();
+
+		if (phase == "X") {
+			QCOMPARE(event.value("cat").toString(), QString{"test"});
+			QVERIFY(event.value("dur").toDouble() >= 0);
+			spans.insert(event.value("name").toString(), event);
+			threadIds.insert(event.value("tid").toInt());
+		} else {
+			QCOMPARE(phase, QString{"M"});
+			QCOMPARE(event.value("name").toString(), QString{"thread_name"});
+			namedThreadIds.insert(event.value("tid").toInt());
+		}
+	}
+
+	QCOMPARE(spans.keys(), (QStringList{"inner", "outer", "worker"}));
+	QCOMPARE(threadIds.count(), qsizetype(2));
+	QCOMPARE(namedThreadIds, threadIds);
+
+	const auto& outerArgs = spans["outer"].value("args").toObject();
+	QCOMPARE(outerArgs.value("width").toInt(), 72);
+	QCOMPARE(outerArgs.value("height").toInt(), 36);
+
+	const auto& innerArgs = spans["inner"].value("args").toObject();
+	QCOMPARE(innerArgs.value("width").toInt(), 8);
+	QCOMPARE(innerArgs.value("height").toInt(), 4);
+
+	QVERIFY(!spans["worker"].contains("args"));
+
+	// Nested spans are contained within their parents
+	QVERIFY(spans["inner"].value("ts").toDouble() >= spans["outer"].value("ts").toDouble());
+	QCOMPARE(spans["inner"].value("tid"), spans["outer"].value("tid"));
+	QVERIFY(spans["worker"].value("tid") != spans["outer"].value("tid"));
+#endif
 }
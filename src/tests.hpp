@@ -30,10 +30,32 @@ private slots:
 	void testMru();
 	void testBuiltinObjects();
 	void testRecolorAlgorithm();
+	void testColorRangeFixedPoint();
+	void testPrecomputedColorMaps();
 	void testWesnothRcImage();
 	void testPaletteSwapImage();
+	void testCompiledColorMap();
+	void testRecolorImages();
+	void testKeyColorIndex();
+	void testColorMapCache();
 	void testColorShiftImage();
 	void testColorBlendImage();
+	void testImagePathFunctionChain();
+	void testIndexedImages();
+	void testSimdKernels();
 	void testUniqueColorsFromImage();
+	void testColorHistogramFromImage();
 	void testWriteBase64();
+	void testImageMimeData();
+	void testImageLoader();
+	void testImageStripReader();
+	void testPngStreamWriter();
+	void testPngProfiles();
+	void testPalettedPng();
+	void testRecolorImageFile();
+	void testRecolorJobRunner();
+	void testPreviewRenderer();
+	void testScaledImageCache();
+	void testSettingsStore();
+	void testTracing();
 };
@@ -0,0 +1,255 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "tracing.hpp"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSaveFile>
+#include <QThread>
+
+#include <vector>
+
+namespace MosTrace {
+
+#ifdef MOS_ENABLE_TRACING
+
+namespace {
+
+struct Event
+{
+	const char* category;
+	const char* name;
+	QSize imageSize;
+	qint64 startTime;
+	qint64 duration;
+	int threadId;
+};
+
+/**
+ * Recording state. Events are only ever appended while holding the mutex,
+ * which is cheap enough given that spans cover entire processing stages
+ * rather than individual pixels or scanlines.
+ */
+struct Recorder
+{
+	QMutex mutex;
+	QString fileName;
+	QElapsedTimer clock;
+	std::vector<Event> events;
+	QHash<int, QString> threadNames;
+};
+
+Recorder& recorder()
+{
+	static Recorder instance;
+	return instance;
+}
+
+QAtomicInt active{0};
+QAtomicInt lastThreadId{0};
+
+/**
+ * Returns a small sequential number identifying the current thread, which is
+ * easier to read in trace viewers than native thread ids.
+ */
+int currentThreadId()
+{
+	thread_local const int id = lastThreadId.fetchAndAddRelaxed(1) + 1;
+	return id;
+}
+
+QString currentThreadName()
+{
+	auto* thread = QThread::currentThread();
+
+	if (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread())
+		return QStringLiteral("Main thread");
+
+	if (!thread->objectName().isEmpty())
+		return thread->objectName();
+
+	return QStringLiteral("Worker thread %1").arg(currentThreadId());
+}
+
+} // end unnamed namespace
+
+bool start(const QString& fileName)
+{
+	if (fileName.isEmpty())
+		return false;
+
+	auto& rec = recorder();
+	QMutexLocker lock{&rec.mutex};
+
+	if (active.loadRelaxed())
+		return false;
+
+	rec.fileName = fileName;
+	rec.events.clear();
+	rec.threadNames.clear();
+	rec.clock.start();
+
+	// Publishes the clock to spans checking whether recording is active
+	active.storeRelease(1);
+
+	return true;
+}
+
+bool stop()
+{
+	auto& rec = recorder();
+	QMutexLocker lock{&rec.mutex};
+
+	if (!active.loadRelaxed())
+		return false;
+
+	active.storeRelease(0);
+
+	const auto pid = QCoreApplication::applicationPid();
+	QJsonArray traceEvents;
+
+	for (auto i = rec.threadNames.cbegin(); i != rec.threadNames.cend(); ++i)
+	{
+		traceEvents.append(QJsonObject{
+			{"name", "thread_name"},
+			{"ph", "M"},
+			{"pid", pid},
+			{"tid", i.key()},
+			{"args", QJsonObject{{"name", i.value()}}},
+		});
+	}
+
+	for (const auto& event : rec.events)
+	{
+		QJsonObject json{
+			{"name", event.name},
+			{"cat", event.category},
+			{"ph", "X"},
+			// Trace event timestamps are in microseconds
+			{"ts", double(event.startTime) / 1000},
+			{"dur", double(event.duration) / 1000},
+			{"pid", pid},
+			{"tid", event.threadId},
+		};
+
+		if (event.imageSize.isValid()) {
+			json.insert("args", QJsonObject{
+				{"width", event.imageSize.width()},
+				{"height", event.imageSize.height()},
+			});
+		}
+
+		traceEvents.append(json);
+	}
+
+	rec.events.clear();
+	rec.threadNames.clear();
+
+	QSaveFile file{rec.fileName};
+
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+
+	file.write(QJsonDocument{QJsonObject{
+		{"traceEvents", traceEvents},
+		{"displayTimeUnit", "ms"},
+	}}.toJson(QJsonDocument::Compact));
+
+	return file.commit();
+}
+
+bool isActive()
+{
+	return active.loadAcquire() != 0;
+}
+
+Span::Span(const char* category, const char* name, const QSize& imageSize)
+	: category_(category)
+	, name_(name)
+	, imageSize_(imageSize)
+	, startTime_(isActive() ? recorder().clock.nsecsElapsed() : -1)
+{
+}
+
+Span::~Span()
+{
+	if (startTime_ < 0 || !isActive())
+		return;
+
+	auto& rec = recorder();
+	const auto endTime = rec.clock.nsecsElapsed();
+	const auto threadId = currentThreadId();
+
+	QMutexLocker lock{&rec.mutex};
+
+	// Recording may have been stopped and restarted in the meantime
+	if (!active.loadRelaxed() || startTime_ > endTime)
+		return;
+
+	if (!rec.threadNames.contains(threadId))
+		rec.threadNames.insert(threadId, currentThreadName());
+
+	rec.events.push_back({category_, name_, imageSize_, startTime_, endTime - startTime_, threadId});
+}
+
+#else // !MOS_ENABLE_TRACING
+
+bool start(const QString& /*fileName*/)
+{
+	return false;
+}
+
+bool stop()
+{
+	return false;
+}
+
+bool isActive()
+{
+	return false;
+}
+
+Span::Span(const char* category, const char* name, const QSize& imageSize)
+	: category_(category)
+	, name_(name)
+	, imageSize_(imageSize)
+	, startTime_(-1)
+{
+}
+
+Span::~Span()
+{
+}
+
+#endif // MOS_ENABLE_TRACING
+
+bool startFromEnvironment()
+{
+	return start(qEnvironmentVariable(ENVIRONMENT_VARIABLE));
+}
+
+} // end namespace MosTrace
@@ -0,0 +1,152 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QSize>
+#include <QString>
+
+/**
+ * Lightweight tracing of image processing stages.
+ *
+ * Stages are instrumented with spans recording their start time, duration,
+ * thread, and the dimensions of the image being processed. Recorded spans are
+ * written as a Chrome trace event file, which can be inspected with Perfetto
+ * (https://ui.perfetto.dev) or chrome://tracing.
+ *
+ * Spans are created through the MOS_TRACE_SPAN() family of macros, which
+ * expand to nothing unless MOS_ENABLE_TRACING is defined (see the CMake
+ * ENABLE_TRACING option). Even then, spans do nothing but check a flag until
+ * recording is started with start() or startFromEnvironment().
+ */
+namespace MosTrace {
+
+/**
+ * Name of the environment variable used by startFromEnvironment().
+ */
+constexpr char ENVIRONMENT_VARIABLE[] = "WESPAL_TRACE";
+
+/**
+ * Starts recording spans.
+ *
+ * @param fileName     Trace file written when calling stop().
+ *
+ * @return Whether recording started. This is always false if tracing was
+ *         disabled at compile time, or if recording was already started.
+ */
+bool start(const QString& fileName);
+
+/**
+ * Starts recording spans if the WESPAL_TRACE environment variable is set to
+ * a file name.
+ *
+ * @return Whether recording started.
+ */
+bool startFromEnvironment();
+
+/**
+ * Stops recording spans, and writes them to the trace file.
+ *
+ * @return Whether the trace file was written successfully. This is false if
+ *         recording had not been started.
+ */
+bool stop();
+
+/**
+ * Returns whether spans are currently being recorded.
+ */
+bool isActive();
+
+/**
+ * A traced stage, lasting until the object is destroyed.
+ *
+ * Use the MOS_TRACE_SPAN() macros instead of using this class directly, so
+ * that spans can be removed at compile time.
+ */
+class Span
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param category     Stage category (e.g. "decode" or "encode"). Must
+	 *                     be a string literal.
+	 * @param name         Span name, normally the function being traced.
+	 *                     Must be a string literal.
+	 * @param imageSize    Dimensions of the image being processed, if any.
+	 */
+	Span(const char* category, const char* name, const QSize& imageSize = {});
+
+	~Span();
+
+	Span(const Span&) = delete;
+	Span& operator=(const Span&) = delete;
+
+	/**
+	 * Sets the dimensions of the image being processed, for stages that only
+	 * find out after starting (e.g. decoding).
+	 */
+	void setImageSize(const QSize& imageSize)
+	{
+		imageSize_ = imageSize;
+	}
+
+private:
+	const char* category_;
+	const char* name_;
+	QSize imageSize_;
+	qint64 startTime_;
+};
+
+} // end namespace MosTrace
+
+#ifdef MOS_ENABLE_TRACING
+
+#define MOS_TRACE_CONCAT_IMPL(a, b) a##b
+#define MOS_TRACE_CONCAT(a, b) MOS_TRACE_CONCAT_IMPL(a, b)
+
+/**
+ * Traces the rest of the enclosing scope.
+ *
+ * Takes the same arguments as the MosTrace::Span constructor.
+ */
+#define MOS_TRACE_SPAN(...) \
+	MosTrace::Span MOS_TRACE_CONCAT(mosTraceSpan, __LINE__){__VA_ARGS__}
+
+/**
+ * Traces the rest of the enclosing scope using a named span, for use with
+ * MOS_TRACE_SET_IMAGE_SIZE().
+ */
+#define MOS_TRACE_NAMED_SPAN(var, ...) \
+	MosTrace::Span var{__VA_ARGS__}
+
+/**
+ * Sets the image dimensions of a named span.
+ */
+#define MOS_TRACE_SET_IMAGE_SIZE(var, size) \
+	var.setImageSize(size)
+
+#else
+
+#define MOS_TRACE_SPAN(...) do {} while (0)
+#define MOS_TRACE_NAMED_SPAN(var, ...) do {} while (0)
+#define MOS_TRACE_SET_IMAGE_SIZE(var, size) do {} while (0)
+
+#endif
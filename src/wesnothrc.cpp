@@ -26,6 +26,10 @@
 
 #include "wesnothrc.hpp"
 
+#include "defs.hpp"
+#include "imagestream.hpp"
+#include "simdkernels.hpp"
+#include "tracing.hpp"
 #include "version.hpp"
 
 #include <QBuffer>
@@ -33,10 +37,49 @@
 #include <QFile>
 #include <QImageWriter>
 #include <QRegularExpression>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QSemaphore>
 #include <QStringBuilder>
+#include <QThread>
+#include <QThreadPool>
+#include <QtAlgorithms>
+#include <QVarLengthArray>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <vector>
 
 namespace {
 
+// Approximate amount of input scanlines processed at once by
+// MosIO::recolorImageFile(), in bytes
+constexpr qint64 STREAMING_STRIP_SIZE = 4 * 1024 * 1024;
+
+// Key palette position of color table entries that are not in the key
+// palette (see KeyColorIndex)
+constexpr quint32 NO_KEY = 0xFFFFFFFFU;
+
+// Minimum number of pixels scanned by each thread when scanning an image
+// for unique colors in parallel
+constexpr qsizetype PARALLEL_SCAN_MIN_PIXELS = 256 * 1024;
+
+// Minimum number of pixels for scanning an image for unique colors using a
+// ColorBitset. The bitset's fixed 2 MiB would otherwise dwarf typical sprites,
+// so smaller images use a hash table instead
+constexpr qsizetype COLOR_BITSET_MIN_PIXELS = PARALLEL_SCAN_MIN_PIXELS;
+
+// Maximum number of threads used for scanning an image for unique colors,
+// since every thread needs its own 2 MiB color bitset
+constexpr int PARALLEL_SCAN_MAX_THREADS = 8;
+
+// Maximum amount of memory used for per-thread pixel counters when building
+// color histograms, in bytes
+constexpr qsizetype PARALLEL_COUNT_MAX_MEMORY = 64 * 1024 * 1024;
+
 const QString WML_INDENT = QStringLiteral("    ");
 
 const QString WML_COLOR_RANGE_DESC = QStringLiteral(
@@ -75,59 +118,413 @@ QString makeWmlColor(QRgb rgb)
 	return ret.right(ret.length() - 1);
 }
 
-} // end unnamed namespace #1
+/**
+ * Creates an uninitialised image with the same size and metadata as an
+ * existing image, and either the same or a different format.
+ */
+QImage blankImageLike(const QImage& image, QImage::Format format = QImage::Format_Invalid)
+{
+	QImage ret{image.size(), format == QImage::Format_Invalid ? image.format() : format};
 
-ColorMap ColorRange::applyToPalette(const ColorList& palette) const
+	ret.setColorSpace(image.colorSpace());
+	ret.setDotsPerMeterX(image.dotsPerMeterX());
+	ret.setDotsPerMeterY(image.dotsPerMeterY());
+	ret.setOffset(image.offset());
+
+	const auto& textKeys = image.textKeys();
+
+	for (const auto& key : textKeys)
+	{
+		ret.setText(key, image.text(key));
+	}
+
+	return ret;
+}
+
+/**
+ * Transforms an Indexed8 image by applying a transform to its color table.
+ *
+ * This produces the same results as applying the transform to every pixel
+ * after converting the image to ARGB32, but the pixel data is never touched.
+ * If the transform leaves the color table unchanged, the input image is
+ * returned as-is.
+ *
+ * @param input        Input image, which must be in Indexed8 format.
+ * @param transform    Callable taking a pointer to QRgb values and their
+ *                     count, which transforms the values in-place.
+ */
+template<typename Transform>
+QImage transformColorTable(const QImage& input, Transform transform)
 {
-	ColorMap mapRgb;
+	auto colorTable = input.colorTable();
 
-	auto midR = qRed(mid_),
-		 midG = qGreen(mid_),
-		 midB = qBlue(mid_);
+	transform(colorTable.data(), colorTable.count());
 
-	auto maxR = qRed(max_),
-		 maxG = qGreen(max_),
-		 maxB = qBlue(max_);
+	if (colorTable == input.colorTable())
+		return input;
 
-	auto minR = qRed(min_),
-		 minG = qGreen(min_),
-		 minB = qBlue(min_);
+	QImage output = input;
 
-	// Map first color in vector to exact new color
-	QRgb tempRgb = palette.empty() ? 0 : palette.front();
-	auto oldR = qRed(tempRgb),
-		 oldG = qGreen(tempRgb),
-		 oldB = qBlue(tempRgb);
-	const auto referenceAvg = (oldR + oldG + oldB) / 3;
+	output.setColorTable(colorTable);
 
-	for (auto color : palette)
+	return output;
+}
+
+/**
+ * Set of RGB colors stored as a bitset covering the whole 24-bit color space,
+ * which takes 2 MiB regardless of the number of colors.
+ */
+class ColorBitset
+{
+public:
+	ColorBitset()
+		: words_(WORD_COUNT, 0)
+		, ranks_()
 	{
-		auto r = qRed(color),
-			 g = qGreen(color),
-			 b = qBlue(color);
-		const auto oldAvg = (r + g + b) / 3;
-
-		// Calculate new color
-		if (referenceAvg && oldAvg <= referenceAvg) {
-			float oldRatio = float(oldAvg) / float(referenceAvg);
-			r = oldRatio * midR + (1 - oldRatio) * minR;
-			g = oldRatio * midG + (1 - oldRatio) * minG;
-			b = oldRatio * midB + (1 - oldRatio) * minB;
-		} else if (255 - referenceAvg) {
-			float oldRatio = (255.0f - float(oldAvg)) / (255.0f - float(referenceAvg));
-			r = oldRatio * midR + (1 - oldRatio) * maxR;
-			g = oldRatio * midG + (1 - oldRatio) * maxG;
-			b = oldRatio * midB + (1 - oldRatio) * maxB;
-		} else {
-			r = g = b = 0;
-			Q_ASSERT(false);
-			// Should never get here.
-			// Would imply oldAvg > referenceAvg = 255
+	}
+
+	void insert(QRgb rgb)
+	{
+		words_[rgb >> 6] |= quint64(1) << (rgb & 63);
+	}
+
+	void unite(const ColorBitset& other)
+	{
+		for (qsizetype i = 0; i < WORD_COUNT; ++i)
+		{
+			words_[i] |= other.words_[i];
+		}
+	}
+
+	/**
+	 * Returns the number of colors in the set.
+	 */
+	qsizetype count() const
+	{
+		qsizetype ret = 0;
+
+		for (auto word : words_)
+		{
+			ret += qPopulationCount(word);
+		}
+
+		return ret;
+	}
+
+	/**
+	 * Calls a function for every color in the set, in ascending order.
+	 */
+	template<typename Function>
+	void forEach(Function function) const
+	{
+		for (qsizetype i = 0; i < WORD_COUNT; ++i)
+		{
+			for (auto word = words_[i]; word != 0; word &= word - 1)
+			{
+				function(QRgb(i * 64 + qCountTrailingZeroBits(word)));
+			}
+		}
+	}
+
+	/**
+	 * Prepares the set for rank() lookups.
+	 *
+	 * @return The number of colors in the set.
+	 */
+	quint32 buildRanks()
+	{
+		quint32 rank = 0;
+
+		ranks_.resize(WORD_COUNT);
+
+		for (qsizetype i = 0; i < WORD_COUNT; ++i)
+		{
+			ranks_[i] = rank;
+			rank += qPopulationCount(words_[i]);
+		}
+
+		return rank;
+	}
+
+	/**
+	 * Returns the position of a color in the set, in ascending order. This
+	 * is only valid after calling buildRanks().
+	 */
+	quint32 rank(QRgb rgb) const
+	{
+		const auto lowerBits = words_[rgb >> 6] & ((quint64(1) << (rgb & 63)) - 1);
+		return ranks_[rgb >> 6] + qPopulationCount(lowerBits);
+	}
+
+private:
+	static constexpr qsizetype WORD_COUNT = (qsizetype(1) << 24) / 64;
+
+	std::vector<quint64> words_;
+	std::vector<quint32> ranks_;
+};
+
+/**
+ * Returns the number of strips to split an image into for scanning it in
+ * parallel.
+ */
+int scanStripCount(const QImage& image)
+{
+	const auto pixels = qsizetype(image.width()) * image.height();
+	const auto maxStrips = qMin(qMin(QThread::idealThreadCount(), PARALLEL_SCAN_MAX_THREADS),
+								image.height());
+
+	return int(qMax<qsizetype>(1, qMin<qsizetype>(maxStrips, pixels / PARALLEL_SCAN_MIN_PIXELS)));
+}
+
+/**
+ * Processes horizontal strips of an image in parallel on the global thread
+ * pool, and waits for all of them to be done. The calling thread processes
+ * the first strip, as well as any strips the pool hasn't started yet.
+ *
+ * Strips are processed one after another when called from a thread of the
+ * global pool, since they would only be competing with the caller for the
+ * same threads.
+ *
+ * @param height       Image height.
+ * @param strips       Number of strips.
+ * @param function     Callable taking a strip number, and the first and last
+ *                     (exclusive) scanlines in the strip.
+ */
+template<typename Function>
+void forEachStrip(int height, int strips, Function function)
+{
+	const auto stripBegin = [height, strips](int strip) {
+		return int(qint64(height) * strip / strips);
+	};
+
+	auto* pool = QThreadPool::globalInstance();
+
+	if (strips <= 1 || pool->contains(QThread::currentThread())) {
+		for (int k = 0; k < strips; ++k)
+		{
+			function(k, stripBegin(k), stripBegin(k + 1));
+		}
+		return;
+	}
+
+	QSemaphore done;
+	std::vector<std::unique_ptr<QRunnable>> tasks;
+
+	for (int k = 1; k < strips; ++k)
+	{
+		auto& task = tasks.emplace_back(QRunnable::create([&function, &stripBegin, &done, k]() {
+			function(k, stripBegin(k), stripBegin(k + 1));
+			done.release();
+		}));
+
+		task->setAutoDelete(false);
+		pool->start(task.get());
+	}
+
+	function(0, 0, stripBegin(1));
+
+	for (auto& task : tasks)
+	{
+		if (pool->tryTake(task.get()))
+			task->run();
+	}
+
+	done.acquire(strips - 1);
+}
+
+/**
+ * Returns whether an image is large enough to be scanned for unique colors
+ * using colorBitsetFromImage() rather than colorCountsFromImage().
+ */
+bool useColorBitset(const QImage& image)
+{
+	return qsizetype(image.width()) * image.height() >= COLOR_BITSET_MIN_PIXELS;
+}
+
+/**
+ * Counts the pixels of each color in a small ARGB32 image, ignoring alpha.
+ */
+QHash<QRgb, qsizetype> colorCountsFromImage(const QImage& input)
+{
+	QHash<QRgb, qsizetype> counts;
+
+	// Runs of the same color are counted before touching the hash table
+	QRgb runRgb = 0;
+	qsizetype runLength = 0;
+
+	for (int y = 0; y < input.height(); ++y)
+	{
+		const auto* line = reinterpret_cast<const QRgb*>(input.constScanLine(y));
+		for (int x = 0; x < input.width(); ++x)
+		{
+			const auto rgb = line[x] & 0xFFFFFFU;
+
+			if (rgb == runRgb && runLength) {
+				++runLength;
+				continue;
+			}
+
+			if (runLength)
+				counts[runRgb] += runLength;
+
+			runRgb = rgb;
+			runLength = 1;
+		}
+	}
+
+	if (runLength)
+		counts[runRgb] += runLength;
+
+	return counts;
+}
+
+/**
+ * Collects the unique colors of an ARGB32 image into a bitset.
+ */
+ColorBitset colorBitsetFromImage(const QImage& input)
+{
+	const auto strips = scanStripCount(input);
+	const auto maxX = input.width();
+
+	// One bitset per strip, merged into the first one at the end
+	std::vector<ColorBitset> bitsets(strips);
+
+	forEachStrip(input.height(), strips, [&input, &bitsets, maxX](int strip, int beginY, int endY) {
+		auto& bitset = bitsets[strip];
+
+		// Skipping runs of the same color saves a lot of random memory
+		// accesses on sprites
+		QRgb lastRgb = 0xFFFFFFFFU;
+
+		for (int y = beginY; y < endY; ++y)
+		{
+			const auto* line = reinterpret_cast<const QRgb*>(input.constScanLine(y));
+			for (int x = 0; x < maxX; ++x)
+			{
+				const auto rgb = line[x] & 0xFFFFFFU;
+
+				if (rgb != lastRgb) {
+					lastRgb = rgb;
+					bitset.insert(rgb);
+				}
+			}
+		}
+	});
+
+	for (int k = 1; k < strips; ++k)
+	{
+		bitsets.front().unite(bitsets[k]);
+	}
+
+	return std::move(bitsets.front());
+}
+
+/**
+ * Builds the color histogram of an Indexed8 image, which only requires
+ * counting color table indices.
+ */
+ColorHistogram indexedColorHistogram(const QImage& input)
+{
+	std::array<qsizetype, 256> indexCounts{};
+
+	auto maxY = input.height(), maxX = input.width();
+
+	for (int y = 0; y < maxY; ++y)
+	{
+		const auto* line = input.constScanLine(y);
+		for (int x = 0; x < maxX; ++x)
+		{
+			++indexCounts[line[x]];
+		}
+	}
+
+	// Let QImage resolve the color of every possible index, so that indices
+	// beyond the end of the color table (or a missing color table) are
+	// handled exactly as they would be by converting the image to ARGB32.
+	QImage indexColors{256, 1, QImage::Format_Indexed8};
+
+	indexColors.setColorTable(input.colorTable());
+
+	for (int i = 0; i < 256; ++i)
+	{
+		indexColors.scanLine(0)[i] = uchar(i);
+	}
+
+	indexColors.convertTo(QImage::Format_ARGB32);
+
+	const auto* colors = reinterpret_cast<const QRgb*>(indexColors.constScanLine(0));
+
+	// Different indices may share the same color
+	QMap<QRgb, qsizetype> colorCounts;
+
+	for (int i = 0; i < 256; ++i)
+	{
+		if (indexCounts[i] != 0)
+			colorCounts[colors[i] & 0xFFFFFFU] += indexCounts[i];
+	}
+
+	ColorHistogram ret;
+
+	ret.colors = colorCounts.keys();
+	ret.counts = colorCounts.values();
+
+	return ret;
+}
+
+/**
+ * Recolors a list of colors in-place using a compiled color map.
+ */
+void recolorColors(QRgb* colors, qsizetype count, const CompiledColorMap& colorMap)
+{
+	for (qsizetype i = 0; i < count; ++i)
+	{
+		QRgb value;
+
+		// Match found, replace everything except alpha
+		if (colorMap.find(colors[i] & 0xFFFFFFU, value))
+			colors[i] = (colors[i] & 0xFF000000U) | value;
+	}
+}
+
+/**
+ * Recolors a scanline of ARGB32 pixels in-place using a compiled color map.
+ */
+void recolorLine(QRgb* line, qsizetype count, const CompiledColorMap& colorMap)
+{
+	// Sprites tend to have long runs of the same color (especially fully
+	// transparent areas), so we remember the last lookup's result.
+	QRgb lastKey = 0xFFFFFFFFU, lastValue = 0;
+	bool lastFound = false;
+
+	for (qsizetype i = 0; i < count; ++i)
+	{
+		const auto key = line[i] & 0xFFFFFFU;
+
+		if (key != lastKey) {
+			lastKey = key;
+			lastFound = colorMap.find(key, lastValue);
 		}
 
-		mapRgb[color] = qRgb(qBound(0, r, 255),
-							 qBound(0, g, 255),
-							 qBound(0, b, 255));
+		if (!lastFound)
+			continue;
+
+		// Match found, replace everything except alpha
+		line[i] = (line[i] & 0xFF000000U) | lastValue;
+	}
+}
+
+} // end unnamed namespace #1
+
+ColorMap ColorRange::applyToPalette(const ColorList& palette) const
+{
+	ColorMap mapRgb;
+
+	// Map first color in vector to exact new color
+	const QRgb referenceColor = palette.empty() ? 0 : palette.front();
+
+	for (auto color : palette)
+	{
+		mapRgb[color] = applyToColor(referenceColor, color);
 	}
 
 	return mapRgb;
@@ -197,168 +594,1130 @@ QString wmlFromColorList(const QString& name,
 	return code;
 }
 
-ColorSet uniqueColorsFromImage(const QImage& input)
+QImage toWorkingFormat(const QImage& input)
 {
-	QImage rgbaInput;
+	if (input.format() == QImage::Format_Indexed8)
+		return input;
 
-	// Force ARGB32 since that's the only format we (and Wesnoth) currently
-	// undertand.
-	rgbaInput = input.convertToFormat(QImage::Format_ARGB32);
+	MOS_TRACE_SPAN("convert", "convertToFormat", input.size());
 
-	ColorSet res;
+	return input.convertToFormat(QImage::Format_ARGB32);
+}
 
-	auto maxY = rgbaInput.height(), maxX = rgbaInput.width();
+QImage toIndexedImage(const QImage& input)
+{
+	MOS_TRACE_SPAN("convert", "toIndexedImage", input.size());
 
-	for (int y = 0; y < maxY; ++y)
-	{
-		const auto* line = reinterpret_cast<const QRgb*>(rgbaInput.constScanLine(y));
-		for (int x = 0; x < maxX; ++x)
-		{
-			res << (line[x] & 0xFFFFFFU);
-		}
-	}
+	if (input.format() == QImage::Format_Indexed8)
+		return input;
 
-	return res;
-}
+	const auto source = input.convertToFormat(QImage::Format_ARGB32);
+	auto output = blankImageLike(source, QImage::Format_Indexed8);
 
-QImage recolorImage(const QImage& input,
-					const ColorMap& colorMap)
-{
-	QImage output;
+	// Open addressing hash table mapping colors to color table indices, which
+	// is never more than half full
+	constexpr int HASH_BITS = 9;
+	constexpr quint32 HASH_MASK = (1U << HASH_BITS) - 1;
 
-	// Copy input to output first. We force ARGB32 since that's the only
-	// format we (and Wesnoth) currently understand.
-	output = input.convertToFormat(QImage::Format_ARGB32);
+	std::array<QRgb, 1U << HASH_BITS> hashKeys;
+	std::array<qint16, 1U << HASH_BITS> hashIndices;
+	hashIndices.fill(-1);
 
-	// Create a version of the color map without alpha values for faster
-	// lookups.
-	ColorMap plainRgbMap;
+	ColorList colorTable;
+	colorTable.reserve(256);
 
-	for (auto i = colorMap.begin(); i != colorMap.end(); ++i)
-		plainRgbMap[i.key() & 0xFFFFFFU] = i.value() & 0xFFFFFFU;
+	const auto maxY = source.height(), maxX = source.width();
 
-	auto maxY = output.height(), maxX = output.width();
+	// Sprites tend to have long runs of the same color, so we remember the
+	// last lookup's result.
+	QRgb lastRgb = 0;
+	int lastIndex = -1;
 
 	for (int y = 0; y < maxY; ++y)
 	{
-		auto* line = reinterpret_cast<QRgb*>(output.scanLine(y));
+		const auto* in = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+		auto* out = output.scanLine(y);
+
 		for (int x = 0; x < maxX; ++x)
 		{
-			auto i = plainRgbMap.find(line[x] & 0xFFFFFFU);
+			const auto rgb = in[x];
 
-			if (i == plainRgbMap.end())
-				continue;
+			if (rgb != lastRgb || lastIndex < 0) {
+				auto slot = (rgb * 0x9E3779B1U) >> (32 - HASH_BITS);
 
-			// Match found, replace everything except alpha
-			line[x] = (line[x] & 0xFF000000U) + i.value();
+				while (hashIndices[slot] >= 0 && hashKeys[slot] != rgb)
+				{
+					slot = (slot + 1) & HASH_MASK;
+				}
+
+				if (hashIndices[slot] < 0) {
+					if (colorTable.size() == 256)
+						return {};
+
+					hashKeys[slot] = rgb;
+					hashIndices[slot] = qint16(colorTable.size());
+					colorTable.push_back(rgb);
+				}
+
+				lastRgb = rgb;
+				lastIndex = hashIndices[slot];
+			}
+
+			out[x] = uchar(lastIndex);
 		}
 	}
 
+	output.setColorTable(colorTable);
+
 	return output;
 }
 
-QImage colorBlendImage(const QImage& input,
-					   const QColor& color,
-					   qreal blendFactor)
+ColorSet uniqueColorsFromImage(const QImage& input)
 {
-	QImage output;
+	MOS_TRACE_SPAN("analyze", "uniqueColorsFromImage", input.size());
 
-	// Copy input to output first. We force ARGB32 since that's the only
-	// format we (and Wesnoth) currently understand.
-	output = input.convertToFormat(QImage::Format_ARGB32);
+	const auto source = toWorkingFormat(input);
 
-	blendFactor = qBound(0.0, blendFactor, 1.0);
+	if (source.format() == QImage::Format_Indexed8) {
+		const auto histogram = indexedColorHistogram(source);
+		return ColorSet{histogram.colors.cbegin(), histogram.colors.cend()};
+	}
 
-	if (blendFactor == 0.0)
-		return output;
+	if (!useColorBitset(source)) {
+		const auto& counts = colorCountsFromImage(source);
+		return ColorSet{counts.keyBegin(), counts.keyEnd()};
+	}
 
-	// Formula from Wesnoth src/sdl/utils.cpp blend_surface()
+	const auto bitset = colorBitsetFromImage(source);
 
-	quint16 ratio = blendFactor * 256;
+	ColorSet res;
 
-	quint16 redShift = ratio * color.red();
-	quint16 greenShift = ratio * color.green();
-	quint16 blueShift = ratio * color.blue();
+	res.reserve(bitset.count());
 
-	ratio = 256 - ratio;
+	bitset.forEach([&res](QRgb rgb) {
+		res << rgb;
+	});
 
-	auto maxY = output.height(), maxX = output.width();
+	return res;
+}
 
-	for (int y = 0; y < maxY; ++y)
-	{
-		auto* line = reinterpret_cast<QRgb*>(output.scanLine(y));
+ColorList ColorHistogram::mostFrequentColors() const
+{
+	QList<qsizetype> order(colors.count());
 
-		for (int x = 0; x < maxX; ++x)
-		{
-			if (blendFactor == 1.0) {
-				line[x] = (line[x] & 0xFF000000U) +
-						  (color.rgb() & 0xFFFFFFU);
-				continue;
-			}
+	std::iota(order.begin(), order.end(), 0);
 
-			quint8 r = (ratio * static_cast<quint8>(line[x] >> 16) + redShift) >> 8;
-			quint8 g = (ratio * static_cast<quint8>(line[x] >> 8) + greenShift) >> 8;
-			quint8 b = (ratio * static_cast<quint8>(line[x]) + blueShift) >> 8;
+	// Colors are already in ascending order, which a stable sort preserves
+	// for colors with the same pixel count.
+	std::stable_sort(order.begin(), order.end(), [this](qsizetype a, qsizetype b) {
+		return counts[a] > counts[b];
+	});
 
-			line[x] = (line[x] & 0xFF000000U) | (r << 16) | (g << 8) | b;
-		}
+	ColorList ret;
+
+	ret.reserve(order.count());
+
+	for (auto i : order)
+	{
+		ret.push_back(colors[i]);
 	}
 
-	return output;
+	return ret;
 }
 
-QImage colorShiftImage(const QImage& input,
-					   int redShift,
-					   int greenShift,
-					   int blueShift)
+ColorHistogram colorHistogramFromImage(const QImage& input)
 {
-	QImage output;
-
-	// Copy input to output first. We force ARGB32 since that's the only
-	// format we (and Wesnoth) currently understand.
-	output = input.convertToFormat(QImage::Format_ARGB32);
-
-	if (redShift == 0 && greenShift == 0 && blueShift == 0)
-		return output;
+	MOS_TRACE_SPAN("analyze", "colorHistogramFromImage", input.size());
 
-	// Formula from Wesnoth src/sdl/utils.cpp adjust_surface_color()
+	const auto source = toWorkingFormat(input);
 
-	auto maxY = output.height(), maxX = output.width();
+	if (source.format() == QImage::Format_Indexed8)
+		return indexedColorHistogram(source);
 
-	for (int y = 0; y < maxY; ++y)
-	{
-		auto* line = reinterpret_cast<QRgb*>(output.scanLine(y));
+	if (!useColorBitset(source)) {
+		const auto& counts = colorCountsFromImage(source);
 
-		for (int x = 0; x < maxX; ++x)
-		{
-			auto alpha = line[x] & 0xFF000000U;
+		ColorHistogram ret;
 
-			if (alpha) {
+		ret.colors = ColorList{counts.keyBegin(), counts.keyEnd()};
+		std::sort(ret.colors.begin(), ret.colors.end());
 
-				auto r = qBound(0, qRed(line[x]) + redShift, 255);
-				auto g = qBound(0, qGreen(line[x]) + greenShift, 255);
-				auto b = qBound(0, qBlue(line[x]) + blueShift, 255);
+		ret.counts.reserve(ret.colors.count());
 
-				line[x] = (line[x] & 0xFF000000U) | (r << 16) | (g << 8) | b;
-			}
+		for (auto rgb : std::as_const(ret.colors))
+		{
+			ret.counts.push_back(counts.value(rgb));
 		}
+
+		return ret;
 	}
 
-	return output;
+	//
+	// Collect the unique colors first, so that each color can be given a
+	// counter in a compact array using its position in the bitset.
+	//
+
+	auto bitset = colorBitsetFromImage(source);
+	const auto colorCount = bitset.buildRanks();
+
+	ColorHistogram ret;
+
+	ret.colors.reserve(colorCount);
+
+	bitset.forEach([&ret](QRgb rgb) {
+		ret.colors.push_back(rgb);
+	});
+
+	// Images with lots of colors need fewer threads to keep the memory used
+	// by the per-thread counters in check
+	const auto countersSize = qsizetype(sizeof(qsizetype)) * qMax<qsizetype>(1, colorCount);
+	const auto strips = int(qMax<qsizetype>(1, qMin<qsizetype>(scanStripCount(source),
+																 PARALLEL_COUNT_MAX_MEMORY / countersSize)));
+	const auto maxX = source.width();
+
+	std::vector<std::vector<qsizetype>> stripCounts(strips, std::vector<qsizetype>(colorCount, 0));
+
+	forEachStrip(source.height(), strips, [&source, &bitset, &stripCounts, maxX](int strip, int beginY, int endY) {
+		auto* counts = stripCounts[strip].data();
+
+		QRgb lastRgb = 0xFFFFFFFFU;
+		quint32 lastRank = 0;
+
+		for (int y = beginY; y < endY; ++y)
+		{
+			const auto* line = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+			for (int x = 0; x < maxX; ++x)
+			{
+				const auto rgb = line[x] & 0xFFFFFFU;
+
+				if (rgb != lastRgb) {
+					lastRgb = rgb;
+					lastRank = bitset.rank(rgb);
+				}
+
+				++counts[lastRank];
+			}
+		}
+	});
+
+	ret.counts = QList<qsizetype>(stripCounts.front().cbegin(), stripCounts.front().cend());
+
+	for (int k = 1; k < strips; ++k)
+	{
+		const auto& counts = stripCounts[k];
+
+		for (quint32 i = 0; i < colorCount; ++i)
+		{
+			ret.counts[i] += counts[i];
+		}
+	}
+
+	return ret;
+}
+
+CompiledColorMap::CompiledColorMap()
+	: slots_(2, {EMPTY_SLOT, 0})
+	, mask_(1)
+	, shift_(31)
+	, count_(0)
+{
+	// A minimal table with empty slots only ensures lookups always terminate.
+}
+
+CompiledColorMap::CompiledColorMap(const ColorMap& colorMap)
+	: CompiledColorMap()
+{
+	if (colorMap.isEmpty())
+		return;
+
+	// Keep the load factor at or below 1/4 so that the common case (a color
+	// that is not in the map) almost always terminates on the first probe.
+	quint32 bits = 4;
+
+	while ((quint32(1) << bits) < quint32(colorMap.count()) * 4)
+		++bits;
+
+	slots_ = QList<Slot>(qsizetype(1) << bits, {EMPTY_SLOT, 0});
+	mask_ = (quint32(1) << bits) - 1;
+	shift_ = 32 - bits;
+
+	auto* slots = slots_.data();
+
+	for (auto i = colorMap.cbegin(); i != colorMap.cend(); ++i)
+	{
+		const auto key = i.key() & 0xFFFFFFU;
+		auto k = slotIndex(key);
+
+		while (slots[k].key != EMPTY_SLOT && slots[k].key != key)
+			k = (k + 1) & mask_;
+
+		// Keys differing only in alpha collapse into a single entry, with the
+		// last one winning (same as the original QMap-based implementation).
+		if (slots[k].key == EMPTY_SLOT)
+			++count_;
+
+		slots[k] = {key, i.value() & 0xFFFFFFU};
+	}
+}
+
+ColorList CompiledColorMap::keys() const
+{
+	ColorList ret;
+
+	ret.reserve(count_);
+
+	for (const auto& slot : slots_)
+	{
+		if (slot.key != EMPTY_SLOT)
+			ret.push_back(slot.key);
+	}
+
+	return ret;
+}
+
+QImage recolorImage(const QImage& input,
+					const ColorMap& colorMap)
+{
+	return recolorImage(input, CompiledColorMap{colorMap});
+}
+
+QImage recolorImage(const QImage& input,
+					const CompiledColorMap& colorMap)
+{
+	MOS_TRACE_SPAN("recolor", "recolorImage", input.size());
+
+	QImage output;
+
+	// Copy input to output first. Indexed8 images are left as they are.
+	output = toWorkingFormat(input);
+
+	if (colorMap.isEmpty())
+		return output;
+
+	if (output.format() == QImage::Format_Indexed8) {
+		return transformColorTable(output, [&colorMap](QRgb* colors, qsizetype count) {
+			recolorColors(colors, count, colorMap);
+		});
+	}
+
+	auto maxY = output.height(), maxX = output.width();
+
+	for (int y = 0; y < maxY; ++y)
+	{
+		auto* line = reinterpret_cast<QRgb*>(output.scanLine(y));
+		recolorLine(line, maxX, colorMap);
+	}
+
+	return output;
+}
+
+ColorMapCache::ColorMapCache()
+	: colorRangeMaps_()
+	, paletteSwapMaps_()
+{
+}
+
+CompiledColorMap ColorMapCache::colorRangeMap(const ColorRange& colorRange,
+											  const ColorList& palette)
+{
+	const ColorRangeKey key{colorRange, palette};
+
+	if (auto it = colorRangeMaps_.constFind(key); it != colorRangeMaps_.constEnd())
+		return it.value();
+
+	if (colorRangeMaps_.count() >= MAX_ENTRIES)
+		colorRangeMaps_.clear();
+
+	ColorMap sourceMap;
+
+	if (!wesnoth::precomputedColorMap(colorRange, palette, sourceMap))
+		sourceMap = colorRange.applyToPalette(palette);
+
+	CompiledColorMap colorMap{sourceMap};
+	colorRangeMaps_.insert(key, colorMap);
+
+	return colorMap;
+}
+
+CompiledColorMap ColorMapCache::paletteSwapMap(const ColorList& srcPalette,
+											   const ColorList& newPalette)
+{
+	const PaletteSwapKey key{srcPalette, newPalette};
+
+	if (auto it = paletteSwapMaps_.constFind(key); it != paletteSwapMaps_.constEnd())
+		return it.value();
+
+	if (paletteSwapMaps_.count() >= MAX_ENTRIES)
+		paletteSwapMaps_.clear();
+
+	CompiledColorMap colorMap{generateColorMap(srcPalette, newPalette)};
+	paletteSwapMaps_.insert(key, colorMap);
+
+	return colorMap;
+}
+
+void ColorMapCache::clear()
+{
+	colorRangeMaps_.clear();
+	paletteSwapMaps_.clear();
+}
+
+KeyColorIndex::KeyColorIndex()
+	: image_()
+	, keys_()
+	, spans_()
+	, pixelKeys_()
+	, tableKeys_()
+	, pixelCount_(0)
+{
+}
+
+KeyColorIndex::KeyColorIndex(const QImage& input, const ColorList& keyColors)
+	: image_(toWorkingFormat(input))
+	, keys_(keyColors)
+	, spans_()
+	, pixelKeys_()
+	, tableKeys_()
+	, pixelCount_(0)
+{
+	MOS_TRACE_SPAN("recolor", "KeyColorIndex", image_.size());
+
+	ColorMap keyPositions;
+
+	for (qsizetype k = keys_.count() - 1; k >= 0; --k)
+	{
+		// Iterating backwards makes the first occurrence of a duplicate win
+		keyPositions.insert(keys_[k] & 0xFFFFFFU, QRgb(k));
+	}
+
+	const CompiledColorMap keyLookup{keyPositions};
+
+	auto maxY = image_.height(), maxX = image_.width();
+
+	if (image_.format() == QImage::Format_Indexed8) {
+		const auto colorTable = image_.colorTable();
+
+		tableKeys_.reserve(colorTable.count());
+
+		for (auto color : colorTable)
+		{
+			QRgb position;
+			tableKeys_.push_back(keyLookup.find(color & 0xFFFFFFU, position)
+								 ? position : NO_KEY);
+		}
+
+		// Matching pixels only need to be counted, not indexed
+		std::array<qsizetype, 256> histogram{};
+
+		for (int y = 0; y < maxY; ++y)
+		{
+			const auto* line = image_.constScanLine(y);
+			for (int x = 0; x < maxX; ++x)
+			{
+				++histogram[line[x]];
+			}
+		}
+
+		for (qsizetype i = 0; i < tableKeys_.count(); ++i)
+		{
+			if (tableKeys_[i] != NO_KEY)
+				pixelCount_ += histogram[i];
+		}
+
+		return;
+	}
+
+	QRgb lastKey = 0xFFFFFFFFU, lastPosition = 0;
+	bool lastFound = false;
+
+	for (int y = 0; y < maxY; ++y)
+	{
+		const auto* line = reinterpret_cast<const QRgb*>(image_.constScanLine(y));
+		for (int x = 0; x < maxX; ++x)
+		{
+			const auto key = line[x] & 0xFFFFFFU;
+
+			if (key != lastKey) {
+				lastKey = key;
+				lastFound = keyLookup.find(key, lastPosition);
+			}
+
+			if (!lastFound)
+				continue;
+
+			if (!spans_.isEmpty() &&
+				spans_.back().y == y &&
+				spans_.back().x + spans_.back().length == x)
+			{
+				++spans_.back().length;
+			} else {
+				spans_.push_back({x, y, 1});
+			}
+
+			pixelKeys_.push_back(lastPosition);
+		}
+	}
+
+	pixelCount_ = pixelKeys_.count();
+}
+
+bool KeyColorIndex::matches(const QImage& input, const ColorList& keyColors) const
+{
+	return !image_.isNull() &&
+		   image_.cacheKey() == input.cacheKey() &&
+		   keys_ == keyColors;
+}
+
+QImage KeyColorIndex::recolor(const CompiledColorMap& colorMap) const
+{
+	MOS_TRACE_SPAN("recolor", "KeyColorIndex::recolor", image_.size());
+
+	// Starts out sharing data with the original, and we only pay for a copy
+	// if we actually have something to change.
+	QImage output = image_;
+
+	if (pixelCount_ == 0 || colorMap.isEmpty())
+		return output;
+
+	static constexpr QRgb UNMAPPED = 0xFFFFFFFFU;
+
+	QList<QRgb> values(keys_.count(), UNMAPPED);
+
+	for (qsizetype k = 0; k < keys_.count(); ++k)
+	{
+		colorMap.find(keys_[k], values[k]);
+	}
+
+	if (output.format() == QImage::Format_Indexed8) {
+		auto colorTable = output.colorTable();
+
+		for (qsizetype i = 0; i < tableKeys_.count(); ++i)
+		{
+			const auto position = tableKeys_[i];
+
+			// Match found, replace everything except alpha
+			if (position != NO_KEY && values[position] != UNMAPPED)
+				colorTable[i] = (colorTable[i] & 0xFF000000U) | values[position];
+		}
+
+		output.setColorTable(colorTable);
+
+		return output;
+	}
+
+	auto* bits = output.bits();
+	const auto bytesPerLine = output.bytesPerLine();
+	const auto* pixelKey = pixelKeys_.constData();
+	const auto* valueData = values.constData();
+
+	for (const auto& span : spans_)
+	{
+		auto* line = reinterpret_cast<QRgb*>(bits + span.y * bytesPerLine) + span.x;
+
+		for (int x = 0; x < span.length; ++x)
+		{
+			const auto value = valueData[*pixelKey++];
+
+			// Match found, replace everything except alpha
+			if (value != UNMAPPED)
+				line[x] = (line[x] & 0xFF000000U) | value;
+		}
+	}
+
+	return output;
+}
+
+QList<QImage> recolorImages(const QImage& input,
+						   const QList<CompiledColorMap>& colorMaps)
+{
+	MOS_TRACE_SPAN("recolor", "recolorImages", input.size());
+
+	const auto source = toWorkingFormat(input);
+	const auto mapCount = colorMaps.count();
+
+	QList<QImage> outputs;
+
+	if (mapCount == 0)
+		return outputs;
+
+	outputs.reserve(mapCount);
+
+	// Indexed8 images only need their color table recolored, which is cheap
+	// enough to do separately for every output.
+	if (source.format() == QImage::Format_Indexed8) {
+		for (const auto& colorMap : colorMaps)
+		{
+			outputs.emplaceBack(transformColorTable(source, [&colorMap](QRgb* colors, qsizetype count) {
+				recolorColors(colors, count, colorMap);
+			}));
+		}
+
+		return outputs;
+	}
+
+	for (qsizetype k = 0; k < mapCount; ++k)
+	{
+		outputs.emplaceBack(blankImageLike(source));
+	}
+
+	//
+	// Build a single lookup table for the union of all the key colors, which
+	// gives us a row of per-output replacement values for every key. This
+	// way each pixel only needs to be looked up once no matter how many color
+	// maps we were given.
+	//
+
+	static constexpr QRgb UNMAPPED = 0xFFFFFFFFU;
+
+	ColorMap keyRows;
+
+	for (const auto& colorMap : colorMaps)
+	{
+		for (auto key : colorMap.keys())
+		{
+			keyRows.insert(key, 0);
+		}
+	}
+
+	QRgb rowCount = 0;
+
+	for (auto& row : keyRows)
+	{
+		row = rowCount++;
+	}
+
+	const CompiledColorMap keyIndex{keyRows};
+	QList<QRgb> rows(qsizetype(rowCount) * mapCount, UNMAPPED);
+
+	for (auto i = keyRows.cbegin(); i != keyRows.cend(); ++i)
+	{
+		auto* row = rows.data() + i.value() * mapCount;
+
+		for (qsizetype k = 0; k < mapCount; ++k)
+		{
+			colorMaps[k].find(i.key(), row[k]);
+		}
+	}
+
+	//
+	// Scatter results to every output, one scanline at a time so that the
+	// source scanline only needs to be read from memory once.
+	//
+
+	auto maxY = source.height(), maxX = source.width();
+	const auto lineSize = sizeof(QRgb) * maxX;
+
+	QVarLengthArray<QRgb*, 32> outLines(mapCount);
+
+	QRgb lastKey = 0xFFFFFFFFU, lastRow = 0;
+	bool lastFound = false;
+
+	for (int y = 0; y < maxY; ++y)
+	{
+		const auto* line = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+
+		for (qsizetype k = 0; k < mapCount; ++k)
+		{
+			outLines[k] = reinterpret_cast<QRgb*>(outputs[k].scanLine(y));
+			std::memcpy(outLines[k], line, lineSize);
+		}
+
+		for (int x = 0; x < maxX; ++x)
+		{
+			const auto key = line[x] & 0xFFFFFFU;
+
+			if (key != lastKey) {
+				lastKey = key;
+				lastFound = keyIndex.find(key, lastRow);
+			}
+
+			if (!lastFound)
+				continue;
+
+			const auto alpha = line[x] & 0xFF000000U;
+			const auto* row = rows.constData() + lastRow * mapCount;
+
+			for (qsizetype k = 0; k < mapCount; ++k)
+			{
+				// Keys missing from individual maps are left untouched
+				if (row[k] != UNMAPPED)
+					outLines[k][x] = alpha | row[k];
+			}
+		}
+	}
+
+	return outputs;
+}
+
+QImage colorBlendImage(const QImage& input,
+					   const QColor& color,
+					   qreal blendFactor)
+{
+	MOS_TRACE_SPAN("recolor", "colorBlendImage", input.size());
+
+	QImage output;
+
+	// Copy input to output first. Indexed8 images are left as they are.
+	output = toWorkingFormat(input);
+
+	blendFactor = qBound(0.0, blendFactor, 1.0);
+
+	if (blendFactor == 0.0)
+		return output;
+
+	// Formula from Wesnoth src/sdl/utils.cpp blend_surface(). Note that a
+	// blend factor of 1.0 needs no special handling, as a ratio of 256 yields
+	// the blend color exactly.
+
+	const quint16 ratio = blendFactor * 256;
+	const QRgb rgb = color.rgb();
+
+	if (output.format() == QImage::Format_Indexed8) {
+		return transformColorTable(output, [rgb, ratio](QRgb* colors, qsizetype count) {
+			MosKernels::colorBlendLine(colors, count, rgb, ratio);
+		});
+	}
+
+	auto maxY = output.height(), maxX = output.width();
+
+	for (int y = 0; y < maxY; ++y)
+	{
+		auto* line = reinterpret_cast<QRgb*>(output.scanLine(y));
+		MosKernels::colorBlendLine(line, maxX, rgb, ratio);
+	}
+
+	return output;
+}
+
+QImage colorShiftImage(const QImage& input,
+					   int redShift,
+					   int greenShift,
+					   int blueShift)
+{
+	MOS_TRACE_SPAN("recolor", "colorShiftImage", input.size());
+
+	QImage output;
+
+	// Copy input to output first. Indexed8 images are left as they are.
+	output = toWorkingFormat(input);
+
+	if (redShift == 0 && greenShift == 0 && blueShift == 0)
+		return output;
+
+	// Formula from Wesnoth src/sdl/utils.cpp adjust_surface_color()
+
+	if (output.format() == QImage::Format_Indexed8) {
+		return transformColorTable(output, [redShift, greenShift, blueShift](QRgb* colors, qsizetype count) {
+			MosKernels::colorShiftLine(colors, count, redShift, greenShift, blueShift);
+		});
+	}
+
+	auto maxY = output.height(), maxX = output.width();
+
+	for (int y = 0; y < maxY; ++y)
+	{
+		auto* line = reinterpret_cast<QRgb*>(output.scanLine(y));
+		MosKernels::colorShiftLine(line, maxX, redShift, greenShift, blueShift);
+	}
+
+	return output;
+}
+
+namespace {
+
+/**
+ * Number of pixels processed by each function in an image path function
+ * chain before moving on to the next function, chosen so that a block stays
+ * in the L1 cache.
+ */
+constexpr qsizetype FUSED_BLOCK_SIZE = 1024;
+
+/**
+ * Parses a comma-separated list of hex colors, as accepted by Wesnoth.
+ */
+bool parseColorList(const QString& str, ColorList& colors)
+{
+	colors.clear();
+
+	const auto& values = str.split(',', Qt::SkipEmptyParts);
+
+	for (auto value : values)
+	{
+		value = value.trimmed();
+
+		if (value.startsWith('#'))
+			value.remove(0, 1);
+
+		bool ok = false;
+		const auto rgb = value.toUInt(&ok, 16);
+
+		if (!ok || value.length() != 6)
+			return false;
+
+		colors.emplaceBack(rgb);
+	}
+
+	return !colors.isEmpty();
+}
+
+/**
+ * Looks up a palette by id, or parses it as a list of colors.
+ */
+bool lookupPalette(const QString& id,
+				   const QMap<QString, ColorList>& palettes,
+				   ColorList& palette)
+{
+	auto it = palettes.constFind(id);
+
+	if (it != palettes.constEnd()) {
+		palette = it.value();
+		return true;
+	}
+
+	return parseColorList(id, palette);
+}
+
+/**
+ * Looks up a color range by id or side number, or parses it as a list of
+ * colors.
+ */
+bool lookupColorRange(const QString& id,
+					  const QMap<QString, ColorRange>& colorRanges,
+					  ColorRange& colorRange)
+{
+	auto rangeId = id;
+	bool isSide = false;
+	const auto side = id.toInt(&isSide);
+
+	// Side numbers always refer to Wesnoth's default team colors
+	if (isSide) {
+		const auto& sideColors = wesnoth::builtinColorRanges.orderedNames();
+
+		if (side < 1 || side > sideColors.count())
+			return false;
+
+		rangeId = sideColors[side - 1];
+	}
+
+	auto it = colorRanges.constFind(rangeId);
+
+	if (it != colorRanges.constEnd()) {
+		colorRange = it.value();
+		return true;
+	}
+
+	if (isSide) {
+		colorRange = wesnoth::builtinColorRanges[rangeId];
+		return true;
+	}
+
+	ColorList colors;
+
+	if (!parseColorList(id, colors) || colors.count() < 3 || colors.count() > 4)
+		return false;
+
+	colorRange = ColorRange{colors[0], colors[1], colors[2],
+							colors.count() > 3 ? colors[3] : colors[0]};
+
+	return true;
+}
+
+/**
+ * Parses a list of integers.
+ */
+bool parseIntList(const QString& str, QList<int>& values)
+{
+	values.clear();
+
+	const auto& items = str.split(',');
+
+	for (const auto& item : items)
+	{
+		bool ok = false;
+		values.push_back(item.trimmed().toInt(&ok));
+
+		if (!ok)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Returns a color map equivalent to applying two color maps in sequence.
+ */
+CompiledColorMap composeColorMaps(const CompiledColorMap& first,
+								  const CompiledColorMap& second)
+{
+	ColorMap composite;
+
+	for (const auto key : first.keys())
+	{
+		QRgb value = key;
+		first.find(key, value);
+		second.find(value, value);
+		composite.insert(key, value);
+	}
+
+	for (const auto key : second.keys())
+	{
+		if (composite.contains(key))
+			continue;
+
+		QRgb value = key;
+		second.find(key, value);
+		composite.insert(key, value);
+	}
+
+	return CompiledColorMap{composite};
+}
+
+} // end unnamed namespace #2
+
+ImagePathFunctionChain::ImagePathFunctionChain()
+	: steps_()
+{
+}
+
+bool ImagePathFunctionChain::parse(const QString& functions,
+								   const QMap<QString, ColorRange>& colorRanges,
+								   const QMap<QString, ColorList>& palettes,
+								   QString* error)
+{
+	static const QRegularExpression functionRe{"~([A-Z]+)\\(([^)]*)\\)"};
+
+	const auto fail = [error](const QString& message) {
+		if (error)
+			*error = message;
+		return false;
+	};
+
+	// Like Wesnoth's modification_queue, ~RC() and ~PAL() run before any
+	// other functions regardless of where they appear in the chain
+	QList<Step> colorMapSteps, steps;
+	ColorMapCache colorMapCache;
+
+	for (qsizetype pos = 0; pos < functions.length();)
+	{
+		const auto& match = functionRe.match(functions, pos,
+											 QRegularExpression::NormalMatch,
+											 QRegularExpression::AnchorAtOffsetMatchOption);
+
+		if (!match.hasMatch())
+			return fail(QString{"Syntax error at \"%1\""}.arg(functions.mid(pos)));
+
+		pos = match.capturedEnd();
+
+		const auto& name = match.captured(1);
+		const auto& args = match.captured(2);
+
+		Step step{StepColorMap, {}, 0, 0, 0, 0, 0};
+
+		if (name == "RC" || name == "PAL") {
+			const auto& params = args.split('>');
+
+			if (params.count() != 2)
+				return fail(QString{"~%1() requires two arguments separated by '>'"}.arg(name));
+
+			ColorList srcPalette;
+
+			if (!lookupPalette(params[0].trimmed(), palettes, srcPalette))
+				return fail(QString{"Unknown palette: %1"}.arg(params[0]));
+
+			if (name == "RC") {
+				ColorRange colorRange;
+
+				if (!lookupColorRange(params[1].trimmed(), colorRanges, colorRange))
+					return fail(QString{"Unknown color range: %1"}.arg(params[1]));
+
+				step.colorMap = colorMapCache.colorRangeMap(colorRange, srcPalette);
+			} else {
+				ColorList newPalette;
+
+				if (!lookupPalette(params[1].trimmed(), palettes, newPalette))
+					return fail(QString{"Unknown palette: %1"}.arg(params[1]));
+
+				step.colorMap = colorMapCache.paletteSwapMap(srcPalette, newPalette);
+			}
+		} else if (name == "BLEND") {
+			const auto& params = args.split(',');
+			QList<int> rgb;
+
+			if (params.count() != 4 || !parseIntList(args.section(',', 0, 2), rgb))
+				return fail(QString{"Invalid ~BLEND() arguments: %1"}.arg(args));
+
+			// Formula from Wesnoth src/image_modifications.cpp blend_modification
+			auto opacityStr = params[3].trimmed();
+			const bool percentage = opacityStr.endsWith('%');
+			bool ok = false;
+
+			if (percentage)
+				opacityStr.chop(1);
+
+			auto opacity = opacityStr.toDouble(&ok);
+
+			if (!ok)
+				return fail(QString{"Invalid ~BLEND() opacity: %1"}.arg(params[3]));
+
+			if (percentage)
+				opacity /= 100.0;
+
+			step.type = StepColorBlend;
+			step.color = qRgb(qBound(0, rgb[0], 255),
+							  qBound(0, rgb[1], 255),
+							  qBound(0, rgb[2], 255));
+			// Same as colorBlendImage()
+			step.ratio = quint16(qBound(0.0, opacity, 1.0) * 256);
+		} else if (name == "CS" || name == "R" || name == "G" || name == "B") {
+			QList<int> shifts;
+
+			if (!parseIntList(args, shifts) || shifts.count() > (name == "CS" ? 3 : 1))
+				return fail(QString{"Invalid ~%1() arguments: %2"}.arg(name, args));
+
+			// ~CS() arguments are all optional, and ~R(), ~G() and ~B() are
+			// shorthands for ~CS() with a single channel
+			shifts.resize(3, 0);
+
+			if (name == "G") {
+				std::swap(shifts[0], shifts[1]);
+			} else if (name == "B") {
+				std::swap(shifts[0], shifts[2]);
+			}
+
+			step.type = StepColorShift;
+			step.redShift = qBound(-255, shifts[0], 255);
+			step.greenShift = qBound(-255, shifts[1], 255);
+			step.blueShift = qBound(-255, shifts[2], 255);
+		} else {
+			return fail(QString{"Unsupported image path function: ~%1()"}.arg(name));
+		}
+
+		appendStep(step.type == StepColorMap ? colorMapSteps : steps, step);
+	}
+
+	steps_ = colorMapSteps + steps;
+
+	return true;
+}
+
+void ImagePathFunctionChain::appendStep(QList<Step>& steps, const Step& step)
+{
+	switch (step.type)
+	{
+		case StepColorMap:
+			if (step.colorMap.isEmpty())
+				return;
+			if (!steps.isEmpty() && steps.back().type == StepColorMap) {
+				steps.back().colorMap = composeColorMaps(steps.back().colorMap, step.colorMap);
+				return;
+			}
+			break;
+		case StepColorBlend:
+			if (step.ratio == 0)
+				return;
+			break;
+		case StepColorShift:
+			if (step.redShift == 0 && step.greenShift == 0 && step.blueShift == 0)
+				return;
+			break;
+	}
+
+	steps.push_back(step);
+}
+
+QImage ImagePathFunctionChain::apply(const QImage& input) const
+{
+	MOS_TRACE_SPAN("recolor", "ImagePathFunctionChain::apply", input.size());
+
+	auto source = toWorkingFormat(input);
+
+	if (steps_.isEmpty())
+		return source;
+
+	if (source.format() == QImage::Format_Indexed8) {
+		return transformColorTable(source, [this](QRgb* colors, qsizetype count) {
+			applyToLine(colors, count);
+		});
+	}
+
+	auto output = blankImageLike(source);
+
+	// Each row is copied and transformed one block at a time, so every pixel
+	// is only read from and written to memory once regardless of the number
+	// of functions in the chain
+	const auto maxX = qsizetype(source.width());
+	const auto* inBits = source.constBits();
+	auto* outBits = output.bits();
+	const auto inStride = source.bytesPerLine(), outStride = output.bytesPerLine();
+
+	// Callers such as RecolorJobRunner may already be running several chains
+	// at once on their own threads
+	const auto strips = MosIO::SerialCompressionScope::isActive() ? 1 : scanStripCount(source);
+
+	forEachStrip(source.height(), strips, [&](int, int beginY, int endY) {
+		for (int y = beginY; y < endY; ++y)
+		{
+			const auto* in = reinterpret_cast<const QRgb*>(inBits + y * inStride);
+			auto* out = reinterpret_cast<QRgb*>(outBits + y * outStride);
+
+			for (qsizetype x = 0; x < maxX; x += FUSED_BLOCK_SIZE)
+			{
+				const auto count = qMin(FUSED_BLOCK_SIZE, maxX - x);
+
+				std::memcpy(out + x, in + x, count * sizeof(QRgb));
+				applyToLine(out + x, count);
+			}
+		}
+	});
+
+	return output;
+}
+
+void ImagePathFunctionChain::applyToLine(QRgb* line, qsizetype count) const
+{
+	for (const auto& step : steps_)
+	{
+		switch (step.type)
+		{
+			case StepColorMap:
+				recolorLine(line, count, step.colorMap);
+				break;
+			case StepColorBlend:
+				MosKernels::colorBlendLine(line, count, step.color, step.ratio);
+				break;
+			case StepColorShift:
+				MosKernels::colorShiftLine(line, count, step.redShift, step.greenShift, step.blueShift);
+				break;
+		}
+	}
 }
 
 namespace MosIO {
 
 static bool writeImageDeviceAgnostic(QImageWriter& out,
 									 QImage& input,
-									 bool vanityPlate = false)
+									 bool vanityPlate = false,
+									 PngProfile profile = PngProfileSmallest)
 {
 	static QString stamp = QString{"Wespal v%1"}.arg(MOS_VERSION);
 
 	if (vanityPlate)
 		out.setText("Software", stamp);
 
-	out.setCompression(100);
+	// Qt's PNG plugin maps 0-100 onto zlib's 0-9 compression levels using
+	// c * 9 / 91, so anything below 11 results in uncompressed output
+	switch (profile)
+	{
+		case PngProfileFast:
+			out.setCompression(20);
+			break;
+		case PngProfileBalanced:
+			out.setCompression(70);
+			break;
+		case PngProfileSmallest:
+			out.setCompression(100);
+			break;
+	}
 
 	// Images produced by reading GIMP XCFs can end up with a color space
 	// set that looks like the following:
@@ -374,28 +1733,154 @@ static bool writeImageDeviceAgnostic(QImageWriter& out,
 	// a seriously washed-out palette. We work around this by making sure
 	// that our output never has a color space transform attached.
 
-	input.setColorSpace({});
+	{
+		MOS_TRACE_SPAN("convert", "setColorSpace", input.size());
+		input.setColorSpace({});
+	}
+
+	MOS_TRACE_SPAN("encode", "QImageWriter::write", input.size());
 
 	return out.write(input);
 }
 
-bool writePng(QImage& input, const QString& fileName, bool vanityPlate)
+/**
+ * Writes a QImage to a device using PngStreamWriter and PngProfileFast.
+ *
+ * Color space information is never written by PngStreamWriter, so unlike
+ * writeImageDeviceAgnostic() there is no need to modify the input.
+ */
+static bool writeFastPng(QIODevice* device,
+						 const QImage& input,
+						 bool vanityPlate)
+{
+	PngStreamWriter writer{device, input.width(), input.height(), vanityPlate, PngProfileFast};
+
+	return writer.write(input) && writer.finish();
+}
+
+/**
+ * Writes a QImage to a device as a PNG file, using a palette if possible (see
+ * writePng()).
+ */
+static bool writePngDevice(QIODevice* device,
+						   QImage& input,
+						   bool vanityPlate,
+						   PngProfile profile)
 {
-	static QString stamp = QString{"Generated by Wespal v%1"}.arg(MOS_VERSION);
+	// Qt writes Indexed8 images as palette PNG files, including a tRNS chunk
+	// if any color table entries are translucent
+	if (input.format() != QImage::Format_Indexed8) {
+		auto indexed = toIndexedImage(input);
+
+		if (!indexed.isNull()) {
+			QImageWriter out{device, "PNG"};
+			return writeImageDeviceAgnostic(out, indexed, vanityPlate, profile);
+		}
+
+		if (profile == PngProfileFast)
+			return writeFastPng(device, input, vanityPlate);
+	}
 
-	QImageWriter out{fileName, "PNG"};
+	QImageWriter out{device, "PNG"};
 
-	return writeImageDeviceAgnostic(out, input, vanityPlate);
+	return writeImageDeviceAgnostic(out, input, vanityPlate, profile);
 }
 
-QString writeBase64Png(QImage& input, bool dataUri)
+bool writePng(QImage& input, const QString& fileName, bool vanityPlate, PngProfile profile)
 {
-	QString res;
+	MOS_TRACE_SPAN("encode", "writePng", input.size());
+
+	QFile out{fileName};
+
+	if (!out.open(QIODevice::WriteOnly))
+		return false;
+
+	return writePngDevice(&out, input, vanityPlate, profile);
+}
+
+bool recolorImageFile(const QString& inputFileName,
+					  const QList<CompiledColorMap>& colorMaps,
+					  const QStringList& outputFileNames,
+					  QStringList& failed,
+					  bool vanityPlate,
+					  PngProfile profile)
+{
+	MOS_TRACE_SPAN("recolor", "recolorImageFile");
+
+	Q_ASSERT(colorMaps.count() == outputFileNames.count());
+
+	failed.clear();
+
+	ImageStripReader reader{inputFileName};
+
+	if (!reader.open()) {
+		failed = outputFileNames;
+		return false;
+	}
+
+	const auto size = reader.size();
+	const int stripRows = int(qBound(qint64(1),
+									 STREAMING_STRIP_SIZE / (qint64(size.width()) * 4),
+									 qint64(size.height())));
+
+	std::vector<std::unique_ptr<QSaveFile>> files;
+	std::vector<std::unique_ptr<PngStreamWriter>> writers;
+
+	for (const auto& fileName : outputFileNames)
+	{
+		auto& file = files.emplace_back(new QSaveFile{fileName});
+		file->open(QIODevice::WriteOnly);
+		writers.emplace_back(new PngStreamWriter{file.get(), size.width(), size.height(), vanityPlate, profile});
+	}
+
+	while (!reader.atEnd())
+	{
+		const auto& strip = reader.read(stripRows);
+
+		if (strip.isNull()) {
+			// Nothing gets committed, so no partial files are left behind
+			failed = outputFileNames;
+			return false;
+		}
+
+		const auto& outputs = recolorImages(strip, colorMaps);
+
+		for (std::size_t k = 0; k < writers.size(); ++k)
+		{
+			writers[k]->write(outputs[qsizetype(k)]);
+		}
+	}
+
+	for (std::size_t k = 0; k < writers.size(); ++k)
+	{
+		if (!writers[k]->finish() || !files[k]->commit())
+			failed.push_back(outputFileNames[qsizetype(k)]);
+	}
+
+	return true;
+}
+
+QByteArray writePngData(QImage& input, bool vanityPlate, PngProfile profile)
+{
+	MOS_TRACE_SPAN("encode", "writePngData", input.size());
+
 	QByteArray data;
 	QBuffer buf{&data};
-	QImageWriter out{&buf, "PNG"};
 
-	if (writeImageDeviceAgnostic(out, input)) {
+	if (!buf.open(QIODevice::WriteOnly) || !writePngDevice(&buf, input, vanityPlate, profile))
+		return {};
+
+	return data;
+}
+
+QString writeBase64Png(QImage& input, bool dataUri, PngProfile profile)
+{
+	MOS_TRACE_SPAN("encode", "writeBase64Png", input.size());
+
+	QString res;
+	const auto& data = writePngData(input, false, profile);
+
+	if (!data.isEmpty()) {
 		if (dataUri)
 			res = "data:image/png;base64,";
 		res.append(data.toBase64());
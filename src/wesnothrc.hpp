@@ -22,10 +22,12 @@
 #pragma once
 
 #include "colortypes.hpp"
+#include "imagestream.hpp"
 
+#include <QHash>
+#include <QImage>
 #include <QString>
-
-class QImage;
+#include <QStringList>
 
 /**
  * A color range definition is made of four reference RGB colors, used
@@ -57,10 +59,10 @@ public:
 	 * @param min Minimum color shade
 	 * @param rep High-contrast icon color
 	 */
-	ColorRange(QRgb mid = 0x808080,
-			   QRgb max = 0xFFFFFF,
-			   QRgb min = 0x000000,
-			   QRgb rep = 0x808080)
+	constexpr ColorRange(QRgb mid = 0x808080,
+						 QRgb max = 0xFFFFFF,
+						 QRgb min = 0x000000,
+						 QRgb rep = 0x808080)
 		: mid_(mid)
 		, max_(max)
 		, min_(min)
@@ -71,7 +73,7 @@ public:
 	/**
 	 * Average color shade.
 	 */
-	QRgb mid() const
+	constexpr QRgb mid() const
 	{
 		return mid_;
 	}
@@ -87,7 +89,7 @@ public:
 	/**
 	 * Maximum color shade.
 	 */
-	QRgb max() const
+	constexpr QRgb max() const
 	{
 		return max_;
 	}
@@ -103,7 +105,7 @@ public:
 	/**
 	 * Minimum color shade.
 	 */
-	QRgb min() const
+	constexpr QRgb min() const
 	{
 		return min_;
 	}
@@ -119,7 +121,7 @@ public:
 	/**
 	 * High-contrast icon color.
 	 */
-	QRgb rep() const
+	constexpr QRgb rep() const
 	{
 		return rep_;
 	}
@@ -143,7 +145,122 @@ public:
 	 */
 	ColorMap applyToPalette(const ColorList& palette) const;
 
+	/**
+	 * Transforms a single color from a source palette.
+	 *
+	 * This is the building block of applyToPalette(), exposed so that color
+	 * maps for built-in definitions may be generated at compile time.
+	 *
+	 * @param referenceColor First color of the source palette.
+	 * @param color          Source palette color to transform.
+	 *
+	 * @return The transformed color, with an alpha value of 255.
+	 */
+	constexpr QRgb applyToColor(QRgb referenceColor, QRgb color) const
+	{
+		const int referenceAvg = (qRed(referenceColor) + qGreen(referenceColor) + qBlue(referenceColor)) / 3;
+		const int oldAvg = (qRed(color) + qGreen(color) + qBlue(color)) / 3;
+
+		if (referenceAvg && oldAvg <= referenceAvg) {
+			const auto ratio = fixedPointRatio(oldAvg, referenceAvg);
+			return qRgb(interpolate(ratio, qRed(mid_), qRed(min_)),
+						interpolate(ratio, qGreen(mid_), qGreen(min_)),
+						interpolate(ratio, qBlue(mid_), qBlue(min_)));
+		}
+
+		// If referenceAvg is 255 we can only get here with oldAvg > 255,
+		// which is impossible, so there is no division by zero to worry about
+		const auto ratio = fixedPointRatio(255 - oldAvg, 255 - referenceAvg);
+		return qRgb(interpolate(ratio, qRed(mid_), qRed(max_)),
+					interpolate(ratio, qGreen(mid_), qGreen(max_)),
+					interpolate(ratio, qBlue(mid_), qBlue(max_)));
+	}
+
 private:
+	//
+	// Wesnoth computes color range transforms using single precision floating
+	// point arithmetic, and its rounding errors make a difference in the
+	// results for a few of the built-in color ranges and palettes. Rather
+	// than using floats, we emulate them exactly with 32.32 fixed point
+	// integers, rounding every intermediate result to 24 significant bits
+	// (the precision of a float) just like the FPU does. Since every value
+	// involved is non-negative and within range, nothing else about floats
+	// needs to be emulated.
+	//
+
+	static constexpr int FIXED_POINT_SHIFT = 32;
+
+	static constexpr quint64 FIXED_POINT_ONE = quint64(1) << FIXED_POINT_SHIFT;
+
+	/**
+	 * Rounds a value to 24 significant bits, with ties to even.
+	 */
+	static constexpr quint64 roundToFloat(quint64 value)
+	{
+		int bits = 0;
+
+		for (int step = 32; step; step /= 2)
+		{
+			if (value >> (bits + step))
+				bits += step;
+		}
+
+		// bits is now the index of the most significant bit set
+		if (bits < 24)
+			return value;
+
+		const int shift = bits - 23;
+		const quint64 half = quint64(1) << (shift - 1);
+		const quint64 remainder = value & ((quint64(1) << shift) - 1);
+		quint64 mantissa = value >> shift;
+
+		if (remainder > half || (remainder == half && (mantissa & 1)))
+			++mantissa;
+
+		return mantissa << shift;
+	}
+
+	/**
+	 * Calculates numerator / denominator rounded to 24 significant bits.
+	 *
+	 * The numerator must not be greater than the denominator, and the
+	 * denominator must not be greater than 255.
+	 */
+	static constexpr quint64 fixedPointRatio(int numerator, int denominator)
+	{
+		if (numerator <= 0 || denominator <= 0)
+			return 0;
+
+		// Scale the dividend so the quotient has exactly 24 significant bits,
+		// which takes at most 31 bits given the operand ranges
+		int scale = 23;
+
+		while ((quint64(numerator) << scale) < (quint64(denominator) << 23))
+			++scale;
+
+		const quint64 dividend = quint64(numerator) << scale;
+		const quint64 remainder = dividend % quint64(denominator);
+		quint64 mantissa = dividend / quint64(denominator);
+
+		if (2 * remainder > quint64(denominator) ||
+			(2 * remainder == quint64(denominator) && (mantissa & 1)))
+			++mantissa;
+
+		return mantissa << (FIXED_POINT_SHIFT - scale);
+	}
+
+	/**
+	 * Calculates ratio * a + (1 - ratio) * b, truncated to an integer.
+	 */
+	static constexpr int interpolate(quint64 ratio, int a, int b)
+	{
+		const auto complement = roundToFloat(FIXED_POINT_ONE - ratio);
+		const auto sum = roundToFloat(roundToFloat(ratio * quint64(a)) +
+									  roundToFloat(complement * quint64(b)));
+
+		return int(sum >> FIXED_POINT_SHIFT);
+	}
+
 	QRgb mid_ , max_ , min_, rep_;
 };
 
@@ -163,6 +280,266 @@ inline bool operator==(const ColorRange& a, const ColorRange& b)
 		   a.min() == b.min();
 }
 
+inline size_t qHash(const ColorRange& colorRange, size_t seed = 0)
+{
+	// Consistent with operator==, the icon color is not taken into account
+	return qHashMulti(seed, colorRange.mid(), colorRange.max(), colorRange.min());
+}
+
+/**
+ * A color map compiled into a flat lookup table.
+ *
+ * ColorMap is convenient for building and comparing color maps, but walking
+ * a red-black tree for every pixel of a large image is very slow. This class
+ * takes a ColorMap and turns it into an open-addressing hash table keyed on
+ * the RGB portion of each color, which provides O(1) lookups and fits in the
+ * CPU's L1 cache for any realistic palette size.
+ *
+ * Objects of this class are immutable and implicitly shared, so they may be
+ * built once and reused for recoloring any number of images, including from
+ * multiple threads.
+ */
+class CompiledColorMap
+{
+public:
+	/**
+	 * Constructs an empty color map.
+	 */
+	CompiledColorMap();
+
+	/**
+	 * Compiles a color map.
+	 *
+	 * @param colorMap     Source color map. Alpha values in both its keys and
+	 *                     values are ignored.
+	 */
+	explicit CompiledColorMap(const ColorMap& colorMap);
+
+	/**
+	 * Returns whether this color map is empty.
+	 */
+	bool isEmpty() const
+	{
+		return count_ == 0;
+	}
+
+	/**
+	 * Returns the number of colors mapped.
+	 */
+	qsizetype count() const
+	{
+		return count_;
+	}
+
+	/**
+	 * Returns the (RGB) colors mapped, in no particular order.
+	 */
+	ColorList keys() const;
+
+	/**
+	 * Looks up a color.
+	 *
+	 * @param color        Color to look up. The alpha channel is ignored.
+	 * @param result       Set to the mapped color (with an alpha value of
+	 *                     zero) if a match is found, left untouched otherwise.
+	 *
+	 * @return Whether a match was found.
+	 */
+	bool find(QRgb color, QRgb& result) const
+	{
+		const auto key = color & 0xFFFFFFU;
+		const auto* slots = slots_.constData();
+
+		for (auto i = slotIndex(key);; i = (i + 1) & mask_)
+		{
+			if (slots[i].key == key) {
+				result = slots[i].value;
+				return true;
+			} else if (slots[i].key == EMPTY_SLOT) {
+				return false;
+			}
+		}
+	}
+
+private:
+	struct Slot
+	{
+		QRgb key;
+		QRgb value;
+	};
+
+	// Keys never have alpha set so this can't clash with an actual color
+	static constexpr QRgb EMPTY_SLOT = 0xFFFFFFFFU;
+
+	quint32 slotIndex(QRgb key) const
+	{
+		// Fibonacci hashing
+		return (key * 0x9E3779B1U) >> shift_;
+	}
+
+	QList<Slot> slots_;
+	quint32 mask_;
+	quint32 shift_;
+	qsizetype count_;
+};
+
+/**
+ * A cache of compiled color maps.
+ *
+ * Generating color maps through ColorRange::applyToPalette() is relatively
+ * expensive, so this class memoizes the results, keyed on the inputs used to
+ * generate them. Since the compiled color maps returned are immutable and
+ * implicitly shared, the cached copies can be handed out at no cost.
+ *
+ * Color maps for built-in color ranges and palettes are never calculated at
+ * all, but taken from the tables generated at compile time instead (see
+ * wesnoth::precomputedColorMap()).
+ *
+ * Entries never become stale as a result of user definitions being edited,
+ * since they are keyed on the actual color values, but clear() may be used
+ * to release entries that are no longer needed.
+ *
+ * This class is not thread-safe.
+ */
+class ColorMapCache
+{
+public:
+	ColorMapCache();
+
+	/**
+	 * Returns the result of applying a color range to a palette.
+	 */
+	CompiledColorMap colorRangeMap(const ColorRange& colorRange,
+								   const ColorList& palette);
+
+	/**
+	 * Returns the result of generating a color map from two palettes.
+	 */
+	CompiledColorMap paletteSwapMap(const ColorList& srcPalette,
+									const ColorList& newPalette);
+
+	/**
+	 * Removes all entries.
+	 */
+	void clear();
+
+private:
+	// Upper bound on the number of entries, just in case
+	static constexpr qsizetype MAX_ENTRIES = 256;
+
+	struct ColorRangeKey
+	{
+		ColorRange colorRange;
+		ColorList palette;
+
+		friend bool operator==(const ColorRangeKey& a, const ColorRangeKey& b)
+		{
+			return a.colorRange == b.colorRange && a.palette == b.palette;
+		}
+
+		friend size_t qHash(const ColorRangeKey& key, size_t seed = 0)
+		{
+			return qHashMulti(seed, key.colorRange, key.palette);
+		}
+	};
+
+	using PaletteSwapKey = std::pair<ColorList, ColorList>;
+
+	QHash<ColorRangeKey, CompiledColorMap> colorRangeMaps_;
+	QHash<PaletteSwapKey, CompiledColorMap> paletteSwapMaps_;
+};
+
+/**
+ * An index of the pixels in an image that match a set of key colors.
+ *
+ * In most Wesnoth sprites, team color pixels only make up a small fraction
+ * of the image. This class scans an image once and records the runs of
+ * pixels whose RGB values are present in a key palette, so that subsequent
+ * recolors using color maps derived from that palette (e.g. through
+ * ColorRange::applyToPalette() or generateColorMap()) only need to touch
+ * those pixels. Indexed8 images only need their color table to be indexed
+ * instead.
+ *
+ * Objects of this class are implicitly shared and may be used from multiple
+ * threads.
+ */
+class KeyColorIndex
+{
+public:
+	/**
+	 * Constructs an empty index.
+	 */
+	KeyColorIndex();
+
+	/**
+	 * Indexes an image.
+	 *
+	 * @param input        Input image.
+	 * @param keyColors    Key palette. Alpha values are ignored.
+	 */
+	KeyColorIndex(const QImage& input, const ColorList& keyColors);
+
+	/**
+	 * Returns the indexed image, in Indexed8 format if the input image was
+	 * an Indexed8 image, or in ARGB32 format otherwise.
+	 */
+	const QImage& image() const
+	{
+		return image_;
+	}
+
+	/**
+	 * Returns the key palette used for building the index.
+	 */
+	const ColorList& keyColors() const
+	{
+		return keys_;
+	}
+
+	/**
+	 * Returns the number of pixels matching a key color.
+	 */
+	qsizetype pixelCount() const
+	{
+		return pixelCount_;
+	}
+
+	/**
+	 * Returns whether this is an index of the specified image and palette.
+	 */
+	bool matches(const QImage& input, const ColorList& keyColors) const;
+
+	/**
+	 * Recolors the indexed image using the specified compiled color map.
+	 *
+	 * This produces the same results as recolorImage() as long as the color
+	 * map only uses colors from the key palette as keys. Other colors in the
+	 * color map are ignored.
+	 *
+	 * @param colorMap     A compiled color map to use for transforming the
+	 *                     image.
+	 *
+	 * @return A recolored image, in the same format as image().
+	 */
+	QImage recolor(const CompiledColorMap& colorMap) const;
+
+private:
+	struct Span
+	{
+		int x;
+		int y;
+		int length;
+	};
+
+	QImage image_;
+	ColorList keys_;
+	QList<Span> spans_;
+	QList<quint32> pixelKeys_;
+	// Key palette positions of each color table entry (Indexed8 only)
+	QList<quint32> tableKeys_;
+	qsizetype pixelCount_;
+};
+
 /**
  * Converts a source palette using the specified color_range object.
  * This holds the main interface for range-based recoloring.
@@ -221,9 +598,41 @@ QString wmlFromColorRange(const QString& name,
 QString wmlFromColorList(const QString& name,
 						 const ColorList& palette);
 
+/**
+ * Converts an image to a format suitable for recoloring.
+ *
+ * Indexed8 images are returned unchanged, since all the recoloring functions
+ * below only need to transform their color table (which is much cheaper than
+ * transforming every pixel). Images in any other format are converted to
+ * ARGB32, since that's the only format we (and Wesnoth) currently understand.
+ *
+ * @param input        Input image.
+ *
+ * @return An image in either Indexed8 or ARGB32 format.
+ */
+QImage toWorkingFormat(const QImage& input);
+
+/**
+ * Converts an image to Indexed8 format without losing any information.
+ *
+ * This is only possible if the image contains at most 256 distinct ARGB
+ * values, which is the case for most Wesnoth sprites. The scan stops as soon
+ * as a 257th color is found, so images with more colors are rejected early.
+ *
+ * @param input        Input image.
+ *
+ * @return An Indexed8 image whose color table contains every distinct ARGB
+ *         value in the input in order of appearance, @a input itself if it
+ *         is already an Indexed8 image, or a null image if the input has
+ *         more than 256 colors.
+ */
+QImage toIndexedImage(const QImage& input);
+
 /**
  * Extracts a set of unique colors in an image.
  *
+ * Large images are scanned in parallel using multiple threads.
+ *
  * @param input        Input image.
  *
  * @return An ordered set of unique colors found in the input, with alpha
@@ -231,6 +640,35 @@ QString wmlFromColorList(const QString& name,
  */
 ColorSet uniqueColorsFromImage(const QImage& input);
 
+/**
+ * Histogram of the colors found in an image.
+ */
+struct ColorHistogram
+{
+	/** Unique colors in ascending order, with alpha values set to zero. */
+	ColorList colors;
+	/** Number of pixels of each color, in the same order as colors. */
+	QList<qsizetype> counts;
+
+	/**
+	 * Returns the colors sorted by descending pixel count. Colors with the
+	 * same pixel count are listed in ascending order.
+	 */
+	ColorList mostFrequentColors() const;
+};
+
+/**
+ * Counts the pixels of each unique color in an image.
+ *
+ * Large images are scanned in parallel using multiple threads.
+ *
+ * @param input        Input image.
+ *
+ * @return A color histogram. Pixels differing only in their alpha values are
+ *         counted as the same color.
+ */
+ColorHistogram colorHistogramFromImage(const QImage& input);
+
 /**
  * Recolors a QImage using the specified color map.
  *
@@ -241,12 +679,46 @@ ColorSet uniqueColorsFromImage(const QImage& input);
  *
  * @param colorMap     A color map to use for transforming the image.
  *
- * @return A recolored image, always in ARGB32 format regardless of the input
- *         format.
+ * @return A recolored image, in Indexed8 format if the input is an Indexed8
+ *         image, or in ARGB32 format otherwise.
  */
 QImage recolorImage(const QImage& input,
 					const ColorMap& colorMap);
 
+/**
+ * Recolors a QImage using the specified compiled color map.
+ *
+ * This is the preferred version when the same color map is used to recolor
+ * multiple images, since the color map only needs to be compiled once.
+ *
+ * @param input        Input image.
+ *
+ * @param colorMap     A compiled color map to use for transforming the image.
+ *
+ * @return A recolored image, in Indexed8 format if the input is an Indexed8
+ *         image, or in ARGB32 format otherwise.
+ */
+QImage recolorImage(const QImage& input,
+					const CompiledColorMap& colorMap);
+
+/**
+ * Recolors a QImage using multiple compiled color maps in a single pass.
+ *
+ * This produces the same results as calling recolorImage() once for every
+ * color map, but each pixel of the input is only read and looked up once,
+ * regardless of the number of color maps used.
+ *
+ * @param input        Input image.
+ *
+ * @param colorMaps    Compiled color maps to use for transforming the image.
+ *
+ * @return A list of recolored images, in the same order as @a colorMaps,
+ *         in Indexed8 format if the input is an Indexed8 image, or in ARGB32
+ *         format otherwise.
+ */
+QList<QImage> recolorImages(const QImage& input,
+							const QList<CompiledColorMap>& colorMaps);
+
 /**
  * Tints a QImage with the specified color.
  *
@@ -258,8 +730,8 @@ QImage recolorImage(const QImage& input,
  *                     outside the range will be bound to the closest legal
  *                     value.
  *
- * @return A recolored image, always in ARGB32 format regardless of the input
- *         format.
+ * @return A recolored image, in Indexed8 format if the input is an Indexed8
+ *         image, or in ARGB32 format otherwise.
  */
 QImage colorBlendImage(const QImage& input,
 					   const QColor& color,
@@ -276,14 +748,126 @@ QImage colorBlendImage(const QImage& input,
  *
  * @param blueShift    Shift value for the blue channel between -255 and 255.
  *
- * @return A recolored image, always in ARGB32 format regardless of the input
- *         format.
+ * @return A recolored image, in Indexed8 format if the input is an Indexed8
+ *         image, or in ARGB32 format otherwise.
  */
 QImage colorShiftImage(const QImage& input,
 					   int redShift,
 					   int greenShift,
 					   int blueShift);
 
+/**
+ * A chain of Wesnoth image path functions compiled into a single pass.
+ *
+ * Chains are written in the same syntax used in WML image paths (minus the
+ * file name), e.g. "~RC(magenta>red)~CS(10,0,-5)~BLEND(255,0,0,0.3)", and
+ * produce the same results as Wesnoth. As in Wesnoth, ~RC() and ~PAL() run
+ * before every other function in the chain, in the order in which they
+ * appear. The following functions are supported:
+ *
+ *  - ~RC(palette>color range): The color range may be given as an id, a side
+ *    number, or a list of 3 or 4 colors (see ColorRange).
+ *  - ~PAL(palette>palette)
+ *  - ~BLEND(r,g,b,opacity): The opacity may be given as a fraction or as a
+ *    percentage.
+ *  - ~CS(r,g,b), ~R(r), ~G(g), ~B(b)
+ *
+ * Palettes may be given as ids or as comma-separated lists of hex colors.
+ *
+ * Rather than running each function as a separate pass over a whole image
+ * like recolorImage(), colorBlendImage() and colorShiftImage() do, apply()
+ * reads each pixel once, runs every function on small blocks of pixels while
+ * they are still in the CPU cache, and writes each pixel once. All ~RC() and
+ * ~PAL() functions are also merged into a single color map, and functions
+ * with no effect are dropped when parsing.
+ *
+ * Objects of this class are implicitly shared, and may be used from multiple
+ * threads once parsed.
+ */
+class ImagePathFunctionChain
+{
+public:
+	/**
+	 * Constructs an empty chain, which leaves images unchanged.
+	 */
+	ImagePathFunctionChain();
+
+	/**
+	 * Parses a chain of image path functions, replacing the current one.
+	 *
+	 * @param functions    Image path functions.
+	 * @param colorRanges  Color ranges available to ~RC(), by id.
+	 * @param palettes     Palettes available to ~RC() and ~PAL(), by id.
+	 * @param error        If not null, set to a description of the problem
+	 *                     when parsing fails.
+	 *
+	 * @return Whether parsing succeeded. On failure, the current chain is left
+	 *         untouched.
+	 */
+	bool parse(const QString& functions,
+			   const QMap<QString, ColorRange>& colorRanges,
+			   const QMap<QString, ColorList>& palettes,
+			   QString* error = nullptr);
+
+	/**
+	 * Returns whether this chain has no effect.
+	 */
+	bool isEmpty() const
+	{
+		return steps_.isEmpty();
+	}
+
+	/**
+	 * Returns the number of steps this chain runs for each block of pixels,
+	 * after merging and dropping functions.
+	 */
+	qsizetype stepCount() const
+	{
+		return steps_.count();
+	}
+
+	/**
+	 * Runs the chain on an image.
+	 *
+	 * Large images are processed in parallel using multiple threads, except
+	 * within a MosIO::SerialCompressionScope.
+	 *
+	 * @param input        Input image.
+	 *
+	 * @return A new image, in Indexed8 format if the input is an Indexed8
+	 *         image, or in ARGB32 format otherwise.
+	 */
+	QImage apply(const QImage& input) const;
+
+	/**
+	 * Runs the chain in-place on a list of ARGB32 pixels or colors.
+	 */
+	void applyToLine(QRgb* line, qsizetype count) const;
+
+private:
+	enum StepType
+	{
+		StepColorMap,
+		StepColorBlend,
+		StepColorShift,
+	};
+
+	struct Step
+	{
+		StepType type;
+		CompiledColorMap colorMap;
+		QRgb color;
+		quint16 ratio;
+		int redShift;
+		int greenShift;
+		int blueShift;
+	};
+
+	static void appendStep(QList<Step>& steps, const Step& step);
+
+	QList<Step> steps_;
+};
+
 namespace MosIO {
 
 /**
@@ -294,13 +878,73 @@ namespace MosIO {
  * @param vanityPlate  Whether to include a tEXt chunk for a Software comment
  *                     including the software name and version used to save
  *                     the PNG file.
+ * @param profile      Encoder profile.
+ *
+ * Images with at most 256 distinct colors are written as 8-bit palette PNG
+ * files (with a tRNS chunk for translucent colors) regardless of @a profile,
+ * since they are both smaller and faster to encode than RGBA files with the
+ * exact same contents (see toIndexedImage()). Other images are written as
+ * 8-bit RGBA files, using PngStreamWriter for PngProfileFast.
+ *
+ * @note @a input is assumed to be in ARGB32 or Indexed8 format, although
+ *       this is not a particularly significant assumption anyway. More
+ *       importantly, this function may MODIFY its input to ensure that its
+ *       color space configuration is correct for the intended output
+ *       format.
+ */
+bool writePng(QImage& input,
+			  const QString& fileName,
+			  bool vanityPlate = true,
+			  PngProfile profile = PngProfileSmallest);
+
+/**
+ * Recolors an image file with multiple color maps, writing the results to
+ * disk as PNG files.
+ *
+ * Unlike loading the input into a QImage and using recolorImages() and
+ * writePng(), this reads, recolors and encodes the image in strips of
+ * scanlines, so memory use is bounded by the strip size rather than the
+ * image size (see ImageStripReader for the input formats this applies to).
+ * Output files are only created once they have been written successfully.
+ *
+ * @param inputFileName    Input image file name.
+ * @param colorMaps        Compiled color maps to use for transforming the
+ *                         image.
+ * @param outputFileNames  Output file names, in the same order as
+ *                         @a colorMaps.
+ * @param failed           Set to the output file names that could not be
+ *                         written.
+ * @param vanityPlate      See writePng().
+ * @param profile          Encoder profile.
+ *
+ * @return Whether the input image could be read. If not, no output files are
+ *         written and all of them are listed in @a failed.
+ */
+bool recolorImageFile(const QString& inputFileName,
+					  const QList<CompiledColorMap>& colorMaps,
+					  const QStringList& outputFileNames,
+					  QStringList& failed,
+					  bool vanityPlate = true,
+					  PngProfile profile = PngProfileSmallest);
+
+/**
+ * Writes a QImage to a byte array as a PNG file.
+ *
+ * @param input        Input image (see notes).
+ * @param vanityPlate  See writePng().
+ * @param profile      Encoder profile (see writePng()).
+ *
+ * @return The PNG file data, or an empty byte array on failure.
  *
- * @note @a input is assumed to be in ARGB32 format, although this is not
- *       a particularly significant assumption anyway. More importantly, this
- *       function may MODIFY its input to ensure that its color space
- *       configuration is correct for the intended output format.
+ * @note @a input is assumed to be in ARGB32 or Indexed8 format, although
+ *       this is not a particularly significant assumption anyway. More
+ *       importantly, this function may MODIFY its input to ensure that its
+ *       color space configuration is correct for the intended output
+ *       format.
  */
-bool writePng(QImage& input, const QString& fileName, bool vanityPlate = true);
+QByteArray writePngData(QImage& input,
+						bool vanityPlate = false,
+						PngProfile profile = PngProfileSmallest);
 
 /**
  * Writes a QImage to a string as Base64 data containing a valid PNG file.
@@ -308,13 +952,17 @@ bool writePng(QImage& input, const QString& fileName, bool vanityPlate = true);
  * @param input        Input image (see notes).
  * @param dataUri      Formats the buffer as an RFC 2397 data URI. If false
  *                     (the default) a naked PNG file will be written instead.
+ * @param profile      Encoder profile (see writePng()).
  *
- * @note @a input is assumed to be in ARGB32 format, although this is not
- *       a particularly significant assumption anyway. More importantly, this
- *       function may MODIFY its input to ensure that its color space
- *       configuration is correct for the intended output format.
+ * @note @a input is assumed to be in ARGB32 or Indexed8 format, although
+ *       this is not a particularly significant assumption anyway. More
+ *       importantly, this function may MODIFY its input to ensure that its
+ *       color space configuration is correct for the intended output
+ *       format.
  */
-QString writeBase64Png(QImage& input, bool dataUri = false);
+QString writeBase64Png(QImage& input,
+					   bool dataUri = false,
+					   PngProfile profile = PngProfileSmallest);
 
 /**
  * Writes a palette to disk in GIMP palette (.gpl) format.